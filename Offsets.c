@@ -77,6 +77,7 @@ int main( void ) {
     printf( "   stack:\t%d\n", (char *)&pcb.stack - (char *)&pcb );
     printf( "   exit_status:\t%d\n", (char *)&pcb.exit_status - (char *)&pcb );
     printf( "   event:\t%d\n", (char *)&pcb.event - (char *)&pcb );
+    printf( "   timer:\t%d\n", (char *)&pcb.timer - (char *)&pcb );
     printf( "   pid:\t\t%d\n", (char *)&pcb.pid - (char *)&pcb );
     printf( "   ppid:\t%d\n", (char *)&pcb.ppid - (char *)&pcb );
 
@@ -0,0 +1,275 @@
+/*
+** File:	ProfReport.c
+**
+** Author:	CSCI-452 class of 20205
+**
+** Description:	Symbolize the kernel profiler's samples.
+**
+**		Reads a namelist for prog.o and the SIO output of a
+**		system built with PROFILE=n, and reports how many
+**		samples landed in each function, busiest first.
+**
+**		usage:	ProfReport [-p] namelist [ logfile ... ]
+**
+**		The namelist may be prog.nl, prog.nll, or the output of
+**		"nm -n prog.o"; the first two cut long names short to fit
+**		their columns, the last does not.  Sample lines ("@P pid
+**		eip") and drop reports ("@D n") are picked out of the
+**		log files (or standard input), and everything else in
+**		them is ignored.  With -p, samples are also separated
+**		by process.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define	TRUE	1
+#define	FALSE	0
+
+/*
+** A symbol from the namelist
+*/
+typedef struct {
+	unsigned long	addr;
+	char		*name;
+} Symbol;
+
+/*
+** One line of the report:  a function (and process, with -p)
+*/
+typedef struct {
+	int		sym;		/* index into symbols, or -1 */
+	unsigned long	pid;
+	unsigned long	count;
+} Bucket;
+
+char	*progname;		/* invocation name of this program */
+int	by_pid = FALSE;		/* separate samples by process? */
+
+Symbol	*symbols;
+int	n_symbols, max_symbols;
+
+Bucket	*buckets;
+int	n_buckets, max_buckets;
+
+unsigned long	total;		/* samples seen */
+unsigned long	dropped;	/* samples the kernel reported losing */
+
+void quit( char *msg, char *arg ) {
+	fprintf( stderr, "%s: %s", progname, msg );
+	if( arg != NULL ){
+		fprintf( stderr, " '%s'", arg );
+	}
+	fputc( '\n', stderr );
+	exit( EXIT_FAILURE );
+}
+
+void usage( void ) {
+	fprintf( stderr, "usage: %s [-p] namelist [ logfile ... ]\n",
+		progname );
+	exit( EXIT_FAILURE );
+}
+
+void *grow( void *array, int *max, size_t size ) {
+	*max = *max ? *max * 2 : 256;
+	array = realloc( array, *max * size );
+	if( array == NULL ){
+		quit( "out of memory", NULL );
+	}
+	return array;
+}
+
+/*
+** Is this token an address?  nm prints them as 8 hex digits.
+*/
+int is_addr( char *tok ) {
+	int	i;
+
+	for( i = 0; tok[i] != '\0'; ++i ){
+		if( !isxdigit( (unsigned char) tok[i] ) ){
+			return FALSE;
+		}
+	}
+	return i == 8;
+}
+
+/*
+** Read the namelist, keeping the text symbols.  Every "address type
+** name" triple is a symbol, however many of them are on a line.
+*/
+void read_namelist( char *path ) {
+	FILE	*fp;
+	char	line[ 512 ];
+	char	*tok[ 64 ];
+	int	n, i;
+
+	fp = fopen( path, "r" );
+	if( fp == NULL ){
+		quit( "can't open", path );
+	}
+
+	while( fgets( line, sizeof( line ), fp ) != NULL ){
+		n = 0;
+		for( tok[n] = strtok( line, " \t\n" ); tok[n] != NULL && n < 63;
+		     tok[n] = strtok( NULL, " \t\n" ) ){
+			++n;
+		}
+
+		for( i = 0; i + 2 < n; ++i ){
+			if( !is_addr( tok[i] ) || strlen( tok[i+1] ) != 1 ){
+				continue;
+			}
+			if( strchr( "TtWw", tok[i+1][0] ) != NULL ){
+				if( n_symbols == max_symbols ){
+					symbols = grow( symbols, &max_symbols,
+						sizeof( Symbol ) );
+				}
+				symbols[n_symbols].addr =
+					strtoul( tok[i], NULL, 16 );
+				symbols[n_symbols].name = strdup( tok[i+2] );
+				++n_symbols;
+			}
+			i += 2;
+		}
+	}
+
+	fclose( fp );
+}
+
+int by_addr( const void *a, const void *b ) {
+	const Symbol *sa = a, *sb = b;
+
+	return ( sa->addr > sb->addr ) - ( sa->addr < sb->addr );
+}
+
+int by_count( const void *a, const void *b ) {
+	const Bucket *ba = a, *bb = b;
+
+	if( ba->count != bb->count ){
+		return ( ba->count < bb->count ) - ( ba->count > bb->count );
+	}
+	return ( ba->pid > bb->pid ) - ( ba->pid < bb->pid );
+}
+
+/*
+** Find the symbol an address belongs to:  the last one at or below it
+*/
+int lookup( unsigned long addr ) {
+	int	lo = 0, hi = n_symbols - 1, found = -1;
+
+	while( lo <= hi ){
+		int mid = ( lo + hi ) / 2;
+		if( symbols[mid].addr <= addr ){
+			found = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return found;
+}
+
+void add_sample( unsigned long pid, unsigned long eip ) {
+	int	sym = lookup( eip );
+	int	i;
+
+	if( !by_pid ){
+		pid = 0;
+	}
+
+	++total;
+	for( i = 0; i < n_buckets; ++i ){
+		if( buckets[i].sym == sym && buckets[i].pid == pid ){
+			++buckets[i].count;
+			return;
+		}
+	}
+
+	if( n_buckets == max_buckets ){
+		buckets = grow( buckets, &max_buckets, sizeof( Bucket ) );
+	}
+	buckets[n_buckets].sym = sym;
+	buckets[n_buckets].pid = pid;
+	buckets[n_buckets].count = 1;
+	++n_buckets;
+}
+
+void read_log( FILE *fp ) {
+	char	line[ 512 ];
+	char	*p;
+	unsigned long	a, b;
+
+	while( fgets( line, sizeof( line ), fp ) != NULL ){
+		if( ( p = strstr( line, "@P " ) ) != NULL ){
+			if( sscanf( p + 3, "%lx %lx", &a, &b ) == 2 ){
+				add_sample( a, b );
+			}
+		} else if( ( p = strstr( line, "@D " ) ) != NULL ){
+			if( sscanf( p + 3, "%lx", &a ) == 1 ){
+				dropped += a;
+			}
+		}
+	}
+}
+
+int main( int ac, char **av ) {
+	int	i;
+
+	progname = av[0];
+
+	for( i = 1; i < ac && av[i][0] == '-'; ++i ){
+		if( strcmp( av[i], "-p" ) == 0 ){
+			by_pid = TRUE;
+		} else {
+			usage();
+		}
+	}
+	if( i >= ac ){
+		usage();
+	}
+
+	read_namelist( av[i++] );
+	if( n_symbols == 0 ){
+		quit( "no text symbols in", av[i-1] );
+	}
+	qsort( symbols, n_symbols, sizeof( Symbol ), by_addr );
+
+	if( i == ac ){
+		read_log( stdin );
+	}
+	for( ; i < ac; ++i ){
+		FILE *fp = fopen( av[i], "r" );
+		if( fp == NULL ){
+			quit( "can't open", av[i] );
+		}
+		read_log( fp );
+		fclose( fp );
+	}
+
+	printf( "%lu samples", total );
+	if( dropped > 0 ){
+		printf( " (%lu more dropped by the kernel)", dropped );
+	}
+	printf( "\n\n" );
+	if( total == 0 ){
+		return EXIT_SUCCESS;
+	}
+
+	qsort( buckets, n_buckets, sizeof( Bucket ), by_count );
+
+	printf( "%8s %6s  %s%s\n", "samples", "%", by_pid ? "pid   " : "",
+		"function" );
+	for( i = 0; i < n_buckets; ++i ){
+		Bucket *bk = &buckets[i];
+
+		printf( "%8lu %6.2f  ", bk->count, 100.0 * bk->count / total );
+		if( by_pid ){
+			printf( "%-5lu ", bk->pid );
+		}
+		printf( "%s\n", bk->sym < 0 ? "?" : symbols[bk->sym].name );
+	}
+
+	return EXIT_SUCCESS;
+}
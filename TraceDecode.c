@@ -0,0 +1,333 @@
+/*
+** File:	TraceDecode.c
+**
+** Author:	CSCI-452 class of 20205
+**
+** Description:	Decode the kernel's I/O trace.
+**
+**		Reads the SIO output of a system built with IOTRACE=mask
+**		and reconstructs each file system request from its trace
+**		records:  how long it waited for the I/O daemon, how long
+**		the daemon spent on it, and how much of that was spent in
+**		block layer requests and AHCI commands, or with the daemon
+**		off the CPU.  A summary by call type follows.
+**
+**		usage:	TraceDecode [-t] [ logfile ... ]
+**
+**		With -t, every record is also printed as it is read.
+**		Trace lines ("@T ..."), TSC rate lines ("@K khz") and
+**		loss reports ("@L n") are picked out of the log files
+**		(or standard input); everything else is ignored.  A loss
+**		abandons any request in progress, since its records may
+**		be incomplete.
+*/
+
+#define	SP_ASM_SRC
+
+#include "trace.h"
+#include "syscalls.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define	TRUE	1
+#define	FALSE	0
+
+/*
+** Names of the calls the daemon performs, and of the ring operations
+*/
+#define	N_CALLS		(SYS_ioring_enter + 1)
+#define	N_OPS		6
+
+char	*call_names[ N_CALLS ] = {
+	[ SYS_fcreate ] = "fcreate",	[ SYS_fdelete ] = "fdelete",
+	[ SYS_fopen ] = "fopen",	[ SYS_fclose ] = "fclose",
+	[ SYS_fread ] = "fread",	[ SYS_fwrite ] = "fwrite",
+	[ SYS_freadv ] = "freadv",	[ SYS_fwritev ] = "fwritev",
+	[ SYS_ioring_enter ] = "ioring_enter"
+};
+
+char	*op_names[ N_OPS ] = {
+	"ior:nop", "ior:read", "ior:write", "ior:readv", "ior:writev",
+	"ior:fsync"
+};
+
+/*
+** Per-type totals, indexed by call code, then by N_CALLS + ring op
+*/
+typedef struct {
+	unsigned long	count;
+	double		queue, total, blk, ahci, off, max;
+} Summary;
+
+Summary	summary[ N_CALLS + N_OPS ];
+
+/*
+** The request being performed, if any.  Ring entries are performed
+** inside an ioring_enter call (or by the daemon when it polls), so
+** one of each can be in progress at once.
+*/
+typedef struct {
+	int		active;
+	int		type;		/* index into summary */
+	unsigned long	pid;		/* who asked for it */
+	double		submit;		/* when it was queued, or -1 */
+	double		start;		/* when the daemon started it */
+	double		blk, ahci, off;	/* time spent in each */
+	int		n_blk, n_ahci;
+} Request;
+
+Request	call, ring;
+
+double		blk_start = -1, ahci_start = -1, off_start = -1;
+unsigned long	daemon_pid;
+double		submitted[ 65536 ];	/* per-PID time of last submit */
+
+char	*progname;
+int	timeline = FALSE;
+
+unsigned long	khz;
+unsigned long long	tsc0;
+unsigned long	records, lost;
+
+char *type_name( int type ) {
+	char	*name;
+
+	name = type < N_CALLS ? call_names[type] : op_names[type - N_CALLS];
+	return name != NULL ? name : "?";
+}
+
+/*
+** Convert a time stamp to microseconds since the first record
+*/
+double usec( unsigned long long tsc ) {
+	if( khz == 0 ){
+		return 0.0;
+	}
+	return (double) ( tsc - tsc0 ) * 1000.0 / khz;
+}
+
+void begin( Request *r, int type, unsigned long pid, double now ) {
+	memset( r, 0, sizeof( *r ) );
+	r->active = TRUE;
+	r->type = type;
+	r->pid = pid;
+	r->start = now;
+	r->submit = -1;
+	off_start = -1;		/* the daemon is running right now */
+	if( pid < 65536 && submitted[pid] >= 0 ){
+		r->submit = submitted[pid];
+		submitted[pid] = -1;
+	}
+}
+
+void finish( Request *r, long result, double now ) {
+	Summary	*s = &summary[ r->type ];
+	double	total = now - r->start;
+	double	queue = r->submit >= 0 ? r->start - r->submit : 0.0;
+
+	printf( "%-12s pid %-4lu queue %9.1f  run %9.1f  blk %9.1f (%d)"
+		"  ahci %9.1f (%d)  off %9.1f  => %ld\n",
+		type_name( r->type ), r->pid, queue, total, r->blk, r->n_blk,
+		r->ahci, r->n_ahci, r->off, result );
+
+	s->count += 1;
+	s->queue += queue;
+	s->total += total;
+	s->blk += r->blk;
+	s->ahci += r->ahci;
+	s->off += r->off;
+	if( total > s->max ){
+		s->max = total;
+	}
+
+	r->active = FALSE;
+}
+
+/*
+** Charge time spent in something to the requests in progress
+*/
+void charge( double t, int which ) {
+	Request	*r[ 2 ] = { &call, &ring };
+	int	i;
+
+	for( i = 0; i < 2; ++i ){
+		if( !r[i]->active ){
+			continue;
+		}
+		switch( which ){
+		case TRC_BLK_DONE:	r[i]->blk += t; r[i]->n_blk++; break;
+		case TRC_AHCI_DONE:	r[i]->ahci += t; r[i]->n_ahci++; break;
+		case TRC_DISPATCH:	r[i]->off += t; break;
+		}
+	}
+}
+
+void event( unsigned long ev, unsigned long pid, double now,
+	    unsigned long a0, unsigned long a1 ) {
+
+	switch( ev ){
+	case TRC_IOD_SUBMIT:
+		if( pid < 65536 ){
+			submitted[pid] = now;
+		}
+		break;
+
+	case TRC_FS_ENTER:
+		daemon_pid = pid;
+		begin( &call, a0 < N_CALLS ? (int) a0 : 0, a1, now );
+		break;
+
+	case TRC_FS_EXIT:
+		if( call.active ){
+			finish( &call, (long) a1, now );
+		}
+		break;
+
+	case TRC_IOR_ENTER:
+		begin( &ring, N_CALLS + ( a0 < N_OPS ? (int) a0 : 0 ),
+		       call.active ? call.pid : pid, now );
+		break;
+
+	case TRC_IOR_EXIT:
+		if( ring.active ){
+			finish( &ring, (long) a1, now );
+		}
+		break;
+
+	case TRC_BLK_ISSUE:
+		blk_start = now;
+		break;
+
+	case TRC_BLK_DONE:
+		if( blk_start >= 0 ){
+			charge( now - blk_start, TRC_BLK_DONE );
+			blk_start = -1;
+		}
+		break;
+
+	case TRC_AHCI_ISSUE:
+		ahci_start = now;
+		break;
+
+	case TRC_AHCI_DONE:
+		if( ahci_start >= 0 ){
+			charge( now - ahci_start, TRC_AHCI_DONE );
+			ahci_start = -1;
+		}
+		break;
+
+	case TRC_DISPATCH:
+		// the daemon leaving or regaining the CPU
+		if( a0 != daemon_pid && off_start < 0 ){
+			off_start = now;
+		} else if( a0 == daemon_pid && off_start >= 0 ){
+			charge( now - off_start, TRC_DISPATCH );
+			off_start = -1;
+		}
+		break;
+	}
+}
+
+/*
+** Forget everything in progress; some of its records are missing
+*/
+void gap( void ) {
+	call.active = ring.active = FALSE;
+	blk_start = ahci_start = off_start = -1;
+}
+
+void read_log( FILE *fp ) {
+	char	line[ 512 ];
+	char	*p;
+	unsigned long	seq, ev, pid, hi, lo, a0, a1, n;
+	unsigned long long	tsc;
+
+	while( fgets( line, sizeof( line ), fp ) != NULL ){
+		if( ( p = strstr( line, "@K " ) ) != NULL ){
+			sscanf( p + 3, "%lx", &khz );
+		} else if( ( p = strstr( line, "@L " ) ) != NULL ){
+			if( sscanf( p + 3, "%lx", &n ) == 1 ){
+				lost += n;
+				gap();
+				if( timeline ){
+					printf( "--- %lu records lost\n", n );
+				}
+			}
+		} else if( ( p = strstr( line, "@T " ) ) != NULL ){
+			if( sscanf( p + 3, "%lx %lx %lx %lx %lx %lx %lx", &seq,
+				    &ev, &pid, &hi, &lo, &a0, &a1 ) != 7 ){
+				continue;
+			}
+			tsc = ( (unsigned long long) hi << 32 ) | lo;
+			if( records++ == 0 ){
+				tsc0 = tsc;
+			}
+			if( timeline ){
+				printf( "%12.1f  #%-6lu pid %-4lu ev %02lx  "
+					"%08lx %08lx\n", usec( tsc ), seq,
+					pid, ev, a0, a1 );
+			}
+			event( ev, pid, usec( tsc ), a0, a1 );
+		}
+	}
+}
+
+int main( int ac, char **av ) {
+	int	i;
+	unsigned long	n;
+
+	progname = av[0];
+
+	for( i = 1; i < ac && av[i][0] == '-'; ++i ){
+		if( strcmp( av[i], "-t" ) == 0 ){
+			timeline = TRUE;
+		} else {
+			fprintf( stderr, "usage: %s [-t] [ logfile ... ]\n",
+				progname );
+			exit( EXIT_FAILURE );
+		}
+	}
+
+	for( n = 0; n < 65536; ++n ){
+		submitted[n] = -1;
+	}
+
+	printf( "all times in microseconds\n\n" );
+
+	if( i == ac ){
+		read_log( stdin );
+	}
+	for( ; i < ac; ++i ){
+		FILE *fp = fopen( av[i], "r" );
+		if( fp == NULL ){
+			fprintf( stderr, "%s: can't open '%s'\n", progname,
+				av[i] );
+			exit( EXIT_FAILURE );
+		}
+		read_log( fp );
+		fclose( fp );
+	}
+
+	printf( "\n%lu records, %lu lost", records, lost );
+	if( khz == 0 ){
+		printf( " (no TSC rate seen; times are all zero)" );
+	}
+	printf( "\n\n%-12s %6s %10s %10s %10s %10s %10s %10s\n", "call",
+		"count", "avg queue", "avg run", "avg blk", "avg ahci",
+		"avg off", "max run" );
+
+	for( i = 0; i < N_CALLS + N_OPS; ++i ){
+		Summary *s = &summary[i];
+		if( s->count == 0 ){
+			continue;
+		}
+		printf( "%-12s %6lu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+			type_name( i ), s->count, s->queue / s->count,
+			s->total / s->count, s->blk / s->count,
+			s->ahci / s->count, s->off / s->count, s->max );
+	}
+
+	return EXIT_SUCCESS;
+}
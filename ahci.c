@@ -1,3 +1,5 @@
+#define SP_KERNEL_SRC
+
 #include "ahci.h"
 #include "pci.h"
 #include "common.h"
@@ -6,6 +8,10 @@
 #include "x86pic.h"
 #include "support.h"
 #include "kmem.h"
+#include "iobuf.h"
+#include "clock.h"
+#include "lathist.h"
+#include "trace.h"
 
 static hbaMem_t* _abar;
 static hbaPort_t* _portsList[32];
@@ -29,6 +35,58 @@ static int find_cmdslot(hbaPort_t *port)
 }
 
 
+static void start_cmd(hbaPort_t *port);
+static void stop_cmd(hbaPort_t *port);
+
+// Has a wait for the HBA gone on too long?  The driver polls, since
+// nothing here takes the HBA's interrupt, and commands are issued both
+// at boot time with interrupts off and by the I/O daemon with them on,
+// so the clock tick can't be relied on.  The TSC keeps counting either
+// way, so the deadline is AHCI_CMD_MS on it; if it couldn't be
+// calibrated, the wait is bounded by AHCI_CMD_SPINS polls instead.
+static bool_t expired(uint64_t start, uint32_t spin)
+{
+   if (_clk_tsc_khz() == 0)
+      return spin >= AHCI_CMD_SPINS;
+   return _clk_ns() - start >= AHCI_CMD_MS * 1000000ULL;
+}
+
+// Wait for the command in a slot to finish.  If it takes too long,
+// the command engine is restarted to abandon the command.
+static bool_t wait_cmd(hbaPort_t *port, int slot, const char *what)
+{
+   uint64_t start = _clk_ns();
+
+   for (uint32_t spin = 0; ; spin++)
+   {
+      // In some longer duration transfers, it may be helpful to spin on
+      // the DPS bit in the PxIS port field as well (1 << 5)
+      if ((port->ci & (1<<slot)) == 0)
+         break;
+      if (port->is & HBA_PxIS_TFES) // Task file error
+      {
+         __cio_printf("\n%s disk error", what);
+         return false;
+      }
+      if (expired(start, spin))
+      {
+         __cio_printf("\n%s command timed out", what);
+         stop_cmd(port);
+         start_cmd(port);
+         return false;
+      }
+   }
+
+   // Check again
+   if (port->is & HBA_PxIS_TFES)
+   {
+      __cio_printf("\n%s disk error", what);
+      return false;
+   }
+
+   return true;
+}
+
 static bool_t get_drive_info(hbaPort_t* port, void* buf)
 {
    port->is = (uint32_t) -1;     // Clear pending interrupt bits
@@ -44,7 +102,7 @@ static bool_t get_drive_info(hbaPort_t* port, void* buf)
    cmdheader->prdtl = (uint16_t) 1;   // PRDT entries count
  
    hbaCmdTbl_t *cmdtbl = (hbaCmdTbl_t*)(cmdheader->ctba);
-   __memset(cmdtbl, 0, sizeof(hbaCmdTbl_t) +
+   __memclr(cmdtbl, sizeof(hbaCmdTbl_t) +
       (cmdheader->prdtl-1)*sizeof(hbaPrdtEntry_t));
 
    // Last entry
@@ -72,32 +130,11 @@ static bool_t get_drive_info(hbaPort_t* port, void* buf)
    }
 
    port->ci = 1<<slot;  // Issue command
- 
-   // Wait for completion
-   while (1)
-   {
-      // In some longer duration writes, it may be helpful to spin on the DPS bit 
-      // in the PxIS port field as well (1 << 5)
-      if ((port->ci & (1<<slot)) == 0) 
-         break;
-      if (port->is & HBA_PxIS_TFES) // Task file error
-      {
-         __cio_printf("\nRead disk error");
-         return false;
-      }
-   }
- 
-   // Check again
-   if (port->is & HBA_PxIS_TFES)
-   {
-      __cio_printf("\nRead disk error");
-      return false;
-   }
- 
-   return true;
+
+   return wait_cmd(port, slot, "Identify");
 }
 
-static bool_t ahci_write(hbaPort_t *port, uint32_t startl, uint32_t starth, uint32_t count, uint16_t *buf)
+static bool_t ahci_write(hbaPort_t *port, uint32_t startl, uint32_t starth, uint32_t count, uint32_t bytes, uint16_t *buf)
 {
    port->is = (uint32_t) -1;     // Clear pending interrupt bits
    int spin = 0; // Spin lock timeout counter
@@ -109,25 +146,26 @@ static bool_t ahci_write(hbaPort_t *port, uint32_t startl, uint32_t starth, uint
    cmdheader += slot;
    cmdheader->cfl = sizeof(fisRegH2d_t)/sizeof(uint32_t);   // Command FIS size
    cmdheader->w = 1;    // Write to device
-   cmdheader->prdtl = (uint16_t)((count-1)>>4) + 1;   // PRDT entries count
+   cmdheader->prdtl = (uint16_t)((bytes-1)/AHCI_PRDT_BYTES) + 1;   // PRDT entries count
  
    hbaCmdTbl_t *cmdtbl = (hbaCmdTbl_t*)(cmdheader->ctba);
-   __memset(cmdtbl, 0, sizeof(hbaCmdTbl_t) +
+   __memclr(cmdtbl, sizeof(hbaCmdTbl_t) +
       (cmdheader->prdtl-1)*sizeof(hbaPrdtEntry_t));
  
-   // 8K bytes (16 sectors) per PRDT
+   // 8K bytes per PRDT
    int i = 0;
+   uint32_t left = bytes;
    for (; i<cmdheader->prdtl-1; i++)
    {
       cmdtbl->prdt_entry[i].dba = (uint32_t) buf;
-      cmdtbl->prdt_entry[i].dbc = 8*1024-1;  // 8K bytes (this value should always be set to 1 less than the actual value)
+      cmdtbl->prdt_entry[i].dbc = AHCI_PRDT_BYTES-1;  // 8K bytes (this value should always be set to 1 less than the actual value)
       cmdtbl->prdt_entry[i].i = 1;
-      buf += 4*1024; // 4K words
-      count -= 16;   // 16 sectors
+      buf += AHCI_PRDT_BYTES/2; // 4K words
+      left -= AHCI_PRDT_BYTES;
    }
    // Last entry
    cmdtbl->prdt_entry[i].dba = (uint32_t) buf;
-   cmdtbl->prdt_entry[i].dbc = (count<<9)-1; // 512 bytes per sector
+   cmdtbl->prdt_entry[i].dbc = left-1;
    cmdtbl->prdt_entry[i].i = 1;
  
    // Setup command
@@ -160,33 +198,15 @@ static bool_t ahci_write(hbaPort_t *port, uint32_t startl, uint32_t starth, uint
       //return false;
    }
  
+   TRACE_EV(TRC_AHCI_ISSUE, slot, startl);
    port->ci = 1<<slot;  // Issue command
- 
-   // Wait for completion
-   while (1)
-   {
-      // In some longer duration writes, it may be helpful to spin on the DPS bit 
-      // in the PxIS port field as well (1 << 5)
-      if ((port->ci & (1<<slot)) == 0) 
-         break;
-      if (port->is & HBA_PxIS_TFES) // Task file error
-      {
-         __cio_printf("\nRead disk error");
-         return false;
-      }
-   }
- 
-   // Check again
-   if (port->is & HBA_PxIS_TFES)
-   {
-      __cio_printf("\nRead disk error");
-      return false;
-   }
- 
-   return true;
+
+   bool_t ok = wait_cmd(port, slot, "Write");
+   TRACE_EV(TRC_AHCI_DONE, slot, ok);
+   return ok;
 }
 
-static bool_t ahci_read(hbaPort_t *port, uint32_t startl, uint32_t starth, uint32_t count, uint16_t *buf)
+static bool_t ahci_read(hbaPort_t *port, uint32_t startl, uint32_t starth, uint32_t count, uint32_t bytes, uint16_t *buf)
 {
    port->is = (uint32_t) -1;     // Clear pending interrupt bits
    int spin = 0; // Spin lock timeout counter
@@ -198,25 +218,26 @@ static bool_t ahci_read(hbaPort_t *port, uint32_t startl, uint32_t starth, uint3
    cmdheader += slot;
    cmdheader->cfl = sizeof(fisRegH2d_t)/sizeof(uint32_t);   // Command FIS size
    cmdheader->w = 0;    // Read from device
-   cmdheader->prdtl = (uint16_t)((count-1)>>4) + 1;   // PRDT entries count
+   cmdheader->prdtl = (uint16_t)((bytes-1)/AHCI_PRDT_BYTES) + 1;   // PRDT entries count
  
    hbaCmdTbl_t *cmdtbl = (hbaCmdTbl_t*)(cmdheader->ctba);
-   __memset(cmdtbl, 0, sizeof(hbaCmdTbl_t) +
+   __memclr(cmdtbl, sizeof(hbaCmdTbl_t) +
       (cmdheader->prdtl-1)*sizeof(hbaPrdtEntry_t));
  
-   // 8K bytes (16 sectors) per PRDT
+   // 8K bytes per PRDT
    int i = 0;
+   uint32_t left = bytes;
    for (; i<cmdheader->prdtl-1; i++)
    {
       cmdtbl->prdt_entry[i].dba = (uint32_t) buf;
-      cmdtbl->prdt_entry[i].dbc = 8*1024-1;  // 8K bytes (this value should always be set to 1 less than the actual value)
+      cmdtbl->prdt_entry[i].dbc = AHCI_PRDT_BYTES-1;  // 8K bytes (this value should always be set to 1 less than the actual value)
       cmdtbl->prdt_entry[i].i = 1;
-      buf += 4*1024; // 4K words
-      count -= 16;   // 16 sectors
+      buf += AHCI_PRDT_BYTES/2; // 4K words
+      left -= AHCI_PRDT_BYTES;
    }
    // Last entry
    cmdtbl->prdt_entry[i].dba = (uint32_t) buf;
-   cmdtbl->prdt_entry[i].dbc = (count<<9)-1; // 512 bytes per sector
+   cmdtbl->prdt_entry[i].dbc = left-1;
    cmdtbl->prdt_entry[i].i = 1;
  
    // Setup command
@@ -249,38 +270,22 @@ static bool_t ahci_read(hbaPort_t *port, uint32_t startl, uint32_t starth, uint3
       //return false;
    }
  
+   TRACE_EV(TRC_AHCI_ISSUE, slot, startl);
    port->ci = 1<<slot;  // Issue command
- 
-   // Wait for completion
-   while (1)
-   {
-      // In some longer duration reads, it may be helpful to spin on the DPS bit 
-      // in the PxIS port field as well (1 << 5)
-      if ((port->ci & (1<<slot)) == 0) 
-         break;
-      if (port->is & HBA_PxIS_TFES) // Task file error
-      {
-         __cio_printf("\nRead disk error");
-         return false;
-      }
-   }
- 
-   // Check again
-   if (port->is & HBA_PxIS_TFES)
-   {
-      __cio_printf("\nRead disk error");
-      return false;
-   }
- 
-   return true;
+
+   bool_t ok = wait_cmd(port, slot, "Read");
+   TRACE_EV(TRC_AHCI_DONE, slot, ok);
+   return ok;
 }
 
 // Start command engine
 static void start_cmd(hbaPort_t *port)
 {
    // Wait until CR (bit15) is cleared
-   while (port->cmd & HBA_PxCMD_CR)
-      ;
+   uint64_t start = _clk_ns();
+   for (uint32_t spin = 0; !expired(start, spin); spin++)
+      if ((port->cmd & HBA_PxCMD_CR) == 0)
+         break;
  
    // Set FRE (bit4) and ST (bit0)
    port->cmd |= HBA_PxCMD_FRE;
@@ -298,7 +303,8 @@ static void stop_cmd(hbaPort_t *port)
    port->cmd &= ~HBA_PxCMD_FRE;
  
    // Wait until FR (bit14), CR (bit15) are cleared
-   while(1)
+   uint64_t start = _clk_ns();
+   for (uint32_t spin = 0; !expired(start, spin); spin++)
    {
       if (port->cmd & HBA_PxCMD_FR)
          continue;
@@ -309,38 +315,46 @@ static void stop_cmd(hbaPort_t *port)
  
 }
 
-static void port_rebase(hbaPort_t *port, int portno)
+static bool_t port_rebase(hbaPort_t *port)
 {
+   // Each port gets its own memory from kmem; pages are 4K aligned,
+   // which covers the 1K/256/128 byte alignment the HBA requires
+   uint8_t *mem = (uint8_t*)_km_page_alloc(AHCI_PORT_PAGES);
+   if (mem == NULL)
+      return false;
+
    stop_cmd(port);   // Stop command engine
  
-   // Command list offset: 1K*portno
+   // Command list offset: 0
    // Command list entry size = 32
    // Command list entry maxim count = 32
    // Command list maxim size = 32*32 = 1K per port
-   port->clb = AHCI_BASE + (portno<<10);
+   port->clb = (uint32_t) mem;
    port->clbu = 0;
-   __memset((void*)(port->clb), 0, 1024);
+   __memclr((void*)(port->clb), 1024);
  
-   // FIS offset: 32K+256*portno
+   // FIS offset: 1K
    // FIS entry size = 256 bytes per port
-   port->fb = AHCI_BASE + (32<<10) + (portno<<8);
+   port->fb = (uint32_t) (mem + (1<<10));
    port->fbu = 0;
-   __memset((void*)(port->fb), 0, 256);
+   __memclr((void*)(port->fb), 256);
  
-   // Command table offset: 40K + 8K*portno
+   // Command table offset: 4K
    // Command table size = 256*32 = 8K per port
    hbaCmdHeader_t *cmdheader = (hbaCmdHeader_t*)(port->clb);
    for (int i=0; i<32; i++)
    {
       cmdheader[i].prdtl = 8; // 8 prdt entries per command table
                // 256 bytes per command table, 64+16+48+16*8
-      // Command table offset: 40K + 8K*portno + cmdheader_index*256
-      cmdheader[i].ctba = AHCI_BASE + (40<<10) + (portno<<13) + (i<<8);
+      // Command table offset: 4K + cmdheader_index*256
+      cmdheader[i].ctba = (uint32_t) (mem + (4<<10) + (i<<8));
       cmdheader[i].ctbau = 0;
-      __memset((void*)cmdheader[i].ctba, 0, 256);
+      __memclr((void*)cmdheader[i].ctba, 256);
    }
  
    start_cmd(port);  // Start command engine
+
+   return true;
 }
 
 static void _ahci_isr(int vector, int code)
@@ -395,22 +409,36 @@ hddDeviceList_t _get_device_list()
    return _hddDevs;
 }
 
-bool_t _write_disk(hddDevice_t device, uint32_t startl, uint32_t starth, uint32_t count, uint16_t *buf)
+bool_t _write_disk(hddDevice_t device, uint64_t lba, uint32_t count, uint16_t *buf)
 {
-   uint64_t absaddr = ((uint64_t)starth << 32) | startl;
-   if((absaddr + count) > device.sector_count){
+   if(count == 0 || count > AHCI_MAX_BYTES / device.sector_size){
       return false;
    }
-   return ahci_write(device.port, startl, starth, count, buf);
+   if((lba + count) > device.sector_count){
+      return false;
+   }
+   // the command FIS takes LBA bits 0-31 and 32-47 separately
+   uint64_t start = _clk_ns();
+   bool_t result = ahci_write(device.port, (uint32_t)lba, (uint32_t)(lba >> 32),
+      count, count * device.sector_size, buf);
+   _lat_record(LAT_AHCI_WRITE, _clk_ns() - start);
+   return result;
 }
 
-bool_t _read_disk(hddDevice_t device, uint32_t startl, uint32_t starth, uint32_t count, uint16_t *buf)
+bool_t _read_disk(hddDevice_t device, uint64_t lba, uint32_t count, uint16_t *buf)
 {  
-   uint64_t absaddr = ((uint64_t)starth << 32) | startl;
-   if((absaddr + count) > device.sector_count){
+   if(count == 0 || count > AHCI_MAX_BYTES / device.sector_size){
+      return false;
+   }
+   if((lba + count) > device.sector_count){
       return false;
    }
-   return ahci_read(device.port, startl, starth, count, buf);
+   // the command FIS takes LBA bits 0-31 and 32-47 separately
+   uint64_t start = _clk_ns();
+   bool_t result = ahci_read(device.port, (uint32_t)lba, (uint32_t)(lba >> 32),
+      count, count * device.sector_size, buf);
+   _lat_record(LAT_AHCI_READ, _clk_ns() - start);
+   return result;
 }
 
 
@@ -483,7 +511,9 @@ void _ahci_init()
       pi >>= 1;
    }
    for(uint8_t i = 0; i < _portsAvail; i++){
-      port_rebase(_portsList[i], 0);
+      if(!port_rebase(_portsList[i])){
+         continue;
+      }
       int count = 0;
       while((_portsList[i]->ssts & 0xF) != 3 && count < 1000000){
          count++;
@@ -493,12 +523,16 @@ void _ahci_init()
          continue;
       }
       _portsList[i]->serr = 0xFFFFFFFF;
-      _hddDevs.devices[count].port = _portsList[i];
+      _hddDevs.devices[_hddDevs.count].port = _portsList[i];
       _hddDevs.count++;
    }
 
-   identifyDeviceData_t* tempIDData = (identifyDeviceData_t*)_km_page_alloc(1);
-   __memset(tempIDData, 4000, 0);
+   identifyDeviceData_t* tempIDData = (identifyDeviceData_t*)_iob_get();
+   if(tempIDData == NULL){
+      __cio_printf(" Fail");
+      return;
+   }
+   __memclr(tempIDData, sizeof(identifyDeviceData_t));
 
    for(int i = 0; i < _hddDevs.count; i++){
       get_drive_info(_hddDevs.devices[i].port, tempIDData);
@@ -519,20 +553,22 @@ void _ahci_init()
 
       _hddDevs.devices[i].sector_count = (uint64_t)secl + ((uint64_t)sech << shift) - 1;
 
-      if(tempIDData->PhysicalLogicalSectorSize.Reserved1 == 0) {
-         _hddDevs.devices[i].sector_size = 512;
-      }
-      else {
+      // word 106 is only meaningful if bits 15:14 are 01
+      _hddDevs.devices[i].sector_size = 512;
+      _hddDevs.devices[i].phys_sector_size = 512;
+      if(tempIDData->PhysicalLogicalSectorSize.Reserved1 == 1) {
          if(tempIDData->PhysicalLogicalSectorSize.LogicalSectorLongerThan256Words) {
-            _hddDevs.devices[i].sector_size = (uint32_t)tempIDData->WordsPerLogicalSector[0] + ((uint32_t)tempIDData->WordsPerLogicalSector[1] << 16);
+            // words 117-118 count 16-bit words, not bytes
+            _hddDevs.devices[i].sector_size = 2 * ((uint32_t)tempIDData->WordsPerLogicalSector[0] + ((uint32_t)tempIDData->WordsPerLogicalSector[1] << 16));
          }
-         else {
-            _hddDevs.devices[i].sector_size = 256;
+         _hddDevs.devices[i].phys_sector_size = _hddDevs.devices[i].sector_size;
+         if(tempIDData->PhysicalLogicalSectorSize.MultipleLogicalSectorsPerPhysicalSector) {
+            _hddDevs.devices[i].phys_sector_size <<= tempIDData->PhysicalLogicalSectorSize.LogicalSectorsPerPhysicalSector;
          }
       }
       _hddDevs.devices[i].total_bytes = _hddDevs.devices[i].sector_count * _hddDevs.devices[i].sector_size;
    }
-   _km_page_free(tempIDData);
+   _iob_put(tempIDData);
 
    //DEMO CODE
    //CAREFULL ON REAL HARDWARE. WILL OVERWRITE DISK.
@@ -540,13 +576,13 @@ void _ahci_init()
    /*void* buffer = _km_page_alloc(1);
    __memset(buffer, 512, 0xFF);
    __cio_printf("\nClear buffer: %08x", *(uint32_t*)buffer);
-   _read_disk(_hddDevs.devices[0], 5, 0, 1, buffer);
+   _read_disk(_hddDevs.devices[0], 5, 1, buffer);
    __cio_printf("\nRead drive: %08x", *(uint32_t*)buffer);
    __memset(buffer, 512, 0xFF);
    __cio_printf("\nClear buffer: %08x", *(uint32_t*)buffer);
-   _write_disk(_hddDevs.devices[0], 5, 0, 1, buffer);
+   _write_disk(_hddDevs.devices[0], 5, 1, buffer);
    __cio_printf("\nWrote to drive");
-   _read_disk(_hddDevs.devices[0], 5, 0, 1, buffer);
+   _read_disk(_hddDevs.devices[0], 5, 1, buffer);
    __cio_printf("\nRead drive: %08x", *(uint32_t*)buffer);
    _km_page_free(buffer);*/
    //END DEMO CODE
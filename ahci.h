@@ -4,7 +4,9 @@
 #include "common.h"
 #include "pci.h"
 
-#define AHCI_BASE       0x00400000  // 4 Megabyte offset
+// pages of kmem used by each port:  command list and received
+// FIS in the first page, the 32 command tables in the next two
+#define AHCI_PORT_PAGES 3
 
 #define SATA_SIG_ATA    0x00000101  // SATA drive
 #define SATA_SIG_ATAPI  0xEB140101  // SATAPI drive
@@ -35,6 +37,17 @@
 #define ATA_CMD_WRITE_DMA_EX    0x35
 #define ATA_CMD_IDENTIFY        0xEC
 
+// largest transfer one command can describe, in bytes:
+// 8 PRDT entries per command table, 8K per entry
+#define AHCI_PRDT_BYTES         (8*1024)
+#define AHCI_MAX_BYTES          (8*AHCI_PRDT_BYTES)
+
+// how long to wait for a command (or the command engine) before
+// giving up on it, and how many polls to allow instead if the TSC
+// can't be used to measure that
+#define AHCI_CMD_MS             5000
+#define AHCI_CMD_SPINS          10000000
+
 
 /* FIS */
 
@@ -344,7 +357,8 @@ typedef struct taghddDevice
     hbaPort_t* port;
     uint64_t sector_count;
     uint64_t total_bytes;
-    uint16_t sector_size;
+    uint32_t sector_size;        // logical sector size, in bytes
+    uint32_t phys_sector_size;   // physical sector size, in bytes
 } hddDevice_t;
 
 typedef struct taghddDeviceList
@@ -807,8 +821,8 @@ void _ahci_init(void);
 
 hddDeviceList_t _get_device_list(void);
 
-bool_t _write_disk(hddDevice_t device, uint32_t startl, uint32_t starth, uint32_t count, uint16_t *buf);
+bool_t _write_disk(hddDevice_t device, uint64_t lba, uint32_t count, uint16_t *buf);
 
-bool_t _read_disk(hddDevice_t device, uint32_t startl, uint32_t starth, uint32_t count, uint16_t *buf);
+bool_t _read_disk(hddDevice_t device, uint64_t lba, uint32_t count, uint16_t *buf);
 
 #endif
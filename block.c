@@ -5,37 +5,125 @@
 **
 ** File to handle block allocation via bitmap. This also calls
 ** functions in ahci.h to read/write sectors from the disk.
+**
+** The disks hold a file system laid out as
+**
+**      block 0                     the superblock (blk_super_t)
+**      bitmap_start ...            the allocation bitmap, one bit per
+**                                  block, bit (id % 8) of byte (id / 8)
+**      table_start ...             the file table, which the file
+**                                  manager owns
+**      journal_start ...           the metadata journal (journal.c);
+**                                  version 1 file systems have none
+**      everything else             i-nodes and file contents
+**
+** _blk_init() mounts what it finds there; _blk_format() writes a new,
+** empty one.  The bitmap is kept in memory.  Changes to it, and to the
+** other metadata blocks, go through the journal if there is one, and
+** are written through to the disk before the call returns if not.
+**
+** Blocks freed while journaling are held, still allocated in memory
+** but free in the bitmap blocks given to the journal, until the
+** transaction freeing them is committed.  Until then a crash would
+** bring back the files they belonged to, so they mustn't be reused.
 */
 
 #define	SP_KERNEL_SRC
 
 #include "common.h"
 #include "kmem.h"
+#include "file.h"
 #include "block.h"
+#include "journal.h"
 #include "ahci.h"
+#include "iobuf.h"
+#include "clock.h"
+#include "lathist.h"
+#include "kstats.h"
+#include "trace.h"
 
 /*
 ** PRIVATE DEFINITIONS
 */
-// size of file inode in bytes
-#define FILE_INODE_SIZE 12
+// most devices the driver can report
+#define MAX_DEVICES 32
+
+// blocks covered by one group of the bitmap, and the size of that
+// group's piece of the bitmap
+#define LOG2_GROUP_BLOCKS 18
+#define GROUP_BLOCKS ( 1u << LOG2_GROUP_BLOCKS )
+#define GROUP_MAP_WORDS ( GROUP_BLOCKS / 32 )
+#define GROUP_MAP_BYTES ( GROUP_BLOCKS / 8 )
+#define GROUP_MAP_PAGES ( GROUP_MAP_BYTES / PAGE_SIZE )
+
+// most runs of freed blocks held for the running transaction
+#define MAX_HELD 64
 
 /*
 ** PRIVATE DATA TYPES
 */
 
+/*
+** The bitmap is split into groups, each covering GROUP_BLOCKS blocks.
+** A group's piece of the bitmap isn't allocated until one of its blocks
+** is, so RAM use follows how much of the disk is in use rather than
+** how big the disk is, and the free count lets the allocator skip
+** groups that can't satisfy a request without looking at their bits.
+*/
+typedef struct group_s {
+    uint32_t *map;     // this group's bitmap, or NULL if all free
+    uint32_t free;     // number of free blocks in the group
+} group_t;
+
+// a run of blocks
+typedef struct run_s {
+    blkno_t id;        // the first block
+    uint32_t num;      // the number of blocks
+} run_t;
+
 /*
 ** PRIVATE GLOBAL VARIABLES
 */
 
-// the bit-map, used to keep track of free and allocated blocks
-uint32_t *bit_map;
+// the bit-map groups, used to keep track of free and allocated blocks
+group_t *groups;
+
+// number of groups
+uint32_t num_groups;
+
+// group the last allocation came from; the next search starts there
+uint32_t group_hint;
+
+// id of the first block on each device; dev_base[num_devices] is
+// one past the last block on the last device
+blkno_t dev_base[ MAX_DEVICES + 1 ];
+
+// log2 of the number of sectors in a block, for each device
+uint32_t dev_shift[ MAX_DEVICES ];
 
-// list of block data structs
-block_t *block_list;
+// number of devices holding blocks
+int num_devices;
+
+// the block size, and its log2
+uint32_t block_size;
+uint32_t block_shift;
 
 // number of blocks
-int block_count;
+blkno_t block_count;
+
+// traffic to each device, and allocator activity, for kstats()
+ksdev_t dev_stats[ MAX_DEVICES ];
+uint32_t alloc_count;
+uint32_t alloc_fails;
+uint32_t free_count;
+
+// the superblock of the mounted file system, and whether there is one
+blk_super_t super;
+bool_t mounted;
+
+// runs of blocks freed in the running transaction
+run_t held[ MAX_HELD ];
+int num_held;
 
 /*
 ** PUBLIC GLOBAL VARIABLES
@@ -45,152 +133,1083 @@ int block_count;
 ** PRIVATE FUNCTIONS
 */
 
+/**
+** Name:  log2_of
+**
+** Log base 2 of a power of two
+**
+** @param n   The number
+**
+** @return  log2(n), or -1 if n is not a power of two
+*/
+static int log2_of( uint32_t n ){
+    int shift = 0;
+
+    if ( n == 0 || ( n & ( n - 1 ) ) != 0 ){
+        return -1;
+    }
+    while ( ( 1u << shift ) < n ){
+        shift++;
+    }
+    return shift;
+}
+
+/**
+** Name:  group_len
+**
+** Number of blocks in a group; only the last one can be short
+**
+** @param g   The group number
+**
+** @return  The number of blocks it covers
+*/
+static uint32_t group_len( uint32_t g ){
+    if ( g < num_groups - 1 ){
+        return GROUP_BLOCKS;
+    }
+    return (uint32_t) ( block_count - ( (blkno_t) g << LOG2_GROUP_BLOCKS ) );
+}
+
+/**
+** Name:  group_map
+**
+** Returns a group's piece of the bitmap, allocating it on first use.
+** Bits past the end of a short last group are marked allocated so
+** searches never run off the end of the disk.
+**
+** @param g   The group number
+**
+** @return  The bitmap, or NULL if there is no memory for it
+*/
+static uint32_t *group_map( uint32_t g ){
+    group_t *grp = &groups[g];
+
+    if ( grp->map == NULL ){
+        grp->map = ( uint32_t * ) _km_page_alloc( GROUP_MAP_PAGES );
+        if ( grp->map == NULL ){
+            return NULL;
+        }
+        __memclr( grp->map, GROUP_MAP_PAGES * PAGE_SIZE );
+
+        for ( uint32_t b = group_len( g ); b < GROUP_BLOCKS; b++ ){
+            grp->map[b / 32] |= 1u << ( b % 32 );
+        }
+    }
+
+    return grp->map;
+}
+
 /**
 ** Name:  is_allocated
 **
 ** Given an id, returns true if the block is allocated, false if not
 **
-** @param index   The id of the block to be checked
+** @param id   The id of the block to be checked
 **
 ** @return  1 if allocated, 0 if free 
 */
-int is_allocated( int index ){
-    return (bit_map[index / 32] & (1 << (index % 32))) != 0;
+int is_allocated( blkno_t id ){
+    uint32_t *map = groups[id >> LOG2_GROUP_BLOCKS].map;
+    uint32_t b = (uint32_t) id & ( GROUP_BLOCKS - 1 );
+
+    return map != NULL && ( map[b / 32] & ( 1u << ( b % 32 ) ) ) != 0;
 }
 
 /**
-** Name:  alloc_block
+** Name:  mark
+**
+** Marks a run of blocks allocated or free in the in-memory bitmap,
+** keeping the group free counts right. Blocks already in the wanted
+** state are left alone.
 **
-** Allocates a single block in the bit-map
+** @param id     The id of the first block
+** @param num    The number of blocks
+** @param used   true to mark them allocated, false to mark them free
 **
-** @param index  The id of the block to be allocated
+** @return The number of blocks that changed, or -1 if there was no
+**         memory for a group's bitmap
 */
-void alloc_block( int index ){
-    bit_map[index / 32] |= 1 << (index % 32);
+static int mark( blkno_t id, uint32_t num, bool_t used ){
+    int changed = 0;
+
+    for ( ; num > 0; id++, num-- ){
+        uint32_t g = (uint32_t) ( id >> LOG2_GROUP_BLOCKS );
+        uint32_t b = (uint32_t) id & ( GROUP_BLOCKS - 1 );
+        uint32_t *map = used ? group_map( g ) : groups[g].map;
+
+        if ( map == NULL ){
+            if ( used ){
+                return E_FAILURE;
+            }
+            continue;   // the whole group is free already
+        }
+
+        uint32_t bit = 1u << ( b % 32 );
+        if ( ( ( map[b / 32] & bit ) != 0 ) == used ){
+            continue;
+        }
+        if ( used ){
+            map[b / 32] |= bit;
+            groups[g].free--;
+        } else {
+            map[b / 32] &= ~bit;
+            groups[g].free++;
+        }
+        changed++;
+    }
+
+    return changed;
 }
 
-/*
-** PUBLIC FUNCTIONS
+/**
+** Name:  fill_bitmap
+**
+** Copies part of the in-memory bitmap out in its on-disk form. Groups
+** that have no bitmap yet are all free.
+**
+** @param buf    Where to put it
+** @param off    The byte offset in the on-disk bitmap to start at
+** @param len    The number of bytes
 */
+static void fill_bitmap( char *buf, uint64_t off, uint32_t len ){
+
+    while ( len > 0 ){
+        uint32_t g = (uint32_t) ( off >> ( LOG2_GROUP_BLOCKS - 3 ) );
+        uint32_t goff = (uint32_t) off & ( GROUP_MAP_BYTES - 1 );
+        uint32_t n = GROUP_MAP_BYTES - goff;
+        if ( n > len ){
+            n = len;
+        }
+
+        if ( g < num_groups && groups[g].map != NULL ){
+            __memcpy( buf, ( char * ) groups[g].map + goff, n );
+        } else {
+            __memclr( buf, n );
+        }
+
+        buf += n;
+        off += n;
+        len -= n;
+    }
+}
 
 /**
-** Name:  _blk_init
+** Name:  merge_bitmap
 **
-** Initializes all the blocks in the disk
+** Adds part of the on-disk bitmap to the in-memory one. Only groups
+** with some block allocated get a bitmap.
 **
+** @param buf    The on-disk bitmap bytes
+** @param off    The byte offset in the on-disk bitmap they start at
+** @param len    The number of bytes
+**
+** @return 0 if successful, -1 if there was no memory for a bitmap
 */
-void _blk_init( void ){
-    
+static int merge_bitmap( char *buf, uint64_t off, uint32_t len ){
+
+    while ( len > 0 ){
+        uint32_t g = (uint32_t) ( off >> ( LOG2_GROUP_BLOCKS - 3 ) );
+        uint32_t goff = (uint32_t) off & ( GROUP_MAP_BYTES - 1 );
+        uint32_t n = GROUP_MAP_BYTES - goff;
+        if ( n > len ){
+            n = len;
+        }
+        if ( g >= num_groups ){
+            break;
+        }
+
+        // block sizes are multiples of 4, so these are whole words
+        uint32_t *words = ( uint32_t * ) buf;
+        uint32_t w = 0;
+        while ( w < n / 4 && words[w] == 0 ){
+            w++;
+        }
+        if ( w < n / 4 ){
+            uint32_t *map = group_map( g );
+            if ( map == NULL ){
+                return E_FAILURE;
+            }
+            for ( w = 0; w < n / 4; w++ ){
+                map[goff / 4 + w] |= words[w];
+            }
+        }
+
+        buf += n;
+        off += n;
+        len -= n;
+    }
+
+    return SUCCESS;
+}
+
+/**
+** Name:  count_free
+**
+** Recounts the free blocks in a group from its bitmap
+**
+** @param g   The group number
+*/
+static void count_free( uint32_t g ){
+    uint32_t *map = groups[g].map;
+    uint32_t used = 0;
+
+    if ( map == NULL ){
+        groups[g].free = group_len( g );
+        return;
+    }
+
+    // the bits past the end of a short group are set, so counting
+    // every bit gives the right answer for it too
+    for ( uint32_t w = 0; w < GROUP_MAP_WORDS; w++ ){
+        uint32_t x = map[w];
+        x = x - ( ( x >> 1 ) & 0x55555555 );
+        x = ( x & 0x33333333 ) + ( ( x >> 2 ) & 0x33333333 );
+        x = ( x + ( x >> 4 ) ) & 0x0f0f0f0f;
+        used += ( x * 0x01010101 ) >> 24;
+    }
+    groups[g].free = GROUP_BLOCKS - used;
+}
+
+/**
+** Name:  map_block
+**
+** Works out where a block lives. Blocks are numbered consecutively
+** through each device in turn, so the location is a pure function of
+** the id and the per-device base ids.
+**
+** @param id   The id of the block
+**
+** @return the device index and starting sector of the block
+*/
+static block_t map_block( blkno_t id ){
+    block_t block;
+
+    // find the device holding this id
+    int dev = 0;
+    while ( dev < num_devices - 1 && id >= dev_base[dev + 1] ){
+        dev++;
+    }
+
+    block.id = id;
+    block.device = dev;
+    block.start = ( id - dev_base[dev] ) << dev_shift[dev];
+
+    return block;
+}
+
+/**
+** Name:  count_io
+**
+** Records one disk command in the device's statistics
+**
+** @param dev     The index of the device
+** @param bytes   The number of bytes transferred
+** @param write   true for a write, false for a read
+** @param ok      Whether the command succeeded
+*/
+static void count_io( uint32_t dev, uint32_t bytes, bool_t write, bool_t ok ){
+    ksdev_t *st = &dev_stats[dev];
+
+    if ( !ok ){
+        st->errors++;
+    } else if ( write ){
+        st->writes++;
+        st->write_bytes += bytes;
+    } else {
+        st->reads++;
+        st->read_bytes += bytes;
+    }
+}
+
+/**
+** Name:  transfer_run
+**
+** Moves a run of consecutive blocks between memory and the disk. The run
+** is split only where it crosses onto another device or would exceed the
+** largest transfer the driver can describe in one command, so a typical
+** file needs a single disk command instead of one per block.
+**
+** @param id          The id of the first block of the run
+** @param buf         The memory side of the transfer
+** @param num_blocks  The number of blocks to transfer
+** @param write       true to write to the disk, false to read from it
+**
+** @return 0 if successful, -1 if not
+*/
+static int transfer_run( blkno_t id, char *buf, int num_blocks, bool_t write ){
+
+    hddDeviceList_t list = _get_device_list();
+    uint64_t start = _clk_ns();
+
+    while ( num_blocks > 0 ){
+
+        // the run starts at this block
+        block_t block = map_block( id );
+        hddDevice_t device = list.devices[block.device];
+
+        // and stops at the end of the device or the command limit
+        int count = num_blocks;
+        if ( dev_base[block.device + 1] - id < (blkno_t) count ){
+            count = (int) ( dev_base[block.device + 1] - id );
+        }
+        if ( count > ( AHCI_MAX_BYTES >> block_shift ) ){
+            count = AHCI_MAX_BYTES >> block_shift;
+        }
+
+        // one command for the whole run
+        bool_t result;
+        TRACE_EV( TRC_BLK_ISSUE, id, count );
+        if ( write ){
+            result = _write_disk( device, block.start,
+                count << dev_shift[block.device], ( uint16_t * ) buf );
+        } else {
+            result = _read_disk( device, block.start,
+                count << dev_shift[block.device], ( uint16_t * ) buf );
+        }
+        count_io( block.device, count << block_shift, write, result );
+        TRACE_EV( TRC_BLK_DONE, write, result );
+
+        // check result of the transfer
+        if ( !result ){
+            __cio_printf( "Unable to %s disk\n", write ? "write to" : "read from" );
+            return E_FAILURE;
+        }
+
+        id += count;
+        num_blocks -= count;
+        buf += count << block_shift;
+    }
+
+    _lat_record( write ? LAT_BLK_WRITE : LAT_BLK_READ, _clk_ns() - start );
+
+    return SUCCESS;
+}
+
+/**
+** Name:  clear_held
+**
+** Marks the held blocks free in part of the on-disk bitmap
+**
+** @param buf     The bitmap bytes
+** @param first   The block their first bit is for (a multiple of 8)
+** @param count   The number of blocks they cover
+*/
+static void clear_held( char *buf, blkno_t first, blkno_t count ){
+
+    for ( int h = 0; h < num_held; h++ ){
+        blkno_t lo = held[h].id;
+        blkno_t hi = held[h].id + held[h].num;
+        if ( lo < first ){
+            lo = first;
+        }
+        if ( hi > first + count ){
+            hi = first + count;
+        }
+        for ( blkno_t b = lo; b < hi; b++ ){
+            uint32_t off = (uint32_t) ( b - first );
+            buf[off / 8] &= ~( 1u << ( off % 8 ) );
+        }
+    }
+}
+
+/**
+** Name:  is_held
+**
+** Says whether a block has been freed in the running transaction
+**
+** @param id   The id of the block
+**
+** @return true if it is held
+*/
+static bool_t is_held( blkno_t id ){
+
+    for ( int h = 0; h < num_held; h++ ){
+        if ( id >= held[h].id && id - held[h].id < held[h].num ){
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+** Name:  save_meta
+**
+** Writes a run of the file system's own blocks: to the journal if the
+** mounted file system has one, and straight to the disk if not
+**
+** @param id     The id of the first block
+** @param buf    Their contents
+** @param num    The number of blocks
+**
+** @return 0 if successful, -1 if not
+*/
+static int save_meta( blkno_t id, char *buf, uint32_t num ){
+
+    if ( !mounted || !_jnl_active() ){
+        return transfer_run( id, buf, num, true );
+    }
+
+    for ( uint32_t k = 0; k < num; k++ ){
+        if ( _jnl_write( id + k, buf + ( k << block_shift ) ) < 0 ){
+            return E_FAILURE;
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+** Name:  save_bitmap
+**
+** Writes the part of the on-disk bitmap covering a run of blocks,
+** several bitmap blocks per disk command when the run is long
+**
+** @param first   The id of the first block of the run
+** @param count   The number of blocks in the run
+**
+** @return 0 if successful, -1 if not
+*/
+static int save_bitmap( blkno_t first, blkno_t count ){
+
+    // log2 of the number of blocks one bitmap block covers
+    uint32_t shift = block_shift + 3;
+
+    blkno_t k = first >> shift;
+    blkno_t last = ( first + count - 1 ) >> shift;
+
+    char *buf = ( char * ) _iob_get();
+    if ( buf == NULL ){
+        return E_FAILURE;
+    }
+
+    int result = SUCCESS;
+    while ( result == SUCCESS && k <= last ){
+        uint32_t n = IOB_SIZE >> block_shift;
+        if ( last - k + 1 < n ){
+            n = (uint32_t) ( last - k + 1 );
+        }
+        fill_bitmap( buf, k << block_shift, n << block_shift );
+        clear_held( buf, k << shift, (blkno_t) n << shift );
+        result = save_meta( super.bitmap_start + k, buf, n );
+        k += n;
+    }
+
+    _iob_put( buf );
+    return result;
+}
+
+/**
+** Name:  free_journaled
+**
+** Frees a run of blocks on a journaled file system. Only the blocks
+** which are allocated and not held already are freed; each run of them
+** is held, its logged copies are revoked, and its part of the bitmap
+** is written to the journal.
+**
+** @param id    The id of the first block
+** @param num   The number of blocks
+*/
+static void free_journaled( blkno_t id, uint32_t num ){
+
+    while ( num > 0 ){
+        if ( !is_allocated( id ) || is_held( id ) ){
+            id++;
+            num--;
+            continue;
+        }
+
+        uint32_t n = 1;
+        while ( n < num && is_allocated( id + n ) && !is_held( id + n ) ){
+            n++;
+        }
+
+        // committing lets the held blocks go
+        if ( num_held == MAX_HELD &&
+             ( _jnl_commit() < 0 || num_held == MAX_HELD ) ){
+            __cio_printf( "Unable to free %d blocks at %d\n",
+                          num, (uint32_t) id );
+            return;
+        }
+
+        _jnl_revoke( id, n );
+        held[num_held].id = id;
+        held[num_held].num = n;
+        num_held++;
+        free_count += n;
+        if ( save_bitmap( id, n ) < 0 ){
+            __cio_printf( "Unable to save the bitmap freeing block %d\n",
+                          (uint32_t) id );
+        }
+
+        id += n;
+        num -= n;
+    }
+}
+
+/**
+** Name:  load_bitmap
+**
+** Reads the whole on-disk bitmap, a staging buffer at a time, into
+** the in-memory one and recounts each group's free blocks
+**
+** @return 0 if successful, -1 if not
+*/
+static int load_bitmap( void ){
+
+    char *buf = ( char * ) _iob_get();
+    if ( buf == NULL ){
+        return E_FAILURE;
+    }
+
+    int result = SUCCESS;
+    blkno_t k = 0;
+    while ( result == SUCCESS && k < super.bitmap_blocks ){
+        uint32_t n = IOB_SIZE >> block_shift;
+        if ( super.bitmap_blocks - k < n ){
+            n = (uint32_t) ( super.bitmap_blocks - k );
+        }
+        result = transfer_run( super.bitmap_start + k, buf, n, false );
+        if ( result == SUCCESS ){
+            result = merge_bitmap( buf, k << block_shift, n << block_shift );
+        }
+        k += n;
+    }
+    _iob_put( buf );
+
+    for ( uint32_t g = 0; g < num_groups; g++ ){
+        count_free( g );
+    }
+
+    return result;
+}
+
+/**
+** Name:  read_super
+**
+** Reads the superblock from the start of a device. Only its first
+** sector is read, since the block size isn't known yet.
+**
+** @param device   The device
+**
+** @return true if it holds a file system this code understands
+*/
+static bool_t read_super( hddDevice_t device ){
+
+    uint16_t *buf = _iob_get();
+    if ( buf == NULL ){
+        return false;
+    }
+
+    bool_t result = _read_disk( device, 0, 1, buf );
+    __memcpy( &super, buf, sizeof( super ) );
+    _iob_put( buf );
+
+    // version 1 had no journal
+    if ( super.version == 1 ){
+        super.journal_start = super.table_start + super.table_blocks;
+        super.journal_blocks = 0;
+    }
+
+    return result && super.magic == BLK_MAGIC &&
+        super.version >= 1 && super.version <= BLK_VERSION &&
+        log2_of( super.block_size ) >= 0 &&
+        super.bitmap_start == 1 &&
+        super.table_start == super.bitmap_start + super.bitmap_blocks &&
+        super.journal_start == super.table_start + super.table_blocks &&
+        super.journal_start + super.journal_blocks < super.block_count;
+}
+
+/**
+** Name:  set_geometry
+**
+** Chooses the block size, works out how many blocks each disk holds
+** and where each disk's blocks start, and sets up an empty bitmap
+**
+** @param size   The requested block size, in bytes, or 0
+**
+** @return 0 if successful, -1 if not
+*/
+static int set_geometry( uint32_t size ){
+
     // get the hdd devices
     hddDeviceList_t list = _get_device_list();
 
-    // go through devices and count the sectors
-    int sector_count = 0;
+    // the smallest block every device can take whole sectors of,
+    // and the smallest that avoids read-modify-write on every device
+    uint32_t logical = BLOCK_SIZE_MIN;
+    uint32_t physical = BLOCK_SIZE_MIN;
     for ( int i = 0; i < list.count; i++ ){
         hddDevice_t device = list.devices[i];
-	sector_count += device.sector_count;
+        if ( log2_of( device.sector_size ) < 0 ||
+             log2_of( device.phys_sector_size ) < 0 ||
+             device.phys_sector_size > BLOCK_SIZE_MAX ){
+            __cio_printf( "Device %d has unusable %d/%d byte sectors\n", i,
+                device.sector_size, device.phys_sector_size );
+            return E_FAILURE;
+        }
+        if ( device.sector_size > logical ){
+            logical = device.sector_size;
+        }
+        if ( device.phys_sector_size > physical ){
+            physical = device.phys_sector_size;
+        }
     }
 
-    // calculate number of blocks that can be made
-    block_count = sector_count / NUM_SECTORS;
+    if ( size == 0 ){
+        size = physical;
+    }
+    if ( log2_of( size ) < 0 || size < BLOCK_SIZE_MIN ||
+         size > BLOCK_SIZE_MAX || size < logical ){
+        __cio_printf( "Invalid block size %d\n", size );
+        return E_FAILURE;
+    }
+    if ( size < physical ){
+        __cio_printf( "Block size raised from %d to %d\n", size, physical );
+        size = physical;
+    }
 
-    // allocate memory to store block info
-    int block_mem = block_count * sizeof( block_t );
-    int num_pages = block_mem / PAGE_SIZE;
-    block_list = ( block_t * ) _km_page_alloc( num_pages );
+    block_size = size;
+    block_shift = log2_of( size );
 
-    // assign sectors to blocks
-    int count = 0;
-    // iterate through the devices
-    for ( int i = 0; i < list.count; i++ ){
+    // each device's blocks follow those of the device before it
+    block_count = 0;
+    num_devices = list.count;
+    for ( int i = 0; i < num_devices; i++ ){
         hddDevice_t device = list.devices[i];
+        dev_shift[i] = block_shift - log2_of( device.sector_size );
+        dev_base[i] = block_count;
+        block_count += device.sector_count >> dev_shift[i];
+    }
+    dev_base[num_devices] = block_count;
 
-	// iterate through the sectors in each device
-        for ( int j = 0; j < device.sector_count; j += NUM_SECTORS ){
-	    // create the block
-	    block_t *block = ( block_t * ) _km_slice_alloc();
-	    block->id = count;
-	    block->device = (uint32_t) i;
-	    block->startl = (uint32_t) (j & 0xff);
-	    block->starth = (uint32_t) (j >> 8);
+    __memclr( dev_stats, sizeof( dev_stats ) );
+    alloc_count = alloc_fails = free_count = 0;
 
-	    // put the block in the list
-	    block_list[count] = *block;
-	    count++;
+    // anything from an earlier mount goes
+    for ( uint32_t g = 0; g < num_groups; g++ ){
+        if ( groups[g].map != NULL ){
+            _km_page_free( groups[g].map );
+        }
+    }
+    if ( groups != NULL ){
+        _km_page_free( groups );
+    }
+
+    // one group entry per GROUP_BLOCKS blocks; the bitmaps themselves
+    // are allocated as they are needed
+    num_groups = (uint32_t) ( ( block_count + GROUP_BLOCKS - 1 ) >>
+        LOG2_GROUP_BLOCKS );
+    group_hint = 0;
+
+    int group_mem = num_groups * sizeof( group_t );
+    int group_pages = ( group_mem / PAGE_SIZE ) + ( ( group_mem % PAGE_SIZE ) != 0 );
+    if ( group_pages == 0 ){
+        groups = NULL;
+        return SUCCESS;
+    }
+    groups = ( group_t * ) _km_page_alloc( group_pages );
+    assert( groups != NULL );
 
-	    // free the memory used
-	    _km_slice_free( block );
-	}
+    for ( uint32_t g = 0; g < num_groups; g++ ){
+        groups[g].map = NULL;
+        groups[g].free = group_len( g );
     }
 
-    // calculate size of the bitmap
-    int map_mem = ( ( block_count / 32 ) + ( ( block_count % 32 ) != 0 ) * 4);
-    // calculate number of pages for the bitmap
-    int map_pages = ( map_mem / PAGE_SIZE ) + ( ( map_mem % PAGE_SIZE ) != 0);
-    // allocate the bitmap
-    bit_map = ( uint32_t * ) _km_page_alloc( map_pages );
+    return SUCCESS;
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** Name:  _blk_init
+**
+** Mounts the file system on the disks if they hold one, using the
+** block size it was formatted with; otherwise sets up the blocks
+** with the requested size, ready for _blk_format
+**
+** @param size   The requested block size, in bytes, or 0
+**
+** @return 0 if successful, -1 if not
+*/
+int _blk_init( uint32_t size ){
+
+    hddDeviceList_t list = _get_device_list();
+    mounted = false;
+
+    if ( list.count == 0 || !read_super( list.devices[0] ) ){
+        return set_geometry( size );
+    }
+
+    if ( set_geometry( super.block_size ) < 0 ){
+        return E_FAILURE;
+    }
+    if ( block_size != super.block_size || block_count != super.block_count ){
+        __cio_printf( "File system of %d %d byte blocks doesn't fit the disks\n",
+            (uint32_t) super.block_count, super.block_size );
+        return E_FAILURE;
+    }
+
+    // what the journal holds is newer than the bitmap on the disk
+    num_held = 0;
+    if ( _jnl_mount( &super ) < 0 || load_bitmap() < 0 ){
+        return E_FAILURE;
+    }
+
+    mounted = true;
+    return SUCCESS;
+}
+
+/**
+** Name:  _blk_format
+**
+** Writes an empty file system onto the disks and mounts it. The old
+** superblock is wiped first and the new one written last, so a format
+** that doesn't finish leaves nothing that looks mountable. The journal
+** gets JNL_BLOCKS blocks, or a 32nd of what is left if that's less,
+** or none if that's too small for one.
+**
+** @param size         The requested block size, in bytes, or 0
+** @param table_bytes  The size of the file table, in bytes
+**
+** @return 0 if successful, -1 if not
+*/
+int _blk_format( uint32_t size, uint32_t table_bytes ){
+
+    mounted = false;
+    if ( set_geometry( size ) < 0 ){
+        return E_FAILURE;
+    }
+
+    // log2 of the number of blocks one bitmap block covers
+    uint32_t shift = block_shift + 3;
+
+    __memclr( &super, sizeof( super ) );
+    super.magic = BLK_MAGIC;
+    super.version = BLK_VERSION;
+    super.block_size = block_size;
+    super.block_count = block_count;
+    super.bitmap_start = 1;
+    super.bitmap_blocks = ( block_count + ( 1u << shift ) - 1 ) >> shift;
+    super.table_start = super.bitmap_start + super.bitmap_blocks;
+    super.table_blocks = ( table_bytes + block_size - 1 ) >> block_shift;
+    super.journal_start = super.table_start + super.table_blocks;
+
+    if ( super.journal_start >= block_count ){
+        __cio_printf( "Disks are too small for a file system\n" );
+        return E_FAILURE;
+    }
+    super.journal_blocks = ( block_count - super.journal_start ) >> 5;
+    if ( super.journal_blocks > JNL_BLOCKS ){
+        super.journal_blocks = JNL_BLOCKS;
+    }
+    if ( super.journal_blocks < JNL_BLOCKS_MIN ){
+        super.journal_blocks = 0;
+    }
+
+    blkno_t meta = super.journal_start + super.journal_blocks;
+    if ( mark( 0, (uint32_t) meta, true ) < 0 ){
+        return E_FAILURE;
+    }
+
+    char *buf = ( char * ) _iob_get();
+    if ( buf == NULL ){
+        return E_FAILURE;
+    }
+    __memclr( buf, IOB_SIZE );
+
+    // no superblock, an empty file table, the bitmap, an empty
+    // journal, the superblock
+    num_held = 0;
+    int result = transfer_run( 0, buf, 1, true );
+    for ( blkno_t k = 0; result == SUCCESS && k < super.table_blocks; ){
+        uint32_t n = IOB_SIZE >> block_shift;
+        if ( super.table_blocks - k < n ){
+            n = (uint32_t) ( super.table_blocks - k );
+        }
+        result = transfer_run( super.table_start + k, buf, n, true );
+        k += n;
+    }
+    if ( result == SUCCESS ){
+        result = save_bitmap( 0, block_count );
+    }
+    if ( result == SUCCESS ){
+        result = _jnl_format( &super );
+    }
+    if ( result == SUCCESS ){
+        __memcpy( buf, &super, sizeof( super ) );
+        result = transfer_run( 0, buf, 1, true );
+    }
+    _iob_put( buf );
+
+    if ( result < 0 ){
+        return E_FAILURE;
+    }
+
+    mounted = true;
+    return SUCCESS;
+}
+
+/**
+** Name:  _blk_super
+**
+** Returns the superblock of the mounted file system
+**
+** @return the superblock, or NULL if nothing is mounted
+*/
+const blk_super_t *_blk_super( void ){
+    return mounted ? &super : NULL;
+}
+
+/**
+** Name:  _blk_reserved
+**
+** Returns the number of blocks at the start of the disks which the
+** mounted file system keeps for itself
+**
+** @return the number of blocks
+*/
+blkno_t _blk_reserved( void ){
+    return super.journal_start + super.journal_blocks;
+}
+
+/**
+** Name:  _blk_size
+**
+** Returns the block size chosen by _blk_init
+**
+** @return the block size, in bytes
+*/
+uint32_t _blk_size( void ){
+    return block_size;
 }
     
 
+/**
+** Name:  _blk_stats
+**
+** Fills in the device and block allocator parts of a kstats_t.
+** Free space is reported group by group, since that's how the
+** allocator searches it; an untouched group is one free run.
+**
+** @param ks   The statistics to fill in
+*/
+void _blk_stats( kstats_t *ks ){
+
+    ks->num_devices = num_devices;
+    for ( int i = 0; i < num_devices && i < KS_MAX_DEVICES; i++ ){
+        ks->dev[i] = dev_stats[i];
+    }
+
+    ks->blk_total = block_count;
+    ks->blk_free = 0;
+    ks->blk_extents = 0;
+    ks->blk_largest = 0;
+    ks->blk_allocs = alloc_count;
+    ks->blk_alloc_fails = alloc_fails;
+    ks->blk_frees = free_count;
+
+    for ( uint32_t g = 0; g < num_groups; g++ ){
+        uint32_t *map = groups[g].map;
+        uint32_t run = 0;
+
+        ks->blk_free += groups[g].free;
+
+        if ( map == NULL ){
+            run = group_len( g );
+        } else {
+            for ( uint32_t b = 0; b < GROUP_BLOCKS; b++ ){
+
+                // skip over whole words that are all free
+                if ( ( b % 32 ) == 0 && map[b / 32] == 0 ){
+                    run += 32;
+                    b += 31;
+                    continue;
+                }
+
+                if ( ( map[b / 32] & ( 1u << ( b % 32 ) ) ) == 0 ){
+                    run++;
+                    continue;
+                }
+
+                // an allocated block ends the run
+                if ( run > 0 ){
+                    ks->blk_extents++;
+                    if ( run > ks->blk_largest ){
+                        ks->blk_largest = run;
+                    }
+                }
+                run = 0;
+            }
+        }
+
+        if ( run > 0 ){
+            ks->blk_extents++;
+            if ( run > ks->blk_largest ){
+                ks->blk_largest = run;
+            }
+        }
+    }
+}
+
 /**
 ** Name:  _blk_free
 **
 ** Frees a single disk block using the bit-map, given the id
 **
-** @param index    The id of the block to be freed
+** @param id    The id of the block to be freed
+**
+*/
+void _blk_free( blkno_t id ){
+    _blk_free_run( id, 1 );
+}
+
+/**
+** Name:  _blk_free_run
+**
+** Frees a run of consecutive disk blocks, with one write of the
+** bitmap. The file system's own blocks are never freed. If there is
+** a journal the blocks are held until the free is committed. Blocks
+** which are free already are left alone.
 **
+** @param id    The id of the first block to be freed
+** @param num   The number of blocks
 */
-void _blk_free( int index ){
-    bit_map[index / 32] &= ~(1 << (index % 32));
+void _blk_free_run( blkno_t id, uint32_t num ){
+
+    if ( id >= block_count || num > block_count - id ){
+        return;
+    }
+    if ( mounted && id < _blk_reserved() ){
+        __cio_printf( "Not freeing file system block %d\n", (uint32_t) id );
+        return;
+    }
+
+    if ( mounted && _jnl_active() ){
+        free_journaled( id, num );
+        return;
+    }
+
+    int changed = mark( id, num, false );
+    if ( changed <= 0 ){
+        return;
+    }
+    free_count += changed;
+
+    if ( mounted && save_bitmap( id, num ) < 0 ){
+        __cio_printf( "Unable to save the bitmap freeing block %d\n",
+                      (uint32_t) id );
+    }
 }
 
 /**
 ** Name:  _blk_alloc
 **
-** Allocates a given number of continous disk blocks using the bit-map
+** Allocates a given number of continous disk blocks using the bit-map.
+** A run never crosses from one group into the next. The search starts
+** in the group the last allocation came from and skips any group
+** whose free count is too small, and any bitmap word that is full.
 **
 ** @param num    The number of disk blocks to be allocated
 **
-** @return id of the first disk block 
+** @return id of the first disk block, or BLK_NONE
 */
-int _blk_alloc( int num ){
-    
-    // index of block being processed
-    int idx = 0;
-    // number of consecutive free blocks found
-    int free_blocks = 0; 
+blkno_t _blk_alloc( uint32_t num ){
 
-    // go through all the blocks
-    while ( idx < block_count ){
-    
-        // check if block is allocated
-        if ( !is_allocated( idx ) ){
-	    free_blocks++;
-
-	    // check if we've found enough consecutive free blocks
-	    if ( free_blocks == block_count ){
-
-	        // index at which the consecutive blocks start
-	        int start_index = idx - block_count + 1;
-		// allocate the blocks
-		int count = 0;
-		while( count < block_count ){
-		    alloc_block( start_index + count );
-		    count++;
-		}
-		// return the block at which the blocks start
-		return start_index;
-	    }
-	} else {
-	    // consecutive free blocks go down to zero
-	    free_blocks = 0;
-	}
-	idx++;
+    if ( num == 0 || num > GROUP_BLOCKS ){
+        return BLK_NONE;
+    }
+
+    for ( uint32_t i = 0; i < num_groups; i++ ){
+        uint32_t g = ( group_hint + i ) % num_groups;
+
+        if ( groups[g].free < num ){
+            continue;
+        }
+
+        uint32_t *map = group_map( g );
+        if ( map == NULL ){
+            break;
+        }
+
+        // number of consecutive free blocks found
+        uint32_t free_blocks = 0;
+        uint32_t b = 0;
+
+        while ( b < GROUP_BLOCKS ){
+
+            // a full word ends any run
+            if ( ( b % 32 ) == 0 && map[b / 32] == ~0u ){
+                free_blocks = 0;
+                b += 32;
+                continue;
+            }
+
+            if ( ( map[b / 32] & ( 1u << ( b % 32 ) ) ) != 0 ){
+                free_blocks = 0;
+                b++;
+                continue;
+            }
+
+            free_blocks++;
+            b++;
+
+            // check if we've found enough consecutive free blocks
+            if ( free_blocks == num ){
+                uint32_t start = b - num;
+                for ( uint32_t k = start; k < b; k++ ){
+                    map[k / 32] |= 1u << ( k % 32 );
+                }
+                groups[g].free -= num;
+                group_hint = g;
+
+                // the run isn't allocated until the disk says so
+                blkno_t id = ( (blkno_t) g << LOG2_GROUP_BLOCKS ) + start;
+                if ( mounted && save_bitmap( id, num ) < 0 ){
+                    mark( id, num, false );
+                    break;
+                }
+
+                alloc_count++;
+                return id;
+            }
+        }
     }
 
     // Out of blocks?????????
-    __cio_printf( "Ran out of blocks?????\n");
-    return E_FAILURE;
+    alloc_fails++;
+    __cio_printf( "Unable to allocate %d blocks\n", num );
+    return BLK_NONE;
+}
+
+/**
+** Name:  _blk_committed
+**
+** Called by the journal once a transaction is committed; the blocks
+** freed in it can now be reused
+*/
+void _blk_committed( void ){
+
+    for ( int h = 0; h < num_held; h++ ){
+        mark( held[h].id, held[h].num, false );
+    }
+    num_held = 0;
+}
+
+/**
+** Name:  _blk_save_meta
+**
+** Writes a run of the file system's own blocks, through the journal
+** if it has one
+**
+** @param id          The id of the first block
+** @param buf         Their new contents
+** @param num_blocks  The number of blocks
+**
+** @return 0 if successful, -1 if not
+*/
+int _blk_save_meta( blkno_t id, char *buf, int num_blocks ){
+    return save_meta( id, buf, num_blocks );
 }
 
 /**
@@ -203,25 +1222,21 @@ int _blk_alloc( int num ){
 **
 ** @return 0 if successful, -1 if not
 */
-int _blk_save_file( int id, file_t *file ){
-    
-    // get the block
-    block_t block = block_list[id];
-
-    // get the device
-    hddDeviceList_t list = _get_device_list();
-    hddDevice_t device = list.devices[block.device];
+int _blk_save_file( blkno_t id, file_t *file ){
 
-    // write it to the disk
-    bool_t result = _write_disk( device, block.startl, block.starth, NUM_SECTORS, (uint16_t *) file );
-
-    // check result of write
-    if ( !result ){
-        __cio_printf( "Unable to write to disk\n");
+    // the i-node fills only the start of the block
+    char *buf = ( char * ) _iob_get();
+    if ( buf == NULL ){
         return E_FAILURE;
     }
+    __memclr( buf, block_size );
+    __memcpy( buf, file, sizeof( file_t ) );
 
-    return SUCCESS; 
+    // it's metadata, so it goes through the journal
+    int result = save_meta( id, buf, 1 );
+    _iob_put( buf );
+
+    return result;
 }
 
 /**
@@ -234,28 +1249,45 @@ int _blk_save_file( int id, file_t *file ){
 **
 ** @return 0 if successful, -1 if not
 */
-int _blk_load_file( int id, file_t *file ){
-    
+int _blk_load_file( blkno_t id, file_t *file ){
+
+    // the journal may have a newer copy than the disk
+    const char *cached = _jnl_lookup( id );
+    if ( cached != NULL ){
+        __memcpy( file, cached, sizeof( file_t ) );
+        return SUCCESS;
+    }
+
     // get the block
-    block_t block = block_list[id];
+    block_t block = map_block( id );
     
     // get the device
     hddDeviceList_t list = _get_device_list();
     hddDevice_t device = list.devices[block.device];
 
-    uint16_t *buf = _km_slice_alloc();
+    uint16_t *buf = _iob_get();
+    if ( buf == NULL ){
+        return E_FAILURE;
+    }
 
     // read it from the disk
-    bool_t result = _read_disk( device, block.startl, block.starth,\
-    NUM_SECTORS, buf );
+    uint64_t start = _clk_ns();
+    TRACE_EV( TRC_BLK_ISSUE, id, 1 );
+    bool_t result = _read_disk( device, block.start, 1u << dev_shift[block.device], buf );
+    _lat_record( LAT_BLK_READ, _clk_ns() - start );
+    count_io( block.device, block_size, false, result );
+    TRACE_EV( TRC_BLK_DONE, false, result );
 
     // check result of read
     if ( !result ){
         __cio_printf( "Unable to read from disk\n");
+        _iob_put( buf );
         return E_FAILURE;
     }
 
-    file = ( file_t *) buf;
+    // hand the i-node back to the caller
+    __memcpy( file, buf, sizeof( file_t ) );
+    _iob_put( buf );
 
     return SUCCESS; 
 }
@@ -264,7 +1296,9 @@ int _blk_load_file( int id, file_t *file ){
 ** Name:  _blk_load_filecontents
 **
 ** Given the contents of a file and the starting block, loads the file 
-** contents from the disk
+** contents from the disk. Consecutive blocks on the same device are
+** read with a single disk command. Any of them the journal hasn't
+** checkpointed yet are filled in from it.
 **
 ** @param id          The id of the starting block of the file
 ** @param contents    Buffer where contents are to be written
@@ -272,35 +1306,14 @@ int _blk_load_file( int id, file_t *file ){
 **
 ** @return 0 if successful, -1 if not
 */
-int _blk_load_filecontents( int id, char *buf, int num_blocks ){
-    
-    // for passing in to the disk driver
-    char *buf_ptr = buf;
-
-    // go through each block
-    for( int i = id; i < id + num_blocks; i++ ){
-        
-	// get the block
-        block_t block = block_list[i];
-        
-	// get the device
-        hddDeviceList_t list = _get_device_list();
-        hddDevice_t device = list.devices[block.device];
+int _blk_load_filecontents( blkno_t id, char *buf, int num_blocks ){
 
-	// read block from the disk
-        bool_t result = _read_disk( device, block.startl, block.starth,\
-        NUM_SECTORS, ( uint16_t *) buf_ptr );
-        
-	// check result of read
-        if ( !result ){
-            __cio_printf( "Unable to read from disk\n");
-            return E_FAILURE;
-        }
-	
-	// this now points to the next part of buffer to be filled
-	buf_ptr += BLOCK_SIZE;
+    if ( transfer_run( id, buf, num_blocks, false ) < 0 ){
+        return E_FAILURE;
     }
 
+    // metadata blocks the journal has newer copies of
+    _jnl_overlay( id, buf, num_blocks );
     return SUCCESS;
 }
 
@@ -308,7 +1321,8 @@ int _blk_load_filecontents( int id, char *buf, int num_blocks ){
 ** Name:  _blk_save_filecontents
 **
 ** Given the contents of a file and the starting block, stores the file 
-** contents onto the disk
+** contents onto the disk. Consecutive blocks on the same device are
+** written with a single disk command.
 **
 ** @param id          The id of the starting block of the file
 ** @param contents    Buffer containing contents of the file
@@ -316,36 +1330,6 @@ int _blk_load_filecontents( int id, char *buf, int num_blocks ){
 **
 ** @return 0 if successful, -1 if not
 */
-int _blk_save_filecontents( int id, char *contents, int num_blocks ){
-    
-    // for passing in to the disk driver
-    char *buf_ptr = contents;
-
-    // go through each block
-    for( int i = id; i < id + num_blocks; i++ ){
-        
-	// get the block
-        block_t block = block_list[i];
-        
-	// get the device
-        hddDeviceList_t list = _get_device_list();
-        hddDevice_t device = list.devices[block.device];
-
-	// write block to the disk
-        bool_t result = _write_disk( device, block.startl, block.starth,\
-        NUM_SECTORS, ( uint16_t *) buf_ptr );
-        
-	// check result of write
-        if ( !result ){
-            __cio_printf( "Unable to write to disk\n");
-            return E_FAILURE;
-        }
-	
-	// this now points to the next part of buffer to be written
-	buf_ptr += BLOCK_SIZE;
-    }
-
-    return SUCCESS;
+int _blk_save_filecontents( blkno_t id, char *contents, int num_blocks ){
+    return transfer_run( id, contents, num_blocks, true );
 }
-
-
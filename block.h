@@ -10,6 +10,8 @@
 #ifndef BLOCK_H_
 #define BLOCK_H_
 
+#include "kstats.h"
+
 // this is to avoid recursive #include statements
 // now the compiler knows that file_t exists without including file.h
 typedef struct i_node_s file_t;
@@ -20,8 +22,13 @@ typedef struct i_node_s file_t;
 ** This section of the header file contains definitions that can be
 ** used in either C or assembly-language source code.
 */
-#define BLOCK_SIZE 1024
-#define NUM_SECTORS 2
+// limits on the block size chosen when the file system is mounted
+#define BLOCK_SIZE_MIN 1024
+#define BLOCK_SIZE_MAX 65536
+
+// identifies a disk holding this file system, and the layout version
+#define BLK_MAGIC   0x53465053  // "SPFS"
+#define BLK_VERSION 2
 
 #ifndef SP_ASM_SRC
 
@@ -36,16 +43,43 @@ typedef struct i_node_s file_t;
 ** Types
 */
 
+// a sector address on a device (48 bits are used)
+typedef uint64_t lba_t;
+
+// a block id, or a count of blocks
+typedef uint64_t blkno_t;
+
+// returned by _blk_alloc when no run of free blocks is available
+#define BLK_NONE ( (blkno_t) -1 )
+
 /*
-** Stores info about each block in the disk
+** Where a block lives on the disk; computed from the id as needed
 */
 typedef struct block_node {
-    uint32_t id;       // unique id
+    blkno_t id;        // unique id
     uint32_t device;   // index of device in device list 
-    uint32_t startl;   // lower half of address of starting sector
-    uint32_t starth;   // upper half of address of starting sector
+    lba_t start;       // address of starting sector
 } block_t;
 
+/*
+** The superblock, at the start of block 0 of the first disk. Every
+** 64-bit field is 8-byte aligned, so the layout is the same for the
+** kernel and for 64-bit host tools.
+*/
+typedef struct blk_super_s {
+    uint32_t magic;         // BLK_MAGIC
+    uint32_t version;       // BLK_VERSION
+    uint32_t block_size;    // in bytes
+    uint32_t reserved;
+    blkno_t block_count;    // blocks on all the disks together
+    blkno_t bitmap_start;   // first block of the allocation bitmap
+    blkno_t bitmap_blocks;  // number of blocks it takes
+    blkno_t table_start;    // first block of the file table
+    blkno_t table_blocks;   // number of blocks it takes
+    blkno_t journal_start;  // first block of the journal (version 2)
+    blkno_t journal_blocks; // number of blocks it takes, or 0 for none
+} blk_super_t;
+
 /*
 ** Globals
 */
@@ -57,11 +91,76 @@ typedef struct block_node {
 /**
 ** Name:  _blk_init
 **
-** Initializes all the blocks in the disk and assigns sectors to them. The 
-** bitmap is also initialized here.
+** Chooses the block size, works out how many blocks each disk holds
+** and where each disk's blocks start. If the disks hold a file system
+** it is mounted: its block size is used and its bitmap loaded.
+** Otherwise the bitmap starts out empty, and _blk_format must be
+** called before any blocks are used. A mounted file system's journal
+** is replayed before its bitmap is loaded.
+**
+** The block size must be a power of two between BLOCK_SIZE_MIN and
+** BLOCK_SIZE_MAX and no smaller than any device's logical sector. If
+** it is smaller than a device's physical sector it is raised to match,
+** so writes never need a read-modify-write in the drive. A size of 0
+** picks the smallest size that satisfies every device.
+**
+** @param size   The requested block size, in bytes, or 0
+**
+** @return 0 if successful, -1 if not
+*/
+int _blk_init( uint32_t size );
+
+/**
+** Name:  _blk_format
+**
+** Writes an empty file system onto the disks, with room for a file
+** table of the given size, and mounts it
+**
+** @param size         The requested block size, in bytes, or 0 (as
+**                     for _blk_init)
+** @param table_bytes  The size of the file table, in bytes
+**
+** @return 0 if successful, -1 if not
+*/
+int _blk_format( uint32_t size, uint32_t table_bytes );
+
+/**
+** Name:  _blk_super
+**
+** Returns the superblock of the mounted file system
+**
+** @return the superblock, or NULL if nothing is mounted
+*/
+const blk_super_t *_blk_super( void );
+
+/**
+** Name:  _blk_reserved
+**
+** Returns the number of blocks at the start of the disks which the
+** mounted file system keeps for itself: the superblock, the bitmap,
+** the file table and the journal
+**
+** @return the number of blocks
+*/
+blkno_t _blk_reserved( void );
+
+/**
+** Name:  _blk_size
+**
+** Returns the block size chosen by _blk_init
+**
+** @return the block size, in bytes
+*/
+uint32_t _blk_size( void );
+
+/**
+** Name:  _blk_stats
+**
+** Fills in the device and block allocator parts of a kstats_t
 **
+** @param ks   The statistics to fill in
 */
-void _blk_init( void );
+void _blk_stats( kstats_t *ks );
 
 /**
 ** Name:  _blk_alloc
@@ -70,19 +169,51 @@ void _blk_init( void );
 **
 ** @param num    The number of disk blocks to be allocated
 **
-** @return id of the first disk block 
+** @return id of the first disk block, or BLK_NONE
 */
-int _blk_alloc( int num );
+blkno_t _blk_alloc( uint32_t num );
 
 /**
 ** Name:  _blk_free
 **
 ** Frees a single disk block, given the id
 **
-** @param index    The id of the block to be freed
+** @param id    The id of the block to be freed
 **
 */
-void _blk_free( int index );
+void _blk_free( blkno_t id );
+
+/**
+** Name:  _blk_free_run
+**
+** Frees a run of consecutive disk blocks
+**
+** @param id    The id of the first block to be freed
+** @param num   The number of blocks
+*/
+void _blk_free_run( blkno_t id, uint32_t num );
+
+/**
+** Name:  _blk_committed
+**
+** Called by the journal once a transaction is committed; the blocks
+** freed in it can now be reused
+*/
+void _blk_committed( void );
+
+/**
+** Name:  _blk_save_meta
+**
+** Writes a run of the file system's own blocks, through the journal
+** if it has one
+**
+** @param id          The id of the first block
+** @param buf         Their new contents
+** @param num_blocks  The number of blocks
+**
+** @return 0 if successful, -1 if not
+*/
+int _blk_save_meta( blkno_t id, char *buf, int num_blocks );
 
 /**
 ** Name:  _blk_load_file
@@ -94,7 +225,7 @@ void _blk_free( int index );
 **
 ** @return 0 if successful, -1 if not
 */
-int _blk_load_file( int id, file_t *file );
+int _blk_load_file( blkno_t id, file_t *file );
 
 /**
 ** Name:  _blk_save_file
@@ -106,7 +237,7 @@ int _blk_load_file( int id, file_t *file );
 **
 ** @return 0 if successful, -1 if not
 */
-int _blk_save_file( int id, file_t *file );
+int _blk_save_file( blkno_t id, file_t *file );
 
 /**
 ** Name:  _blk_load_filecontents
@@ -120,7 +251,7 @@ int _blk_save_file( int id, file_t *file );
 **
 ** @return 0 if successful, -1 if not
 */
-int _blk_load_filecontents( int id, char *buf, int num_blocks );
+int _blk_load_filecontents( blkno_t id, char *buf, int num_blocks );
 
 /**
 ** Name:  _blk_save_filecontents
@@ -134,7 +265,7 @@ int _blk_load_filecontents( int id, char *buf, int num_blocks );
 **
 ** @return 0 if successful, -1 if not
 */
-int _blk_save_filecontents( int id, char *contents, int num_blocks );
+int _blk_save_filecontents( blkno_t id, char *contents, int num_blocks );
 
 #endif
 /* SP_ASM_SRC */
@@ -18,11 +18,66 @@
 #include "process.h"
 #include "queues.h"
 #include "scheduler.h"
+#include "profile.h"
 
 /*
 ** PRIVATE DEFINITIONS
 */
 
+/*
+** Timers live on a hashed timing wheel:  a timer expiring at time T
+** is kept in slot (T mod WHEEL_SLOTS).  Adding and cancelling are
+** O(1); each tick only looks at the one slot for the current time.
+**
+** Timers more than a full revolution away wait on a heap queue instead,
+** soonest first, and are moved onto the wheel once they come within a
+** revolution of their expiration time, so a slot only ever holds
+** timers which are due when it comes around.  Should the heap be out
+** of memory, a far timer goes onto the wheel anyway, and is passed
+** over (and left in place) until its time comes.
+*/
+
+#define WHEEL_SLOTS     256
+#define WHEEL_MASK      (WHEEL_SLOTS - 1)
+
+// PIT input clocks per tick
+#define TICK_DIVISOR    (TIMER_FREQUENCY / CLOCK_FREQUENCY)
+
+/*
+** The TSC is calibrated at boot by counting cycles while PIT timer 2
+** counts down TSC_CAL_COUNT input clocks (about 10ms).  Conversion to
+** nanoseconds is then a multiply and a shift:
+**
+**      ns = (cycles * _tsc_mult) >> TSC_SHIFT
+**
+** which avoids 64-bit division (we have no libgcc to do it for us).
+*/
+
+#define TSC_CAL_COUNT   (TIMER_FREQUENCY / 100)
+#define TSC_CAL_NS      ((uint32_t) (((uint64_t) TSC_CAL_COUNT * 1000000000ULL) \
+                            / TIMER_FREQUENCY))
+#define TSC_SHIFT       24
+
+// give up on calibration if timer 2 hasn't finished after this many polls
+#define TSC_CAL_SPINS   100000000
+
+// fewest cycles in the window for _tsc_mult to fit in 32 bits; a
+// slower TSC (under about 39 MHz) is treated as unusable
+#define TSC_CAL_MIN     ((TSC_CAL_NS >> (32 - TSC_SHIFT)) + 1)
+
+#ifdef TICKLESS_IDLE
+/*
+** With TICKLESS_IDLE defined, the periodic tick is stopped whenever
+** only the idle process has anything to do.  The PIT is instead set
+** to interrupt once, when the next timer is due; the ISR (or the
+** scheduler, if some other interrupt makes a process ready first)
+** then brings _system_time up to date and restarts the tick.
+*/
+
+// the longest one-shot the PIT's 16-bit counter can hold, in ticks
+#define TICKLESS_MAX    (0xffff / TICK_DIVISOR)
+#endif
+
 /*
 ** PRIVATE DATA TYPES
 */
@@ -35,6 +90,24 @@
 static uint32_t _pinwheel;   // pinwheel counter
 static uint32_t _pindex;     // index into pinwheel string
 
+// the timing wheel
+static ktimer_t *_wheel[WHEEL_SLOTS];
+static uint32_t _timers;     // number of pending timers
+
+// timers more than a revolution away, and what their pprev points to
+static queue_t _far;
+static ktimer_t *_far_link;
+
+#ifdef TICKLESS_IDLE
+// ticks covered by the pending one-shot, or 0 if ticking normally
+static uint32_t _tickless;
+#endif
+
+// TSC calibration results
+static uint64_t _tsc_base;   // TSC value at calibration
+static uint32_t _tsc_mult;   // ns per cycle, scaled by 2^TSC_SHIFT; 0 if unusable
+static uint32_t _tsc_khz;    // TSC frequency
+
 /*
 ** PUBLIC GLOBAL VARIABLES
 */
@@ -42,17 +115,15 @@ static uint32_t _pindex;     // index into pinwheel string
 // current system time
 time_t _system_time;
 
-// we own the sleep queue
-queue_t _sleeping;
-
 /*
 ** PRIVATE FUNCTIONS
 */
 
 /**
-** Name:  _cmp_wakeup
+** Name:  _cmp_expires
 **
-** Ordering function for the sleep queue
+** Ordering function for the far timer queue; keys are expiration
+** times, compared so that the wraparound of _system_time is harmless
 **
 ** @param v1    First key value to examine
 ** @param v2    Second key value to examine
@@ -62,22 +133,265 @@ queue_t _sleeping;
 **      = 0   v1 == v2
 **      > 0   v1 > v2
 */
-static int _cmp_wakeup( const void *v1, const void *v2 ) {
+static int _cmp_expires( const void *v1, const void *v2 ) {
+    int32_t diff = (int32_t) ( (time_t) v1 - (time_t) v2 );
 
-    // QUESTION:  does it make more sense to put this function
-    // somewhere else with a name like "_cmp_uint32", which would
-    // make it more generic and thus usable for other ordered
-    // queues which sort in ascending order by uint32_t values?
+    return( diff < 0 ? -1 : ( diff > 0 ? 1 : 0 ) );
+}
 
-    // we just do direct comparisons between the void* values,
-    // because pointers are essentially unsigned integers in IA32
+/**
+** Name:  _timer_link
+**
+** Put a timer into the wheel slot for its expiration time, or onto
+** the far queue if it is more than a revolution away
+**
+** @param t   The timer
+*/
+static void _timer_link( ktimer_t *t ) {
+
+    if( t->expires - _system_time >= WHEEL_SLOTS &&
+            _que_enque(_far,t,t->expires) == E_SUCCESS ) {
+        t->next = NULL;
+        t->pprev = &_far_link;
+        return;
+    }
+
+    ktimer_t **head = &_wheel[ t->expires & WHEEL_MASK ];
+
+    t->next = *head;
+    if( t->next != NULL ) {
+        t->next->pprev = &t->next;
+    }
+    t->pprev = head;
+    *head = t;
+}
+
+/**
+** Name:  _timer_unlink
+**
+** Take a pending timer out of whatever list it is on
+**
+** @param t   The timer
+*/
+static void _timer_unlink( ktimer_t *t ) {
+
+    if( t->pprev == &_far_link ) {
+        (void) _que_remove( _far, t );
+    } else {
+        *(t->pprev) = t->next;
+        if( t->next != NULL ) {
+            t->next->pprev = t->pprev;
+        }
+    }
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+/**
+** Name:  _timer_approach
+**
+** Move the far timers which are now within a revolution of their
+** expiration time onto the wheel
+*/
+static void _timer_approach( void ) {
+    ktimer_t *t;
+
+    while( (t = _que_peek(_far)) != NULL &&
+            t->expires - _system_time < WHEEL_SLOTS ) {
+        (void) _que_deque( _far );
+
+        // they come off in order, so none can have been missed
+        assert2( (int32_t) (t->expires - _system_time) >= 0 );
 
-	if( v1 < v2 )
-        return( -1 );
-	else if( v1 == v2 )
-        return( 0 );
-	else
-        return( 1 );
+        _timer_link( t );
+    }
+}
+
+/**
+** Name:  _timer_expire
+**
+** Fire all timers in the current slot whose time has come
+*/
+static void _timer_expire( void ) {
+    ktimer_t *list;
+
+    /*
+    ** Detach the whole slot first; callbacks may add new timers
+    ** or cancel others, and anything cancelled while on our
+    ** private list simply unlinks itself from it.
+    */
+
+    _timer_approach();
+
+    ktimer_t **slot = &_wheel[ _system_time & WHEEL_MASK ];
+    list = *slot;
+    *slot = NULL;
+    if( list != NULL ) {
+        list->pprev = &list;
+    }
+
+    while( list != NULL ) {
+        ktimer_t *t = list;
+        _timer_unlink( t );
+
+        if( (int32_t) (t->expires - _system_time) > 0 ) {
+            // not this time around; back onto the wheel it goes
+            _timer_link( t );
+        } else {
+            _timers -= 1;
+            t->func( t );
+        }
+    }
+}
+
+/**
+** Name:  _clk_advance
+**
+** Move the system time forward, running timers as we go
+**
+** @param ticks  How many ticks have passed
+*/
+static void _clk_advance( uint32_t ticks ) {
+
+    while( ticks-- > 0 ) {
+        ++_system_time;
+        _timer_expire();
+    }
+}
+
+/**
+** Name:  _pit_periodic
+**
+** Program the PIT to interrupt CLOCK_FREQUENCY times per second
+*/
+static void _pit_periodic( void ) {
+
+    __outb( TIMER_CONTROL_PORT, TIMER_0_LOAD | TIMER_0_SQUARE );
+    __outb( TIMER_0_PORT, TICK_DIVISOR & 0xff );        // LSB of divisor
+    __outb( TIMER_0_PORT, (TICK_DIVISOR >> 8) & 0xff ); // MSB of divisor
+}
+
+#ifdef TICKLESS_IDLE
+/**
+** Name:  _pit_oneshot
+**
+** Program the PIT to interrupt once, after some number of ticks
+**
+** @param ticks  The delay (at most TICKLESS_MAX)
+*/
+static void _pit_oneshot( uint32_t ticks ) {
+    uint32_t count = ticks * TICK_DIVISOR;
+
+    __outb( TIMER_CONTROL_PORT, TIMER_0_LOAD | TIMER_0_ENDSIGNAL );
+    __outb( TIMER_0_PORT, count & 0xff );
+    __outb( TIMER_0_PORT, (count >> 8) & 0xff );
+}
+
+/**
+** Name:  _pit_count
+**
+** @return the PIT's current (remaining) count
+*/
+static uint32_t _pit_count( void ) {
+    uint32_t lo, hi;
+
+    __outb( TIMER_CONTROL_PORT, TIMER_0_SELECT | TIMER_0_LATCH );
+    lo = __inb( TIMER_0_PORT ) & 0xff;
+    hi = __inb( TIMER_0_PORT ) & 0xff;
+
+    return( (hi << 8) | lo );
+}
+
+/**
+** Name:  _next_deadline
+**
+** Find the earliest pending timer
+**
+** @return the number of ticks until it is due, at most TICKLESS_MAX
+*/
+static uint32_t _next_deadline( void ) {
+
+    for( uint32_t k = 1; k < TICKLESS_MAX; ++k ) {
+        time_t when = _system_time + k;
+        for( ktimer_t *t = _wheel[when & WHEEL_MASK]; t; t = t->next ) {
+            if( t->expires == when ) {
+                return( k );
+            }
+        }
+    }
+
+    return( TICKLESS_MAX );
+}
+#endif
+
+/**
+** Name:  _div64
+**
+** 64-by-32 bit unsigned division, by shift and subtract
+**
+** @param n   Dividend
+** @param d   Divisor (non-zero)
+**
+** @return the quotient
+*/
+static uint64_t _div64( uint64_t n, uint32_t d ) {
+    uint64_t q = 0;
+    uint64_t r = 0;
+
+    for( int i = 63; i >= 0; --i ) {
+        r = (r << 1) | ((n >> i) & 1);
+        if( r >= d ) {
+            r -= d;
+            q |= (1ULL << i);
+        }
+    }
+
+    return( q );
+}
+
+/**
+** Name:  _tsc_calibrate
+**
+** Measure the TSC frequency against PIT timer 2
+*/
+static void _tsc_calibrate( void ) {
+    uint32_t gate = __inb( TIMER_2_GATE_PORT ) & ~TIMER_2_SPEAKER;
+    uint64_t start, end;
+    uint32_t spin;
+
+    // load timer 2 with the gate closed, so it holds the count
+    __outb( TIMER_2_GATE_PORT, gate & ~TIMER_2_GATE );
+    __outb( TIMER_CONTROL_PORT, TIMER_2_SELECT | TIMER_2_READ | TIMER_MODE_0 );
+    __outb( TIMER_2_PORT, TSC_CAL_COUNT & 0xff );
+    __outb( TIMER_2_PORT, (TSC_CAL_COUNT >> 8) & 0xff );
+
+    // open the gate and wait for OUT to go high at terminal count
+    __outb( TIMER_2_GATE_PORT, gate | TIMER_2_GATE );
+    start = _clk_tsc();
+    for( spin = 0; spin < TSC_CAL_SPINS; ++spin ) {
+        if( __inb(TIMER_2_GATE_PORT) & TIMER_2_OUT ) {
+            break;
+        }
+    }
+    end = _clk_tsc();
+
+    __outb( TIMER_2_GATE_PORT, gate & ~TIMER_2_GATE );
+
+    _tsc_base = end;
+    _tsc_mult = 0;
+    _tsc_khz = 0;
+
+    uint64_t cycles = end - start;
+    if( spin == TSC_CAL_SPINS || cycles < TSC_CAL_MIN
+            || (cycles >> 32) != 0 ) {
+        // no usable timer 2, or a TSC too slow or too fast to
+        // measure this way
+        return;
+    }
+
+    _tsc_mult = (uint32_t) _div64( (uint64_t) TSC_CAL_NS << TSC_SHIFT,
+                                   (uint32_t) cycles );
+    _tsc_khz = (uint32_t) _div64( cycles * 1000000ULL, TSC_CAL_NS );
 }
 
 /**
@@ -90,6 +404,12 @@ static int _cmp_wakeup( const void *v1, const void *v2 ) {
 */
 static void _clk_isr( int vector, int code ) {
 
+#ifdef PROFILE
+    // sample the interrupted process before anything can
+    // replace it as the current process
+    _prof_tick( _current );
+#endif
+
 	// spin the pinwheel
 	
     ++_pinwheel;
@@ -108,9 +428,9 @@ static void _clk_isr( int vector, int code ) {
 
     if( (_system_time % SEC_TO_TICKS(STATUS)) == 0 ) {
         __cio_printf_at( 3, 0,
-            "%3d procs:  sl/%d wt/%d rd/%d zo/%d  r %d %d %d %d    ",
+            "%3d procs:  tm/%d wt/%d rd/%d zo/%d  r %d %d %d %d    ",
                 _active_procs,
-                _que_length(_sleeping), _que_length(_waiting),
+                _clk_timer_count(), _que_length(_waiting),
                 _que_length(_reading), _que_length(_zombie),
                 _que_length(_ready[0]), _que_length(_ready[1]),
                 _que_length(_ready[2]), _que_length(_ready[3])
@@ -121,24 +441,22 @@ static void _clk_isr( int vector, int code ) {
 #endif
 
     // time marches on!
-	++_system_time;
-	
-    // wake up an sleeping processes whose time has come
-    //
-    // we give them preference over the current process
-    // (when it is scheduled again)
+    uint32_t elapsed = 1;
 
-    // peek at the first element on the sleep queue
-	pcb_t *tmp = _que_peek( _sleeping );
+#ifdef TICKLESS_IDLE
+    // if this is the end of a one-shot, it covered several ticks
+    if( _tickless ) {
+        elapsed = _tickless;
+        _tickless = 0;
+        _pit_periodic();
+    }
+#endif
+
+    // run any timers whose time has come; this wakes up sleeping
+    // processes, which we give preference over the current process
+    // (when it is scheduled again)
+    _clk_advance( elapsed );
 
-    // loop as long as there is something on the queue AND
-    // it's (past?) time for that process to wake up
-	while( tmp != NULL && tmp->event.wakeup <= _system_time ) {
-		tmp = _que_deque( _sleeping );
-		_schedule( tmp );
-		tmp = _que_peek( _sleeping );
-	}
-	
     // check the current process to see if its time slice has expired
 	_current->ticks -= 1;
 
@@ -148,6 +466,18 @@ static void _clk_isr( int vector, int code ) {
         // pick a new "current" process
 		_dispatch();
 	}
+
+#ifdef TICKLESS_IDLE
+    // if only the idle process can run, stop the tick until
+    // the next timer is due
+    if( _sched_idle() ) {
+        uint32_t ticks = _next_deadline();
+        if( ticks > 1 ) {
+            _pit_oneshot( ticks );
+            _tickless = ticks;
+        }
+    }
+#endif
 	
     // tell the PIC we're done
 	__outb( PIC_PRI_CMD_PORT, PIC_EOI );
@@ -173,20 +503,209 @@ void _clk_init( void ) {
 
     // return to the dawn of time
 	_system_time = 0;
+
+    // create the queue for timers too far off for the wheel
+    _far = _que_alloc_heap( _cmp_expires );
+    assert( _far != NULL );
 	
+    // see how fast the TSC runs
+    _tsc_calibrate();
+
 	// configure the clock
-    uint32_t divisor = TIMER_FREQUENCY / CLOCK_FREQUENCY;
-    __outb( TIMER_CONTROL_PORT, TIMER_0_LOAD | TIMER_0_SQUARE );
-    __outb( TIMER_0_PORT, divisor & 0xff );        // LSB of divisor
-    __outb( TIMER_0_PORT, (divisor >> 8) & 0xff ); // MSB of divisor
-	
-    // create the sleep queue
-	_sleeping = _que_alloc( _cmp_wakeup );
-	assert( _sleeping != NULL );
+    _pit_periodic();
 	
     // register the second-stage ISR
 	__install_isr( INT_VEC_TIMER, _clk_isr );
 	
     // report that we're all set
-	__cio_puts( " done" );
+    if( _tsc_mult != 0 ) {
+        __cio_printf( " done (%d MHz TSC)", _tsc_khz / 1000 );
+    } else {
+        __cio_puts( " done (no TSC)" );
+    }
+}
+
+/**
+** Name:  _clk_tsc
+**
+** @return the current value of the time-stamp counter
+*/
+uint64_t _clk_tsc( void ) {
+    uint64_t tsc;
+
+    __asm volatile( "rdtsc" : "=A" (tsc) );
+
+    return( tsc );
+}
+
+/**
+** Name:  _clk_ns
+**
+** Get a high-resolution timestamp.  If the TSC couldn't be
+** calibrated, this falls back to the system time.
+**
+** @return nanoseconds since the clock was initialized
+*/
+uint64_t _clk_ns( void ) {
+
+    if( _tsc_mult == 0 ) {
+        return( (uint64_t) _system_time * (1000000ULL / TICKS_PER_MS) );
+    }
+
+    uint64_t cycles = _clk_tsc() - _tsc_base;
+
+    // (cycles * mult) >> TSC_SHIFT, done in two 32x32 pieces
+    uint64_t lo = (uint64_t) (uint32_t) cycles * _tsc_mult;
+    uint64_t hi = (uint64_t) (uint32_t) (cycles >> 32) * _tsc_mult;
+
+    return( (lo >> TSC_SHIFT) + (hi << (32 - TSC_SHIFT)) );
+}
+
+/**
+** Name:  _clk_tsc_khz
+**
+** @return the calibrated TSC frequency in kHz, or 0 if unknown
+*/
+uint32_t _clk_tsc_khz( void ) {
+    return( _tsc_khz );
+}
+
+#ifdef TICKLESS_IDLE
+/**
+** Name:  _clk_wake
+**
+** Restart the periodic tick early, because something other than
+** the idle process has become ready.  The system time is brought
+** up to date with the part of the one-shot that has gone by.
+*/
+void _clk_wake( void ) {
+
+    if( _tickless == 0 ) {
+        return;
+    }
+
+    uint32_t total = _tickless * TICK_DIVISOR;
+    uint32_t left = _pit_count();
+    uint32_t done;
+
+    if( left == 0 || left > total ) {
+        // the count already ran out (and wrapped); that interrupt
+        // is pending, and it will supply the final tick
+        done = _tickless - 1;
+    } else {
+        done = (total - left) / TICK_DIVISOR;
+    }
+
+    _tickless = 0;
+    _pit_periodic();
+    _clk_advance( done );
+}
+#endif
+
+/**
+** Name:  _clk_timer_init
+**
+** Prepare a timer for use
+**
+** @param t     The timer
+** @param func  Function to call when the timer expires
+** @param arg   Data for the owner's use
+*/
+void _clk_timer_init( ktimer_t *t, void (*func)(ktimer_t *), void *arg ) {
+
+    assert1( t != NULL && func != NULL );
+
+    t->next = NULL;
+    t->pprev = NULL;
+    t->expires = 0;
+    t->func = func;
+    t->arg = arg;
+}
+
+/**
+** Name:  _clk_timer_add
+**
+** Arm a timer to expire after some number of ticks.  An already
+** pending timer is re-armed with the new delay.
+**
+** @param t      The timer
+** @param ticks  Delay, in clock ticks (0 is treated as 1)
+*/
+void _clk_timer_add( ktimer_t *t, uint32_t ticks ) {
+
+    assert1( t != NULL && t->func != NULL );
+
+    if( t->pprev != NULL ) {
+        _timer_unlink( t );
+    } else {
+        _timers += 1;
+    }
+
+    // the soonest we can do anything is the next tick
+    if( ticks == 0 ) {
+        ticks = 1;
+    }
+
+    t->expires = _system_time + ticks;
+    _timer_link( t );
+}
+
+/**
+** Name:  _clk_timer_cancel
+**
+** Disarm a timer
+**
+** @param t   The timer
+**
+** @return true if the timer was pending, else false
+*/
+bool_t _clk_timer_cancel( ktimer_t *t ) {
+
+    assert1( t != NULL );
+
+    if( t->pprev == NULL ) {
+        return( false );
+    }
+
+    _timer_unlink( t );
+    _timers -= 1;
+
+    return( true );
+}
+
+/**
+** Name:  _clk_timer_count
+**
+** @return the number of timers currently pending
+*/
+uint32_t _clk_timer_count( void ) {
+    return( _timers );
+}
+
+/**
+** Name:  _clk_timer_dump
+**
+** Dump the timer wheel occupancy to the console
+**
+** @param msg   Optional message to print
+*/
+void _clk_timer_dump( const char *msg ) {
+    uint32_t used = 0, longest = 0;
+
+    for( int i = 0; i < WHEEL_SLOTS; ++i ) {
+        uint32_t n = 0;
+        for( ktimer_t *t = _wheel[i]; t != NULL; t = t->next ) {
+            ++n;
+        }
+        if( n > 0 ) {
+            ++used;
+        }
+        if( n > longest ) {
+            longest = n;
+        }
+    }
+
+    __cio_printf( "%s: %d pending, %d/%d slots used, longest %d, %d far\n",
+                  msg, _timers, used, WHEEL_SLOTS, longest,
+                  _que_length(_far) );
 }
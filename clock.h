@@ -42,6 +42,21 @@
 ** Types
 */
 
+/*
+** A kernel timer.  The owner embeds one of these in some longer-lived
+** structure, fills it in with _clk_timer_init(), and arms it with
+** _clk_timer_add().  When it expires, the callback is invoked from
+** the clock ISR with the timer as its argument; the timer is no
+** longer pending at that point, so the callback may re-arm it.
+*/
+typedef struct ktimer_s {
+    struct ktimer_s *next;      // next timer in this wheel slot
+    struct ktimer_s **pprev;    // link pointing at us; NULL if idle
+    time_t expires;             // system time at which we fire
+    void (*func)( struct ktimer_s * );  // what to do when we fire
+    void *arg;                  // owner's data
+} ktimer_t;
+
 /*
 ** Globals
 */
@@ -49,9 +64,6 @@
 // current system time
 extern time_t _system_time;
 
-// we own the sleep queue
-extern queue_t _sleeping;
-
 /*
 ** Prototypes
 */
@@ -64,6 +76,89 @@ extern queue_t _sleeping;
 */
 void _clk_init( void );
 
+/**
+** Name:  _clk_tsc
+**
+** @return the current value of the time-stamp counter
+*/
+uint64_t _clk_tsc( void );
+
+/**
+** Name:  _clk_ns
+**
+** Get a high-resolution timestamp.  If the TSC couldn't be
+** calibrated, this falls back to the system time.
+**
+** @return nanoseconds since the clock was initialized
+*/
+uint64_t _clk_ns( void );
+
+/**
+** Name:  _clk_tsc_khz
+**
+** @return the calibrated TSC frequency in kHz, or 0 if unknown
+*/
+uint32_t _clk_tsc_khz( void );
+
+#ifdef TICKLESS_IDLE
+/**
+** Name:  _clk_wake
+**
+** Restart the periodic tick if it was stopped while idle; called by
+** the scheduler when a non-idle process becomes ready
+*/
+void _clk_wake( void );
+#endif
+
+/**
+** Name:  _clk_timer_init
+**
+** Prepare a timer for use
+**
+** @param t     The timer
+** @param func  Function to call when the timer expires
+** @param arg   Data for the owner's use
+*/
+void _clk_timer_init( ktimer_t *t, void (*func)(ktimer_t *), void *arg );
+
+/**
+** Name:  _clk_timer_add
+**
+** Arm a timer to expire after some number of ticks.  An already
+** pending timer is re-armed with the new delay.
+**
+** @param t      The timer
+** @param ticks  Delay, in clock ticks (0 is treated as 1)
+*/
+void _clk_timer_add( ktimer_t *t, uint32_t ticks );
+
+/**
+** Name:  _clk_timer_cancel
+**
+** Disarm a timer
+**
+** @param t   The timer
+**
+** @return true if the timer was pending, else false
+*/
+bool_t _clk_timer_cancel( ktimer_t *t );
+
+/**
+** Name:  _clk_timer_count
+**
+** @return the number of timers currently pending
+*/
+uint32_t _clk_timer_count( void );
+
+/**
+** Name:  _clk_timer_dump
+**
+** Dump the timer wheel occupancy to the console
+**
+** @param msg   Optional message to print
+*/
+void _clk_timer_dump( const char *msg );
+
 #endif
 /* SP_ASM_SRC */
 
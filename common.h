@@ -134,6 +134,15 @@ typedef uint32_t time_t;
 // status return type
 typedef int status_t;
 
+// I/O vector, used by the scatter/gather file system calls
+typedef struct iovec_s {
+    void *base;           // start of this piece of the buffer
+    uint32_t len;         // length of this piece, in bytes
+} iovec_t;
+
+// maximum number of I/O vectors accepted by a single system call
+#define N_IOVECS    16
+
 // Error return values (e.g., from system calls)
 
 #define E_SUCCESS       (0)
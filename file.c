@@ -14,6 +14,7 @@
 #include "kmem.h"
 #include "file.h"
 #include "block.h"
+#include "iobuf.h"
 
 /*
 ** PRIVATE DEFINITIONS
@@ -33,9 +34,10 @@
 static filemap_t *file_to_block;
 
 /*
-** Number of files
+** Number of files, and the most there can be
 */
 static int file_count;
+static int file_max;
 
 /*
 ** PUBLIC GLOBAL VARIABLES
@@ -52,12 +54,12 @@ static int file_count;
 **
 ** @param file_id   The id of the file
 **
-** @return The block id 
+** @return The block id, or BLK_NONE
 **
 */
-int get_block_id( int file_id ){
+blkno_t get_block_id( int file_id ){
     
-    int block_id = -1;
+    blkno_t block_id = BLK_NONE;
     for ( int i = 0; i < file_count; i++ ){
         if ( file_to_block[i].file_id == file_id ){
 	    block_id = file_to_block[i].block_id;
@@ -67,6 +69,20 @@ int get_block_id( int file_id ){
     return block_id;
 }
 
+/**
+** Name:  blocks_for
+**
+** Number of disk blocks needed to hold some number of bytes
+**
+** @param bytes   The number of bytes
+**
+** @return The number of blocks
+*/
+static int blocks_for( uint32_t bytes ){
+    uint32_t size = _blk_size();
+    return ( bytes / size ) + ( ( bytes % size ) != 0 );
+}
+
 /*
 ** PUBLIC FUNCTIONS
 */
@@ -76,52 +92,145 @@ int get_block_id( int file_id ){
 **
 ** Initializes global variables and calls the block init function
 **
+** @param block_size   The block size to mount with, or 0 to pick one
+**
+** @return 0 if successful, -1 if not
 */
-void _fl_init(){
-    // Initilize the globals
-    file_to_block = ( filemap_t * ) _km_page_alloc( 2 );
+int _fl_init( uint32_t block_size ){
+    // Initilize the globals; the map is sized by _fl_mount
     file_count = 0;
+    file_max = 0;
 
     // call block init
-    _blk_init();
+    return _blk_init( block_size );
 }
 
 /**
-** Name:  _fl_create
+** Name:  _fl_mount
+**
+** Empties the map of file ids to i-nodes, making room in it for a
+** given number of files
+**
+** @param max_files   The most files there can be
+**
+** @return 0 if successful, -1 if not
+*/
+int _fl_mount( uint32_t max_files ){
+
+    if ( file_to_block != NULL ){
+        _km_page_free( file_to_block );
+    }
+
+    uint32_t bytes = max_files * sizeof( filemap_t );
+    file_to_block = ( filemap_t * ) _km_page_alloc( ( bytes + PAGE_SIZE - 1 )
+        / PAGE_SIZE );
+    if ( file_to_block == NULL ){
+        file_max = 0;
+        return E_FAILURE;
+    }
+
+    file_count = 0;
+    file_max = max_files;
+    return SUCCESS;
+}
+
+/**
+** Name:  _fl_register
+**
+** Records where the i-node of a file already on the disk is
+**
+** @param id      The id of the file
+** @param inode   The block holding its i-node
+**
+** @return 0 if successful, -1 if not
+*/
+int _fl_register( int id, blkno_t inode ){
+
+    if ( file_count >= file_max ){
+        return E_FAILURE;
+    }
+
+    file_to_block[file_count].file_id = id;
+    file_to_block[file_count].block_id = inode;
+    file_count++;
+
+    return SUCCESS;
+}
+
+/**
+** Name:  _fl_inode
 **
-** Creates a new file, given an id to assign to it
+** Returns the block holding the i-node of a file
 **
 ** @param id   The id of the file
 **
+** @return The block id, or BLK_NONE
+*/
+blkno_t _fl_inode( int id ){
+    return get_block_id( id );
+}
+
+/**
+** Name:  _fl_create
+**
+** Creates a new file, given an id to assign to it. The file's data
+** blocks and then its i-node block are allocated, so files created
+** one after another are laid out back to back.
+**
+** @param id      The id of the file
+** @param bytes   How many bytes it must be able to hold, or 0 for
+**                NUM_BLOCKS blocks' worth
+**
 ** @return 0 if successful, -1 if not
 */
-int _fl_create( int id ){
+int _fl_create( int id, uint32_t bytes ){
+
+    if ( file_count >= file_max ){
+        __cio_printf( "No room for more than %d files\n", file_max );
+        return E_FAILURE;
+    }
 
     // initialize file
-    file_t *file = ( file_t * ) _km_slice_alloc();
+    file_t *file = ( file_t * ) _km_alloc( sizeof( file_t ) );
+    if ( file == NULL ){
+        __cio_printf( "No memory for the i-node of file %d\n", id );
+        return E_FAILURE;
+    }
     file->id = id;
     file->bytes = 0;
-    file->block = _blk_alloc( NUM_BLOCKS );
+    file->blocks = bytes == 0 ? NUM_BLOCKS : blocks_for( bytes );
+    file->block = _blk_alloc( file->blocks );
 
     // alloc block to store i-node
-    int file_block = _blk_alloc( 1 );
-    filemap_t *fl_map = _km_slice_alloc();
-    fl_map->block_id = file_block;
-    fl_map->file_id = id;
+    blkno_t file_block = BLK_NONE;
+    if ( file->block != BLK_NONE ){
+        file_block = _blk_alloc( 1 );
+    }
+    if ( file->block == BLK_NONE || file_block == BLK_NONE ){
+        if ( file->block != BLK_NONE ){
+            _blk_free_run( file->block, file->blocks );
+        }
+        _km_free( file, sizeof( file_t ) );
+        return E_FAILURE;
+    }
 
     // save file and block ids to the map
-    file_to_block[file_count] = *fl_map;
+    file_to_block[file_count].file_id = id;
+    file_to_block[file_count].block_id = file_block;
     file_count++;
 
-    // save i-node to disk
+    // save i-node to disk, undoing everything if that fails
     int result = _blk_save_file( file_block, file );
     if ( result < 0 ){
-        return E_FAILURE; // something went wrong
+        file_count--;
+        _blk_free( file_block );
+        _blk_free_run( file->block, file->blocks );
+        _km_free( file, sizeof( file_t ) );
+        return E_FAILURE;
     }
 
     // free memory
-    _km_slice_free( fl_map );
-    _km_slice_free( file );
+    _km_free( file, sizeof( file_t ) );
 
     return SUCCESS;
 }
@@ -133,21 +242,27 @@ int _fl_create( int id ){
 **
 ** @param id   The id of the file
 **
-** @return the i-node
+** @return the i-node (which the caller must _km_free), or NULL
 */
 file_t *_fl_open( int id ){
     
     // get the block the i-node is in
-    int block_id = get_block_id( id );
-    if ( block_id == -1 ){
+    blkno_t block_id = get_block_id( id );
+    if ( block_id == BLK_NONE ){
         __cio_printf( "File %d does not have an i-node??\n", id );
         return NULL; // file i-node not found
     }
 
-    file_t *file = NULL;
+    file_t *file = ( file_t * ) _km_alloc( sizeof( file_t ) );
+    if ( file == NULL ){
+        __cio_printf( "No memory for the i-node of file %d\n", id );
+        return NULL;
+    }
+
     // load the file i-node from disk
     int result = _blk_load_file( block_id, file );
-    if ( result < 0 || file == NULL){
+    if ( result < 0 ){
+        _km_free( file, sizeof( file_t ) );
         return NULL; // something went wrong
     }
 
@@ -166,24 +281,21 @@ file_t *_fl_open( int id ){
 int _fl_delete( int id ){
     
     // get the block that the i-node is in
-    int block_id = get_block_id( id );
-    if ( block_id == -1 ){
+    blkno_t block_id = get_block_id( id );
+    if ( block_id == BLK_NONE ){
         __cio_printf( "File %d does not have an i-node??\n", id );
         return E_FAILURE; // file i-node not found
     }
 
     // load the file i-node from disk
-    file_t *file = NULL;
-    int result = _blk_load_file( block_id, file );
-    if ( result < 0 || file == NULL){
+    file_t file;
+    int result = _blk_load_file( block_id, &file );
+    if ( result < 0 ){
         return E_FAILURE; // something went wrong
     }
 
     // free file blocks
-    int start_block = file->block;
-    for( int i = 0; i < NUM_BLOCKS; i++ ){
-        _blk_free( start_block + i );
-    }
+    _blk_free_run( file.block, file.blocks );
 
     // free the file i-node block
     _blk_free( block_id );
@@ -193,7 +305,7 @@ int _fl_delete( int id ){
     int index = -1;
     for ( int i = 0; i < file_count; i++ ){
         if ( file_to_block[i].block_id == block_id ){
-	    index = -1;
+	    index = i;
 	    break;
 	}
     }
@@ -208,6 +320,7 @@ int _fl_delete( int id ){
             file_to_block[i].block_id = file_to_block[i+1].block_id;
 	}
     }
+    file_count--;
 
     return SUCCESS;
 }
@@ -215,7 +328,8 @@ int _fl_delete( int id ){
 /**
 ** Name:  _fl_close
 **
-** Saves a file i-node to the disk
+** Saves a file i-node to the disk. The i-node memory is still owned
+** by the caller afterwards.
 **
 ** @param file   The i-node of the file
 **
@@ -223,8 +337,8 @@ int _fl_delete( int id ){
 */
 int _fl_close( file_t *file ){
     
-    int block_id = get_block_id( file->id );
-    if ( block_id == -1 ){
+    blkno_t block_id = get_block_id( file->id );
+    if ( block_id == BLK_NONE ){
         __cio_printf( "File %d does not have an i-node??\n", file->id );
         return E_FAILURE; // file i-node not found
     }
@@ -235,9 +349,6 @@ int _fl_close( file_t *file ){
         return E_FAILURE; // something went wrong
     }
 
-    // free the file
-    _km_slice_free( file );
-
     return SUCCESS;
 }
 
@@ -253,12 +364,12 @@ int _fl_close( file_t *file ){
 */
 int _fl_read( file_t *file, char *buf){
     
-    // get the number of blocks to read
-    int num_blocks = ( file->bytes / BLOCK_SIZE ) + \
-    ( ( file->bytes % BLOCK_SIZE ) != 0 );
+    // the whole file goes into the caller's buffer
+    iovec_t iov;
+    iov.base = buf;
+    iov.len = file->bytes;
 
-    // read file contents from disk
-    int result = _blk_load_filecontents( file->block, buf, num_blocks );
+    int result = _fl_readv( file, &iov, 1 );
 
     // check result
     if ( result < 0 ){
@@ -266,10 +377,10 @@ int _fl_read( file_t *file, char *buf){
     }
 
     // nul-terminate buffer so it can be a string
-    buf[file->bytes] = '\0';
+    buf[result] = '\0';
 
     // return the number of characters read (includes NULL-terminator)
-    return file->bytes + 1;
+    return result + 1;
 }
 
 /**
@@ -285,45 +396,194 @@ int _fl_read( file_t *file, char *buf){
 */
 int _fl_write( file_t *file, char *buf, int buf_size ){
     
-    // make buffer to store the current contents of the file
-    int num_pages = ( file->bytes / PAGE_SIZE ) +
-        (( file->bytes % PAGE_SIZE ) != 0);
-    char *contents = ( char * ) _km_page_alloc( num_pages );
+    // a single buffer is just a one-entry vector
+    iovec_t iov;
+    iov.base = buf;
+    iov.len = buf_size;
 
-    // get the current contents of the file
-    int result = _fl_read( file, contents );
-    if ( result < 0 ){
-        return E_FAILURE; // could not load file contents
+    if ( _fl_writev( file, &iov, 1 ) < 0 ){
+        return E_FAILURE;
     }
 
-    // make a new buffer that can hold the combined contents
-    int num_bytes = file->bytes + buf_size;
-    int num_blocks = ( num_bytes / BLOCK_SIZE ) + 
-    ( ( num_bytes % BLOCK_SIZE ) != 0);
-    char *new_contents = _km_slice_alloc();
+    return SUCCESS;
+}
 
-    // append the new contents to the old in the new buffer
-    new_contents = __strcpy( new_contents, contents );
-    new_contents = __strcat( new_contents, buf );
+/**
+** Name:  _fl_readv
+**
+** Reads contents of a file, scattering them across several buffers.
+** The file is brought in a staging buffer at a time, each with one
+** disk read, and copied out to the buffers in order until either the
+** file or the buffers run out.
+**
+** @param file      The i-node of the file
+** @param iov       The buffers to be filled, in order
+** @param iovcnt    Number of entries in iov
+**
+** @return Number of bytes placed in the buffers, or -1 on error
+*/
+int _fl_readv( file_t *file, iovec_t *iov, int iovcnt ){
+
+    // nothing to read?
+    if ( file->bytes == 0 ){
+        return 0;
+    }
+
+    // staging buffer for the file
+    char *contents = ( char * ) _iob_get();
+    if ( contents == NULL ){
+        return E_FAILURE;
+    }
+
+    // where we are in the file and in the caller's buffers
+    blkno_t block = file->block;
+    uint32_t copied = 0;
+    int vec = 0;
+    uint32_t vec_off = 0;
+    int result = SUCCESS;
+
+    while ( copied < file->bytes && vec < iovcnt ){
+
+        // read the next piece of the file from disk
+        uint32_t len = file->bytes - copied;
+        if ( len > IOB_SIZE ){
+            len = IOB_SIZE;
+        }
+        result = _blk_load_filecontents( block, contents, blocks_for( len ) );
+        if ( result < 0 ){
+            break;
+        }
+
+        // scatter it into the caller's buffers
+        uint32_t done = 0;
+        while ( done < len && vec < iovcnt ){
+            uint32_t n = iov[vec].len - vec_off;
+            if ( n > len - done ){
+                n = len - done;
+            }
+            __memcpy( ( char * ) iov[vec].base + vec_off, contents + done, n );
+            done += n;
+            vec_off += n;
+            if ( vec_off == iov[vec].len ){
+                vec++;
+                vec_off = 0;
+            }
+        }
+
+        copied += done;
+        block += IOB_SIZE / _blk_size();
+    }
 
-    // write new contents to the disk
-    result = _blk_save_filecontents( file->block, new_contents, 
-    num_blocks );
+    // free memory
+    _iob_put( contents );
 
     // check result
     if ( result < 0 ){
         return E_FAILURE;
     }
 
-    // update file i-node
-    file->bytes += buf_size;
+    return copied;
+}
+
+/**
+** Name:  _fl_writev
+**
+** Appends the contents of several buffers to a file. Only the blocks
+** from the current end of the file onward are touched: the partly
+** filled last block (if any) is read back, the buffers are gathered
+** behind it, and the result goes out a staging buffer at a time, each
+** with one disk write.
+**
+** @param file      The i-node of the file
+** @param iov       The buffers containing stuff to write, in order
+** @param iovcnt    Number of entries in iov
+**
+** @return Number of bytes written, or -1 on error
+*/
+int _fl_writev( file_t *file, iovec_t *iov, int iovcnt ){
+
+    // how much is being added?
+    uint32_t total = 0;
+    for ( int i = 0; i < iovcnt; i++ ){
+        total += iov[i].len;
+    }
+
+    if ( total == 0 ){
+        return 0;
+    }
+
+    // files have a fixed number of blocks
+    uint32_t size = _blk_size();
+    uint64_t room = (uint64_t) file->blocks * size;
+    if ( file->bytes + (uint64_t) total > room ){
+        __cio_printf( "File %d would grow past %d bytes\n", file->id,
+            (uint32_t) room );
+        return E_FAILURE;
+    }
+
+    // staging buffer for the blocks that will change
+    char *contents = ( char * ) _iob_get();
+    if ( contents == NULL ){
+        return E_FAILURE;
+    }
+
+    // the first block that will change, and where in it we start
+    blkno_t block = file->block + file->bytes / size;
+    uint32_t offset = file->bytes % size;
+
+    // keep whatever is already in the last, partly filled block
+    int result = SUCCESS;
+    if ( offset != 0 ){
+        result = _blk_load_filecontents( block, contents, 1 );
+    }
+
+    // where we are in the caller's buffers
+    int vec = 0;
+    uint32_t vec_off = 0;
+    uint32_t left = total;
+
+    while ( result >= 0 && left > 0 ){
+
+        // gather as much as fits behind what's already staged
+        uint32_t len = IOB_SIZE - offset;
+        if ( len > left ){
+            len = left;
+        }
+        uint32_t done = 0;
+        while ( done < len ){
+            uint32_t n = iov[vec].len - vec_off;
+            if ( n > len - done ){
+                n = len - done;
+            }
+            __memcpy( contents + offset + done,
+                ( char * ) iov[vec].base + vec_off, n );
+            done += n;
+            vec_off += n;
+            if ( vec_off == iov[vec].len ){
+                vec++;
+                vec_off = 0;
+            }
+        }
+
+        // write the changed blocks to the disk
+        int num_blocks = blocks_for( offset + len );
+        result = _blk_save_filecontents( block, contents, num_blocks );
+
+        block += num_blocks;
+        left -= len;
+        offset = 0;
+    }
 
     // free memory
-    for( int i = 0; i < num_pages; i++ ){
-        _km_page_free( contents );
-	contents += PAGE_SIZE;
+    _iob_put( contents );
+
+    // check result
+    if ( result < 0 ){
+        return E_FAILURE;
     }
 
-    return SUCCESS;
-}
+    // update file i-node
+    file->bytes += total;
 
+    return total;
+}
@@ -7,7 +7,7 @@
 ** interface between the file manager and the block.
 */
 
-#ifndef FILE__H_
+#ifndef FILE_H_
 #define FILE_H_
 
 /*
@@ -17,8 +17,11 @@
 ** used in either C or assembly-language source code.
 */
 
+// data blocks given to a file created empty
 #define NUM_BLOCKS 8
 
+#include "block.h"
+
 #ifndef SP_ASM_SRC
 /*
 ** Start of C-only definitions
@@ -32,12 +35,16 @@
 */
 
 /*
-** Stores file meta-data, AKA the i-node
+** Stores file meta-data, AKA the i-node. Each file's data is one run
+** of consecutive blocks, fixed when the file is created. The layout
+** is the same for the kernel and for 64-bit host tools.
 */
 typedef struct i_node_s {
-    uint32_t id;    // unique file id
-    uint32_t bytes; // number of bytes written to the file
-    uint32_t block; // first of 8 blocks allocated to this file
+    uint32_t id;       // unique file id
+    uint32_t bytes;    // number of bytes written to the file
+    blkno_t block;     // first of the blocks allocated to this file
+    uint32_t blocks;   // number of blocks allocated to this file
+    uint32_t reserved;
 } file_t;
 
 /*
@@ -45,7 +52,7 @@ typedef struct i_node_s {
 */
 typedef struct file_block_s {
     int file_id;
-    int block_id;
+    blkno_t block_id;
 } filemap_t;
 
 /*
@@ -61,19 +68,60 @@ typedef struct file_block_s {
 **
 ** Initializes global variables and calls the block init function
 **
+** @param block_size   The block size to mount with, or 0 to pick one
+**
+** @return 0 if successful, -1 if not
+*/
+int _fl_init( uint32_t block_size );
+
+/**
+** Name:  _fl_mount
+**
+** Empties the map of file ids to i-nodes, making room in it for a
+** given number of files. The file manager then adds the files on the
+** disk with _fl_register.
+**
+** @param max_files   The most files there can be
+**
+** @return 0 if successful, -1 if not
+*/
+int _fl_mount( uint32_t max_files );
+
+/**
+** Name:  _fl_register
+**
+** Records where the i-node of a file already on the disk is
+**
+** @param id      The id of the file
+** @param inode   The block holding its i-node
+**
+** @return 0 if successful, -1 if not
 */
-void _fl_init( void );
+int _fl_register( int id, blkno_t inode );
+
+/**
+** Name:  _fl_inode
+**
+** Returns the block holding the i-node of a file
+**
+** @param id   The id of the file
+**
+** @return The block id, or BLK_NONE
+*/
+blkno_t _fl_inode( int id );
 
 /**
 ** Name:  _fl_create
 **
 ** Creates a new file, given an id to assign to it
 **
-** @param id   The id of the file
+** @param id      The id of the file
+** @param bytes   How many bytes it must be able to hold, or 0 for
+**                NUM_BLOCKS blocks' worth
 **
 ** @return 0 if successful, -1 if not
 */
-int _fl_create( int id );
+int _fl_create( int id, uint32_t bytes );
 
 /**
 ** Name:  _fl_open
@@ -82,7 +130,7 @@ int _fl_create( int id );
 **
 ** @param id   The id of the file
 **
-** @return the i-node
+** @return the i-node (which the caller must _km_free), or NULL
 */
 file_t *_fl_open( int id );
 
@@ -100,7 +148,8 @@ int _fl_delete( int id );
 /**
 ** Name:  _fl_close
 **
-** Saves a file i-node to the disk
+** Saves a file i-node to the disk. The i-node memory is still owned
+** by the caller afterwards.
 **
 ** @param file   The i-node of the file
 **
@@ -133,6 +182,32 @@ int _fl_read( file_t *file, char *buf);
 */
 int _fl_write( file_t *file, char *buf, int buf_size );
 
+/**
+** Name:  _fl_readv
+**
+** Reads contents of a file, scattering them across several buffers
+**
+** @param file      The i-node of the file
+** @param iov       The buffers to be filled, in order
+** @param iovcnt    Number of entries in iov
+**
+** @return Number of bytes placed in the buffers, or -1 on error
+*/
+int _fl_readv( file_t *file, iovec_t *iov, int iovcnt );
+
+/**
+** Name:  _fl_writev
+**
+** Appends the contents of several buffers to a file with one disk write
+**
+** @param file      The i-node of the file
+** @param iov       The buffers containing stuff to write, in order
+** @param iovcnt    Number of entries in iov
+**
+** @return Number of bytes written, or -1 on error
+*/
+int _fl_writev( file_t *file, iovec_t *iov, int iovcnt );
+
 #endif
 /* SP_ASM_SRC */
 
@@ -8,6 +8,15 @@
 ** These functions are being used by syscalls to do file system operations.
 ** The file manager essentially looks up the filename, finds the id of the 
 ** file, and then calls the corresponding function in file to do the operation.
+**
+** The names live on the disk in the file table (see fs_entry_t), which
+** is read whole when the file system is mounted; creating or deleting
+** a file writes back the one block of the table its entry is in.
+**
+** Those writes, and the block layer's, go through the metadata journal
+** (journal.h).  Each call that changes metadata ends by letting the
+** journal commit if it's due, so a call's changes are committed
+** together; _fs_sync commits right away.
 */
 
 #define	SP_KERNEL_SRC
@@ -17,6 +26,8 @@
 #include "ulib.h"
 #include "file.h"
 #include "kmem.h"
+#include "fsck.h"
+#include "journal.h"
 
 /*
 ** PRIVATE DEFINITIONS
@@ -39,6 +50,12 @@ static nameMap_t *map;
 // number of entries in the map
 static int map_count;
 
+// the file table, the number of entries it has room for, and the
+// block it starts at on the disk
+static fs_entry_t *table;
+static int table_slots;
+static blkno_t table_start;
+
 // stores i-nodes for open files which are being used
 static file_t *open_files;
 
@@ -89,6 +106,119 @@ int get_file_id( char *file_name ){
     return -1;
 }
 
+/**
+** Name:  get_open_file
+**
+** Given a file name, returns the i-node of the file if it is open
+**
+** @param file_name    The name of the file we are searching for
+** @param what         What the caller wants to do, for error messages
+**
+** @return The i-node from the open file list, or NULL
+*/
+file_t *get_open_file( char *file_name, char *what ){
+
+    // get the file id
+    int file_id = get_file_id( file_name );
+    if ( file_id < 0 ){
+        __cio_printf( "File '%s' does not exist\n", file_name );
+        return NULL; // file doesn't exist
+    }
+
+    // find the file in the open file list
+    for ( int i = 0; i < open_files_count; i++ ){
+        if ( open_files[i].id == file_id ){
+            return &open_files[i];
+	}
+    }
+
+    __cio_printf( "File '%s' is not open, cannot %s\n", file_name, what );
+    return NULL; // file isn't in the open list
+}
+
+/**
+** Name:  pages_for
+**
+** Number of pages needed to hold some number of bytes
+**
+** @param bytes   The number of bytes
+**
+** @return The number of pages
+*/
+static uint32_t pages_for( uint32_t bytes ){
+    return ( bytes + PAGE_SIZE - 1 ) / PAGE_SIZE;
+}
+
+/**
+** Name:  save_slot
+**
+** Writes the block of the file table holding one entry to the disk
+**
+** @param slot    The entry
+**
+** @return 0 if successful, -1 if not
+*/
+static int save_slot( int slot ){
+    uint32_t size = _blk_size();
+    uint32_t blk = slot * sizeof( fs_entry_t ) / size;
+
+    return _blk_save_meta( table_start + blk,
+        ( char * ) table + blk * size, 1 );
+}
+
+/**
+** Name:  mount
+**
+** Reads the file table of the mounted file system and fills in the
+** name map, and the file layer's map of i-nodes, from it
+**
+** @return 0 if successful, -1 if not
+*/
+static int mount( void ){
+    const blk_super_t *super = _blk_super();
+    uint32_t bytes = (uint32_t) super->table_blocks * _blk_size();
+
+    table_start = super->table_start;
+    table = ( fs_entry_t * ) _km_page_alloc( pages_for( bytes ) );
+    map = ( nameMap_t * ) _km_page_alloc( pages_for( bytes /
+        sizeof( fs_entry_t ) * sizeof( nameMap_t ) ) );
+    if ( table == NULL || map == NULL ){
+        return E_FAILURE;
+    }
+
+    if ( _blk_load_filecontents( table_start, ( char * ) table,
+            (int) super->table_blocks ) < 0 ){
+        return E_FAILURE;
+    }
+    if ( _fl_mount( bytes / sizeof( fs_entry_t ) ) < 0 ){
+        return E_FAILURE;
+    }
+
+    for ( uint32_t slot = 0; slot < bytes / sizeof( fs_entry_t ); slot++ ){
+        fs_entry_t *entry = &table[slot];
+        if ( entry->name[0] == '\0' ){
+            continue;
+        }
+        entry->name[FS_NAME_LEN - 1] = '\0';
+
+        strcpy( map[map_count].name, entry->name );
+        map[map_count].id = entry->id;
+        map[map_count].slot = slot;
+        map_count++;
+        _fl_register( entry->id, entry->inode );
+
+        // new files get ids no file has
+        if ( entry->id >= file_id_assigner ){
+            file_id_assigner = entry->id + 1;
+        }
+    }
+
+    // only now can files be created
+    table_slots = bytes / sizeof( fs_entry_t );
+
+    return SUCCESS;
+}
+
 /*
 ** PUBLIC FUNCTIONS
 */
@@ -97,8 +227,9 @@ int get_file_id( char *file_name ){
 /**
 ** Name:    _fs_init
 **
-** Initializes the file system. This involves initializing globals and
-** then calling _fl_init.
+** Initializes the file system. This involves initializing globals,
+** calling _fl_init, and then reading the file table. Disks without a
+** file system are formatted first.
 */
 void _fs_init(){
 
@@ -107,18 +238,70 @@ void _fs_init(){
     // start at 0
     file_id_assigner = 0;
 
-    // allocate map of names to file ids
-    map = ( nameMap_t * ) _km_page_alloc( 2 );
+    // the map of names to file ids is allocated when the size of the
+    // file table is known
     map_count = 0;
+    table_slots = 0;
 
     // allocate list of open file i-nodes
     open_files = (file_t *)  _km_page_alloc( 2 );
     open_files_count = 0;
 
     // call the file init
-    _fl_init();
+    if ( _fl_init( FS_BLOCK_SIZE ) < 0 ){
+        __cio_printf(" Fail");
+        return;
+    }
 
-   __cio_printf(" done");
+    if ( _blk_super() == NULL ){
+        __cio_printf(" formatting,");
+        if ( _fs_format( FS_BLOCK_SIZE, FS_MAX_FILES ) < 0 ){
+            __cio_printf(" Fail");
+            return;
+        }
+    }
+
+#ifdef FSCK_AT_MOUNT
+    // check the file system before trusting it; after a repair the
+    // block layer has to load the bitmap again
+    fsck_t check;
+    int problems = _fsck_check( &check, true );
+    _fsck_report( &check );
+    __cio_printf(",");
+    if ( problems > 0 && _fl_init( FS_BLOCK_SIZE ) < 0 ){
+        __cio_printf(" Fail");
+        return;
+    }
+#endif
+
+    if ( mount() < 0 ){
+        __cio_printf(" Fail");
+        return;
+    }
+
+   __cio_printf(" done (%d byte blocks, %d files)", _blk_size(), map_count);
+}
+
+/**
+** Name:    _fs_format
+**
+** Writes an empty file system onto the disks. _fs_init must be called
+** afterward to mount it.
+**
+** @param block_size  The block size, or 0 to pick one
+** @param max_files   The number of files it will have room for
+**
+** @return 0 if successful, -1 if not
+*/
+int _fs_format( uint32_t block_size, uint32_t max_files ){
+
+    // the name map has to fit in memory too
+    if ( max_files == 0 || max_files > ( 1u << 20 ) ){
+        __cio_printf( "Can't make room for %d files\n", max_files );
+        return E_FAILURE;
+    }
+
+    return _blk_format( block_size, max_files * sizeof( fs_entry_t ) );
 }
 
 /**
@@ -131,9 +314,24 @@ void _fs_init(){
 ** @return 0 if successful, -1 if not
 */
 int _fs_create( char *filename ){
+    return _fs_create_sized( filename, 0 );
+}
+
+/**
+** Name:    _fs_create_sized
+**
+** Creates a new file in the file system with the given name, and
+** room for a given number of bytes in one run of blocks
+**
+** @param filename  The name of the file
+** @param bytes     The room it needs, or 0 for the default
+**
+** @return 0 if successful, -1 if not
+*/
+int _fs_create_sized( char *filename, uint32_t bytes ){
 
     // check if name is correct length
-    if ( strlen( filename ) >= 16 ){
+    if ( strlen( filename ) >= FS_NAME_LEN ){
         __cio_printf( "File name '%s' is too long\n", filename );
         return E_FAILURE;
     }
@@ -146,22 +344,42 @@ int _fs_create( char *filename ){
 	}
     }
 
+    // find it a slot in the file table
+    int slot = 0;
+    while ( slot < table_slots && table[slot].name[0] != '\0' ){
+        slot++;
+    }
+    if ( slot >= table_slots ){
+        __cio_printf( "No room for file '%s'\n", filename );
+        return E_FAILURE;
+    }
+
     // make file in storage first
-    int file_id = _fl_create( file_id_assigner );
-    if ( file_id < 0 ){
+    int file_id = file_id_assigner;
+    if ( _fl_create( file_id, bytes ) < 0 ){
+        return E_FAILURE;
+    }
+
+    // then record it in the file table
+    fs_entry_t *entry = &table[slot];
+    __memclr( entry, sizeof( fs_entry_t ) );
+    strcpy( entry->name, filename );
+    entry->id = file_id;
+    entry->inode = _fl_inode( file_id );
+    if ( save_slot( slot ) < 0 ){
+        __memclr( entry, sizeof( fs_entry_t ) );
+        _fl_delete( file_id );
         return E_FAILURE;
     }
     file_id_assigner++;
 
     // add file to filename list
-    nameMap_t *new_map = ( nameMap_t *) _km_slice_alloc( );
-    new_map->id = file_id;
-    strcpy( new_map->name, filename );
-    map[map_count] = *new_map;
+    map[map_count].id = file_id;
+    map[map_count].slot = slot;
+    strcpy( map[map_count].name, filename );
     map_count++;
-    _km_slice_free( new_map );
 
-    return SUCCESS;
+    return _jnl_poll();
 }
 
 /**
@@ -197,17 +415,24 @@ int _fs_delete( char *filename ){
         return E_FAILURE; // unable to delete file
     }
 
+    // and from the file table
+    int slot = map[index].slot;
+    __memclr( &table[slot], sizeof( fs_entry_t ) );
+    result = save_slot( slot );
+
     // delete file from the map
     for ( int i = index; i < map_count; i++ ){
         if ( i + 1 < map_count ){
-             nameMap_t temp = map[i+1];
-	     map[i].id = temp.id;
-	     strcpy( map[i].name, temp.name );
+             map[i] = map[i+1];
 	}
     }
     map_count--;
 
-    return SUCCESS;
+    if ( _jnl_poll() < 0 ){
+        result = E_FAILURE;
+    }
+
+    return result < 0 ? E_FAILURE : SUCCESS;
 }
 
 /**
@@ -253,6 +478,7 @@ int _fs_open( char *filename ){
     // Add it to the open files list
     open_files[open_files_count] = *file;
     open_files_count++;
+    _km_free( file, sizeof( file_t ) );
 
     return SUCCESS;
 }
@@ -289,6 +515,7 @@ int _fs_close( char *filename ){
     for ( int i = 0; i < open_files_count; i++ ){
         if ( open_files[i].id == id ){
             file = &open_files[i];
+	    index = i;
 	}
     }
 
@@ -311,7 +538,7 @@ int _fs_close( char *filename ){
     }
     open_files_count--;
 
-    return SUCCESS;
+    return _jnl_poll();
 }
 
 /**
@@ -397,3 +624,88 @@ int _fs_write( char *filename, char *buf, int buf_size ){
 
 }
 
+/**
+** Name:    _fs_readv
+**
+** Reads a file in the file system, scattering its contents across
+** several buffers
+**
+** @param filename  The name of the file
+** @param iov       The buffers to be filled, in order
+** @param iovcnt    Number of entries in iov
+**
+** @return the number of bytes read from the file, or -1
+*/
+int _fs_readv( char *filename, iovec_t *iov, int iovcnt ){
+
+    if ( iovcnt < 0 || iovcnt > N_IOVECS ){
+        return E_FAILURE;
+    }
+
+    file_t *file = get_open_file( filename, "read" );
+    if ( file == NULL ){
+        return E_FAILURE;
+    }
+
+    return _fl_readv( file, iov, iovcnt );
+}
+
+/**
+** Name:    _fs_writev
+**
+** Appends the contents of several buffers to a file in the file system
+**
+** @param filename  The name of the file
+** @param iov       The buffers containing what's to be written, in order
+** @param iovcnt    Number of entries in iov
+**
+** @return the number of bytes written to the file, or -1
+*/
+int _fs_writev( char *filename, iovec_t *iov, int iovcnt ){
+
+    if ( iovcnt < 0 || iovcnt > N_IOVECS ){
+        return E_FAILURE;
+    }
+
+    file_t *file = get_open_file( filename, "write" );
+    if ( file == NULL ){
+        return E_FAILURE;
+    }
+
+    return _fl_writev( file, iov, iovcnt );
+}
+
+/**
+** Name:    _fs_sync
+**
+** Writes the i-node of an open file back to the disk without closing
+** it, and commits everything the journal is holding
+**
+** @param filename  The name of the file
+**
+** @return 0 if successful, -1 if not
+*/
+int _fs_sync( char *filename ){
+
+    file_t *file = get_open_file( filename, "sync" );
+    if ( file == NULL ){
+        return E_FAILURE;
+    }
+
+    if ( _fl_close( file ) < 0 ){
+        return E_FAILURE;
+    }
+    return _jnl_commit();
+}
+
+/**
+** Name:    _fs_stats
+**
+** Fills in the file counts in a kstats_t
+**
+** @param ks   The statistics to fill in
+*/
+void _fs_stats( kstats_t *ks ){
+    ks->files = map_count;
+    ks->open_files = open_files_count;
+}
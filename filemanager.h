@@ -9,6 +9,8 @@
 #ifndef FILEMANAGER_H_
 #define FILEMANAGER_H_
 
+#include "kstats.h"
+
 /*
 ** General (C and/or assembly) definitions
 **
@@ -16,6 +18,22 @@
 ** used in either C or assembly-language source code.
 */
 
+// block size to mount the file system with; 0 lets the block layer
+// pick the smallest size that suits every disk.  Override at build
+// time with e.g. -DFS_BLOCK_SIZE=4096
+#ifndef FS_BLOCK_SIZE
+#define FS_BLOCK_SIZE 0
+#endif
+
+// number of files a file system formatted at boot has room for.
+// Override at build time with e.g. -DFS_MAX_FILES=4096
+#ifndef FS_MAX_FILES
+#define FS_MAX_FILES 1024
+#endif
+
+// longest file name, counting the NUL
+#define FS_NAME_LEN 16
+
 #ifndef SP_ASM_SRC
 
 /*
@@ -34,10 +52,24 @@
 ** corresponding file ids
 */
 typedef struct str_to_int_s {
-    char name[16];
+    char name[FS_NAME_LEN];
     int id;
+    int slot;          // the file's entry in the file table
 } nameMap_t;
 
+/*
+** An entry in the file table on the disk. The table is an array of
+** these filling the blocks the superblock gives it; a slot whose
+** name is empty is free. The layout is the same for the kernel and
+** for 64-bit host tools.
+*/
+typedef struct fs_entry_s {
+    char name[FS_NAME_LEN];
+    uint32_t id;       // the file's id
+    uint32_t reserved;
+    uint64_t inode;    // block holding the file's i-node
+} fs_entry_t;
+
 /*
 ** Globals
 */
@@ -50,10 +82,38 @@ typedef struct str_to_int_s {
 ** Name:    _fs_init
 **
 ** Initializes the file system by initializing globals. Also calls
-** _fl_init.
+** _fl_init, which mounts the file system on the disks. If they don't
+** hold one, they are formatted with FS_BLOCK_SIZE blocks and room
+** for FS_MAX_FILES files.
 */
 void _fs_init( void );
 
+/**
+** Name:    _fs_format
+**
+** Writes an empty file system onto the disks. _fs_init must be called
+** afterward to mount it.
+**
+** @param block_size  The block size, or 0 to pick one
+** @param max_files   The number of files it will have room for
+**
+** @return 0 if successful, -1 if not
+*/
+int _fs_format( uint32_t block_size, uint32_t max_files );
+
+/**
+** Name:    _fs_create_sized
+**
+** Creates a new file in the file system with the given name, and
+** room for a given number of bytes in one run of blocks.
+**
+** @param filename  The name of the file
+** @param bytes     The room it needs, or 0 for the default
+**
+** @return 0 if successful, -1 if not
+*/
+int _fs_create_sized( char *filename, uint32_t bytes );
+
 /**
 ** Name:    _fs_create
 **
@@ -125,6 +185,56 @@ int _fs_read( char *filename, char *buf );
 */
 int _fs_write( char *filename, char *buf, int buf_size );
 
+/**
+** Name:    _fs_readv
+**
+** Reads a file in the file system with the given name, scattering its
+** contents across several buffers.
+**
+** @param filename  The name of the file
+** @param iov       The buffers to be filled, in order
+** @param iovcnt    Number of entries in iov (at most N_IOVECS)
+**
+** @return the number of bytes read from the file, or -1
+*/
+int _fs_readv( char *filename, iovec_t *iov, int iovcnt );
+
+/**
+** Name:    _fs_writev
+**
+** Appends the contents of several buffers to a file in the file system
+** with the given name.
+**
+** @param filename  The name of the file
+** @param iov       The buffers containing what's to be written, in order
+** @param iovcnt    Number of entries in iov (at most N_IOVECS)
+**
+** @return the number of bytes written to the file, or -1
+*/
+int _fs_writev( char *filename, iovec_t *iov, int iovcnt );
+
+/**
+** Name:    _fs_sync
+**
+** Writes the i-node of an open file back to the disk; the file
+** stays open. The journal's running transaction is committed, so
+** every change made so far survives a crash.
+**
+** @param filename  The name of the file
+**
+** @return 0 if successful, -1 if not
+*/
+int _fs_sync( char *filename );
+
+/**
+** Name:    _fs_stats
+**
+** Fills in the file counts in a kstats_t
+**
+** @param ks   The statistics to fill in
+*/
+void _fs_stats( kstats_t *ks );
+
 #endif
 /* SP_ASM_SRC */
 
@@ -0,0 +1,535 @@
+/**
+** @file fsck.c
+**
+** @author CSCI-452 class of 20205
+**
+** File system consistency checker implementation
+**
+** The check is three passes over the metadata, each reading the disk
+** in increasing block order:
+**
+**    1. the file table, with one read; each entry's name and id are
+**       checked for uniqueness with hash sets
+**    2. the i-nodes, sorted by block, with one read per run of nearby
+**       i-nodes; each extent is checked against, and then added to, a
+**       bitmap of the blocks found in use
+**    3. the allocation bitmap, a staging buffer at a time, compared a
+**       word at a time with the bitmap built in pass 2
+**
+** An entry which fails a check in pass 1 or 2 is dropped:  its blocks
+** are not counted as in use, so they show up in pass 3 as leaked.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "fsck.h"
+#include "filemanager.h"
+#include "file.h"
+#include "block.h"
+#include "journal.h"
+#include "iobuf.h"
+#include "kmem.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+/*
+** PRIVATE DATA TYPES
+*/
+
+// a file table entry, by the block holding its i-node
+typedef struct fsck_ref_s {
+    blkno_t inode;
+    uint32_t slot;
+} fsck_ref_t;
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// the file system being checked
+static const blk_super_t *_sb;
+static uint32_t _shift;         // log2 of the block size
+static blkno_t _meta;           // blocks the file system itself uses
+
+// the file table, how many entries it has, and whether it's changed
+static fs_entry_t *_table;
+static uint32_t _slots;
+static bool_t _table_changed;
+
+// the entries which pass the first pass, and how many there are
+static fsck_ref_t *_refs;
+static uint32_t _nrefs;
+
+// hash sets of the names and ids seen so far; each element is a slot
+// number plus one, or 0 if it's empty
+static uint32_t *_names;
+static uint32_t *_ids;
+static uint32_t _hash_mask;
+
+// one bit per block, set for the blocks found in use
+static uint8_t *_claimed;
+
+// what has been found, and whether to fix it
+static fsck_t *_res;
+static bool_t _repair;
+
+/*
+** PUBLIC GLOBAL VARIABLES
+*/
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/**
+** Name:  _fsck_alloc
+**
+** Allocates zeroed memory, in pages
+**
+** @param bytes  How much
+**
+** @return the memory, or NULL
+*/
+static void *_fsck_alloc( uint32_t bytes ) {
+    void *mem = _km_page_alloc( ( bytes + PAGE_SIZE - 1 ) / PAGE_SIZE );
+
+    if( mem != NULL ) {
+        __memclr( mem, bytes );
+    }
+
+    return( mem );
+}
+
+/**
+** Name:  _fsck_free
+**
+** Releases memory from _fsck_alloc
+**
+** @param mem  The memory, or NULL
+*/
+static void _fsck_free( void *mem ) {
+    if( mem != NULL ) {
+        _km_page_free( mem );
+    }
+}
+
+/**
+** Name:  _fsck_in_use
+**
+** Is any of a run of blocks already in use?
+**
+** @param id   The first block
+** @param num  The number of blocks
+**
+** @return true if so
+*/
+static bool_t _fsck_in_use( blkno_t id, blkno_t num ) {
+
+    for( ; num > 0; ++id, --num ) {
+        if( _claimed[(uint32_t) ( id >> 3 )] & ( 1 << ( id & 7 ) ) ) {
+            return( true );
+        }
+    }
+
+    return( false );
+}
+
+/**
+** Name:  _fsck_claim
+**
+** Records a run of blocks as in use
+**
+** @param id   The first block
+** @param num  The number of blocks
+*/
+static void _fsck_claim( blkno_t id, blkno_t num ) {
+
+    _res->used += num;
+    for( ; num > 0; ++id, --num ) {
+        _claimed[(uint32_t) ( id >> 3 )] |= 1 << ( id & 7 );
+    }
+}
+
+/**
+** Name:  _fsck_drop
+**
+** Reports a bad file table entry, and removes it if repairing
+**
+** @param slot  The entry
+** @param why   What's wrong with it
+*/
+static void _fsck_drop( uint32_t slot, char *why ) {
+    fs_entry_t *entry = &_table[slot];
+
+    ++_res->bad_files;
+    if( _res->bad_files <= FSCK_SHOW ) {
+        entry->name[FS_NAME_LEN - 1] = '\0';
+        __cio_printf( "fsck: file '%s' (entry %d): %s\n", entry->name, slot,
+                      why );
+    }
+
+    if( _repair ) {
+        __memclr( entry, sizeof( fs_entry_t ) );
+        _table_changed = true;
+    }
+}
+
+/**
+** Name:  _fsck_seen
+**
+** Adds an entry to a hash set, unless one matching it is there already
+**
+** @param set      The set (_names or _ids)
+** @param hash     The entry's hash
+** @param slot     The entry
+**
+** @return true if a matching entry was already there
+*/
+static bool_t _fsck_seen( uint32_t *set, uint32_t hash, uint32_t slot ) {
+    fs_entry_t *entry = &_table[slot];
+    uint32_t i = hash & _hash_mask;
+
+    while( set[i] != 0 ) {
+        fs_entry_t *other = &_table[set[i] - 1];
+
+        if( set == _names ? __strcmp( other->name, entry->name ) == 0 :
+                            other->id == entry->id ) {
+            return( true );
+        }
+        i = ( i + 1 ) & _hash_mask;
+    }
+
+    set[i] = slot + 1;
+    return( false );
+}
+
+/**
+** Name:  _fsck_hash
+**
+** FNV-1a hash of a file name
+**
+** @param str  The name
+**
+** @return the hash
+*/
+static uint32_t _fsck_hash( const char *str ) {
+    uint32_t hash = 2166136261u;
+
+    while( *str ) {
+        hash = ( hash ^ (uint8_t) *str++ ) * 16777619u;
+    }
+
+    return( hash );
+}
+
+/**
+** Name:  _fsck_table
+**
+** Pass 1:  checks each file table entry by itself, and collects the
+** ones which pass
+*/
+static void _fsck_table( void ) {
+
+    for( uint32_t slot = 0; slot < _slots; ++slot ) {
+        fs_entry_t *entry = &_table[slot];
+        uint32_t len = 0;
+
+        if( entry->name[0] == '\0' ) {
+            continue;
+        }
+        ++_res->files;
+
+        while( len < FS_NAME_LEN && entry->name[len] != '\0' ) {
+            ++len;
+        }
+
+        if( len == FS_NAME_LEN ) {
+            _fsck_drop( slot, "name isn't terminated" );
+        } else if( entry->inode < _meta || entry->inode >= _sb->block_count ) {
+            _fsck_drop( slot, "i-node is outside the data blocks" );
+        } else if( _fsck_seen( _names, _fsck_hash( entry->name ), slot ) ) {
+            _fsck_drop( slot, "another file has this name" );
+        } else if( _fsck_seen( _ids, entry->id * 2654435761u, slot ) ) {
+            _fsck_drop( slot, "another file has this id" );
+        } else {
+            _refs[_nrefs].inode = entry->inode;
+            _refs[_nrefs].slot = slot;
+            ++_nrefs;
+        }
+    }
+}
+
+/**
+** Name:  _fsck_sort
+**
+** Sorts the entries collected by pass 1 by i-node block (Shell sort;
+** they usually are in order already)
+*/
+static void _fsck_sort( void ) {
+    uint32_t gap = 1;
+
+    while( gap < _nrefs / 3 ) {
+        gap = gap * 3 + 1;
+    }
+
+    for( ; gap > 0; gap /= 3 ) {
+        for( uint32_t i = gap; i < _nrefs; ++i ) {
+            fsck_ref_t ref = _refs[i];
+            uint32_t j = i;
+
+            while( j >= gap && _refs[j - gap].inode > ref.inode ) {
+                _refs[j] = _refs[j - gap];
+                j -= gap;
+            }
+            _refs[j] = ref;
+        }
+    }
+}
+
+/**
+** Name:  _fsck_inode
+**
+** Checks one i-node against its file table entry and the blocks found
+** in use so far, and claims its blocks if it passes
+**
+** @param ref   The entry
+** @param file  Its i-node
+*/
+static void _fsck_inode( fsck_ref_t *ref, file_t *file ) {
+    fs_entry_t *entry = &_table[ref->slot];
+    blkno_t count = _sb->block_count;
+
+    if( file->id != entry->id ) {
+        _fsck_drop( ref->slot, "i-node belongs to another file" );
+    } else if( file->blocks == 0 || file->block < _meta ||
+               file->block >= count || file->blocks > count - file->block ) {
+        _fsck_drop( ref->slot, "blocks are outside the data blocks" );
+    } else if( file->bytes > ( (uint64_t) file->blocks << _shift ) ) {
+        _fsck_drop( ref->slot, "size is bigger than its blocks" );
+    } else if( _fsck_in_use( ref->inode, 1 ) ||
+               _fsck_in_use( file->block, file->blocks ) ) {
+        ++_res->shared;
+        _fsck_drop( ref->slot, "blocks belong to another file" );
+    } else {
+        _fsck_claim( ref->inode, 1 );
+        _fsck_claim( file->block, file->blocks );
+    }
+}
+
+/**
+** Name:  _fsck_inodes
+**
+** Pass 2:  reads the i-nodes in block order, each run of them that
+** fits in a staging buffer with one read, and checks them
+**
+** @param buf  A staging buffer
+**
+** @return 0 if successful, -1 if the disk couldn't be read
+*/
+static int _fsck_inodes( char *buf ) {
+    uint32_t max = IOB_SIZE >> _shift;
+    uint32_t i = 0;
+
+    while( i < _nrefs ) {
+        blkno_t start = _refs[i].inode;
+        uint32_t j = i;
+
+        while( j < _nrefs && _refs[j].inode - start < max ) {
+            ++j;
+        }
+        if( _blk_load_filecontents( start, buf,
+                (int) ( _refs[j - 1].inode - start ) + 1 ) < 0 ) {
+            return( E_FAILURE );
+        }
+
+        for( ; i < j; ++i ) {
+            file_t file;
+            uint32_t off = (uint32_t) ( _refs[i].inode - start ) << _shift;
+
+            __memcpy( &file, buf + off, sizeof( file_t ) );
+            _fsck_inode( &_refs[i], &file );
+        }
+    }
+
+    return( SUCCESS );
+}
+
+/**
+** Name:  _fsck_bitmap
+**
+** Pass 3:  compares the on-disk bitmap with the blocks found in use
+**
+** @param buf  A staging buffer
+**
+** @return 0 if successful, -1 if the disk couldn't be read
+*/
+static int _fsck_bitmap( char *buf ) {
+    blkno_t count = _sb->block_count;
+    blkno_t k = 0;
+
+    while( k < _sb->bitmap_blocks ) {
+        uint32_t n = IOB_SIZE >> _shift;
+        if( _sb->bitmap_blocks - k < n ) {
+            n = (uint32_t) ( _sb->bitmap_blocks - k );
+        }
+        if( _blk_load_filecontents( _sb->bitmap_start + k, buf, n ) < 0 ) {
+            return( E_FAILURE );
+        }
+
+        uint32_t off = (uint32_t) k << _shift;
+        uint32_t *disk = (uint32_t *) buf;
+        uint32_t *want = (uint32_t *) ( _claimed + off );
+
+        for( uint32_t w = 0; w < ( n << _shift ) / 4; ++w ) {
+            if( disk[w] == want[w] ) {
+                continue;
+            }
+
+            for( uint32_t b = 0; b < 32; ++b ) {
+                blkno_t id = ( (blkno_t) ( off + w * 4 ) << 3 ) + b;
+                uint32_t bit = 1u << b;
+
+                if( id >= count ) {
+                    break;
+                }
+                if( ( ( disk[w] ^ want[w] ) & bit ) == 0 ) {
+                    continue;
+                }
+
+                if( disk[w] & bit ) {
+                    ++_res->leaked;
+                } else {
+                    ++_res->unmarked;
+                }
+                if( _res->leaked + _res->unmarked <= FSCK_SHOW ) {
+                    __cio_printf( "fsck: block %d is %s\n", (uint32_t) id,
+                        ( disk[w] & bit ) ? "marked in use but unused" :
+                                            "in use but marked free" );
+                }
+            }
+        }
+
+        k += n;
+    }
+
+    return( SUCCESS );
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** Name:  _fsck_check
+**
+** Checks the mounted file system
+**
+** @param res     Where to put what was found
+** @param repair  true to fix what can be fixed
+**
+** @return the number of problems found (bad files plus wrongly marked
+**         blocks, up to 2^31-1), or -1 if the check couldn't be done
+*/
+int32_t _fsck_check( fsck_t *res, bool_t repair ) {
+    int32_t result = E_FAILURE;
+    char *buf;
+
+    __memclr( res, sizeof( fsck_t ) );
+    _res = res;
+    _repair = repair;
+    _table_changed = false;
+    _nrefs = 0;
+
+    // the check reads, and repairs write, the blocks' homes
+    _sb = _blk_super();
+    if( _sb == NULL || _jnl_checkpoint() < 0 ) {
+        return( E_FAILURE );
+    }
+
+    _shift = 0;
+    while( ( 1u << _shift ) < _sb->block_size ) {
+        ++_shift;
+    }
+    _meta = _blk_reserved();
+    _slots = ( (uint32_t) _sb->table_blocks << _shift ) / sizeof( fs_entry_t );
+
+    uint32_t hash_size = 1;
+    while( hash_size < 2 * _slots ) {
+        hash_size <<= 1;
+    }
+    _hash_mask = hash_size - 1;
+
+    _table = _fsck_alloc( (uint32_t) _sb->table_blocks << _shift );
+    _refs = _fsck_alloc( _slots * sizeof( fsck_ref_t ) );
+    _names = _fsck_alloc( hash_size * sizeof( uint32_t ) );
+    _ids = _fsck_alloc( hash_size * sizeof( uint32_t ) );
+    _claimed = _fsck_alloc( (uint32_t) _sb->bitmap_blocks << _shift );
+    buf = _iob_get();
+
+    if( _table == NULL || _refs == NULL || _names == NULL || _ids == NULL ||
+        _claimed == NULL || buf == NULL ) {
+        __cio_puts( "fsck: not enough memory\n" );
+
+    } else if( _blk_load_filecontents( _sb->table_start, (char *) _table,
+                   (int) _sb->table_blocks ) == SUCCESS ) {
+
+        _fsck_claim( 0, _meta );
+        _fsck_table();
+        _fsck_sort();
+
+        if( _fsck_inodes( buf ) == SUCCESS && _fsck_bitmap( buf ) == SUCCESS ) {
+            uint64_t problems = res->bad_files + res->leaked + res->unmarked;
+            result = problems > 0x7fffffff ? 0x7fffffff : (int32_t) problems;
+        }
+
+        // bad entries go first, so the bitmap never frees blocks a
+        // file on the disk still names
+        if( result > 0 && repair ) {
+            int ok = SUCCESS;
+            if( _table_changed ) {
+                ok = _blk_save_filecontents( _sb->table_start,
+                    (char *) _table, (int) _sb->table_blocks );
+            }
+            if( ok == SUCCESS && ( res->leaked || res->unmarked ) ) {
+                ok = _blk_save_filecontents( _sb->bitmap_start,
+                    (char *) _claimed, (int) _sb->bitmap_blocks );
+            }
+            res->repaired = ok == SUCCESS;
+        }
+    }
+
+    if( buf != NULL ) {
+        _iob_put( buf );
+    }
+    _fsck_free( _claimed );
+    _fsck_free( _ids );
+    _fsck_free( _names );
+    _fsck_free( _refs );
+    _fsck_free( _table );
+
+    return( result );
+}
+
+/**
+** Name:  _fsck_report
+**
+** Prints a one-line summary of a check on the console
+**
+** @param res   What the check found
+*/
+void _fsck_report( fsck_t *res ) {
+
+    __cio_printf( " fsck: %d files, %d blocks in use", res->files,
+                  (uint32_t) res->used );
+
+    if( res->bad_files || res->leaked || res->unmarked ) {
+        __cio_printf( ", %d bad files, %d blocks leaked, %d unmarked%s",
+                      res->bad_files, (uint32_t) res->leaked,
+                      (uint32_t) res->unmarked,
+                      res->repaired ? " (repaired)" : "" );
+    }
+}
@@ -0,0 +1,98 @@
+/*
+** @file fsck.h
+**
+** @author CSCI-452 class of 20205
+**
+** File system consistency checker declarations
+**
+** The checker compares the file system's metadata on the disk against
+** itself:  every file table entry must name an i-node that belongs to
+** it, every i-node's extent must lie on the disk outside the file
+** system's own blocks and overlap no other file's, and the allocation
+** bitmap must mark exactly the blocks those use.  It reads the file
+** table in one go, the i-nodes in increasing block order (nearby ones
+** with a single read), and the bitmap a staging buffer at a time, and
+** it keeps its own bitmap of the blocks it has found in use rather
+** than looking anything up per block.
+**
+** It runs on the mounted block layer (after _blk_init) and doesn't use
+** the file manager's tables, so it can run before they are read:  at
+** boot if FSCK_AT_MOUNT is defined, or over an image file with the
+** hosted/fsck program.  The journal is checkpointed first, so what it
+** reads is current.  Repairs drop bad file table entries and then
+** rewrite the bitmap to match what is in use; the block layer must be
+** remounted afterward.
+*/
+
+#ifndef FSCK_H_
+#define FSCK_H_
+
+#include "common.h"
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+// problems of each kind that are described; the rest are only counted
+#define FSCK_SHOW   8
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+/*
+** Types
+*/
+
+// what a check found
+typedef struct fsck_s {
+    uint32_t files;         // entries in the file table
+    uint32_t bad_files;     // entries with a bad name, i-node or extent
+    uint32_t shared;        // of those, ones using another file's blocks
+    uint64_t used;          // blocks in use, counting the file system's own
+    uint64_t leaked;        // blocks marked in use which nothing uses
+    uint64_t unmarked;      // blocks in use which are marked free
+    bool_t repaired;        // whether the disk was fixed
+} fsck_t;
+
+#ifdef SP_KERNEL_SRC
+
+/*
+** Globals
+*/
+
+/*
+** Prototypes
+*/
+
+/**
+** Name:  _fsck_check
+**
+** Checks the mounted file system
+**
+** @param res     Where to put what was found
+** @param repair  true to fix what can be fixed
+**
+** @return the number of problems found (bad files plus wrongly marked
+**         blocks, up to 2^31-1), or -1 if the check couldn't be done
+*/
+int32_t _fsck_check( fsck_t *res, bool_t repair );
+
+/**
+** Name:  _fsck_report
+**
+** Prints a one-line summary of a check on the console
+**
+** @param res   What the check found
+*/
+void _fsck_report( fsck_t *res );
+
+#endif
+/* SP_KERNEL_SRC */
+
+#endif
+/* SP_ASM_SRC */
+
+#endif
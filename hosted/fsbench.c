@@ -0,0 +1,128 @@
+/**
+** @file fsbench.c
+**
+** @author CSCI-452 class of 20205
+**
+** Hosted file system benchmark
+**
+** Builds the userland fsbench process (userland/fsbench.c) as a Linux
+** program, with each system call it uses going straight to the file
+** system or its shim equivalent, and runs it over a disk image file:
+**
+**    fsbench [-D] [-s size] image [n]
+**
+**    -D       open the image with O_DIRECT
+**    -s size  make the image 'size' bytes (k, m and g suffixes work)
+**    n        the most files to create (see userland/fsbench.c)
+**
+** The results are written to the standard output in the same form as
+** the userland version writes them to the SIO.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "filemanager.h"
+#include "block.h"
+#include "journal.h"
+#include "lathist.h"
+#include "clock.h"
+
+#include "hosted/hostio.h"
+
+/*
+** The system calls the benchmark makes
+*/
+
+static int32_t _h_fcreate( char *name )  { return( _fs_create( name ) ); }
+static int32_t _h_fdelete( char *name )  { return( _fs_delete( name ) ); }
+static int32_t _h_fopen( char *name )    { return( _fs_open( name ) ); }
+static int32_t _h_fclose( char *name )   { return( _fs_close( name ) ); }
+
+static int32_t _h_fread( char *name, char *buf ) {
+    return( _fs_read( name, buf ) );
+}
+
+static int32_t _h_fwrite( char *name, char *buf, int length ) {
+    return( _fs_write( name, buf, length ) );
+}
+
+static int32_t _h_nanotime( uint64_t *ns ) {
+    *ns = _clk_ns();
+    return( E_SUCCESS );
+}
+
+static int32_t _h_writes( const char *str ) {
+    __cio_puts( (char *) str );
+    return( __strlen( str ) );
+}
+
+// nothing else is using the "SIO", so there's no need to wait for it
+static void _h_sleep( uint32_t msec ) {
+    (void) msec;
+}
+
+// the image is left with nothing in its journal
+static void _h_exit( int32_t status ) {
+    _jnl_checkpoint();
+    hio_exit( status );
+}
+
+#define fcreate     _h_fcreate
+#define fdelete     _h_fdelete
+#define fopen       _h_fopen
+#define fclose      _h_fclose
+#define fread       _h_fread
+#define fwrite      _h_fwrite
+#define nanotime    _h_nanotime
+#define swrites     _h_writes
+#define cwrites     _h_writes
+#define sleep       _h_sleep
+#define sprint      __sprint
+#define exit        _h_exit
+
+#include "userland/fsbench.c"
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+int main( int ac, char **av ) {
+    unsigned long long size = 0, files = 0;
+    int direct = 0;
+    int i;
+
+    for( i = 1; i < ac && av[i][0] == '-'; ++i ) {
+        if( __strcmp( av[i], "-D" ) == 0 ) {
+            direct = 1;
+        } else if( __strcmp( av[i], "-s" ) == 0 && i + 1 < ac &&
+                   hio_strtoull( av[i+1], &size ) == 0 ) {
+            ++i;
+        } else {
+            break;
+        }
+    }
+    if( i >= ac || ac - i > 2 ||
+        ( ac - i == 2 && hio_strtoull( av[i+1], &files ) < 0 ) ) {
+        __cio_puts( "usage: fsbench [-D] [-s size] image [n]\n" );
+        hio_exit( 1 );
+    }
+
+    if( hio_open( av[i], size, direct ) < 0 ) {
+        hio_exit( 1 );
+    }
+
+    __cio_puts( "Init:" );
+    _lat_init();
+    _fs_init();
+    __cio_puts( "\n" );
+    if( _blk_super() == NULL ) {
+        hio_exit( 1 );
+    }
+
+    fsbench( 0, files );
+
+    _h_exit( 0 );
+    return( 0 );
+}
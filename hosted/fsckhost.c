@@ -0,0 +1,104 @@
+/**
+** @file fsckhost.c
+**
+** @author CSCI-452 class of 20205
+**
+** Hosted file system checker
+**
+** Runs the kernel's consistency checker (fsck.c) over a disk image
+** file:
+**
+**    fsck [-D] [-r] image
+**
+**    -D       open the image with O_DIRECT
+**    -r       repair what can be repaired
+**
+** The exit status is 0 if the file system is clean, 1 if problems
+** were found and repaired, and 4 if problems remain (or the image
+** has no file system).
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "filemanager.h"
+#include "block.h"
+#include "lathist.h"
+#include "clock.h"
+#include "fsck.h"
+
+#include "hosted/hostio.h"
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/**
+** Name:  usage
+**
+** Describes the command line, and quits
+*/
+static void usage( void ) {
+    __cio_puts( "usage: fsck [-D] [-r] image\n" );
+    hio_exit( 4 );
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+int main( int ac, char **av ) {
+    int direct = 0, repair = 0;
+    uint64_t start;
+    fsck_t res;
+    int32_t problems;
+    int i;
+
+    for( i = 1; i < ac && av[i][0] == '-'; ++i ) {
+        if( __strcmp( av[i], "-D" ) == 0 ) {
+            direct = 1;
+        } else if( __strcmp( av[i], "-r" ) == 0 ) {
+            repair = 1;
+        } else {
+            usage();
+        }
+    }
+    if( ac - i != 1 ) {
+        usage();
+    }
+
+    if( hio_open( av[i], 0, direct ) < 0 ) {
+        hio_exit( 4 );
+    }
+
+    // only the block layer is needed, and it mounts what it finds
+    // (replaying its journal)
+    __cio_puts( "Init:" );
+    _lat_init();
+    if( _blk_init( FS_BLOCK_SIZE ) < 0 || _blk_super() == NULL ) {
+        __cio_printf( "\nfsck: no file system on '%s'\n", av[i] );
+        hio_exit( 4 );
+    }
+    __cio_puts( "\n" );
+
+    start = _clk_ns();
+    problems = _fsck_check( &res, repair );
+    if( problems < 0 ) {
+        __cio_puts( "fsck: the check couldn't be completed\n" );
+        hio_exit( 4 );
+    }
+
+    __cio_printf( "%s:", av[i] );
+    _fsck_report( &res );
+    __cio_printf( "; %llu of %llu %u byte blocks, %llu us\n",
+                  (unsigned long long) res.used,
+                  (unsigned long long) _blk_super()->block_count,
+                  _blk_size(), ( _clk_ns() - start ) / 1000 );
+
+    if( problems == 0 ) {
+        hio_exit( 0 );
+    }
+    hio_exit( res.repaired ? 1 : 4 );
+    return( 0 );
+}
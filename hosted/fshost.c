@@ -0,0 +1,238 @@
+/**
+** @file fshost.c
+**
+** @author CSCI-452 class of 20205
+**
+** Hosted file system driver
+**
+** Runs the kernel's file system, block layer and latency histograms
+** as a Linux program over a disk image file, performing the file
+** system calls given on the command line in order:
+**
+**    fshost [-D] [-s size] image command ...
+**
+**    -D       open the image with O_DIRECT
+**    -s size  make the image 'size' bytes (k, m and g suffixes work);
+**             it is created if need be, and sparse
+**
+** Commands are "create name", "delete name", "open name", "close
+** name", "sync name", "read name", "write name text" (writes the
+** text), "fill name n" (writes n bytes of a pattern) and "lat" (prints
+** the block layer latency histograms).  The result of each call is
+** printed, followed at the end by the elapsed time.  "crash" quits on
+** the spot, without committing the journal's running transaction or
+** checkpointing it, as if the power had gone out.
+**
+** An image without a file system on it is formatted first; one with
+** a file system (from an earlier run, or from hosted/mkfs) is mounted,
+** so files persist from run to run.  The journal is checkpointed when
+** the commands are done.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "filemanager.h"
+#include "file.h"
+#include "block.h"
+#include "journal.h"
+#include "lathist.h"
+
+#include "hosted/hostio.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+// largest file the file system can hold
+#define MAX_FILE    ( NUM_BLOCKS * BLOCK_SIZE_MAX )
+
+// how much of a file "read" prints
+#define SHOW_BYTES  64
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// file contents, for reads and writes
+static char *buf;
+
+// names of the histograms, indexed by LAT_* code
+static char *lat_names[N_LAT] = {
+    "ahci read", "ahci write", "blk read", "blk write", "fcreate",
+    "fdelete", "fopen", "fclose", "fread", "fwrite", "freadv",
+    "fwritev", "ioring_enter"
+};
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/**
+** Name:  usage
+**
+** Describes the command line, and quits
+*/
+static void usage( void ) {
+    __cio_puts( "usage: fshost [-D] [-s size] image command ...\n"
+                "commands: create name, delete name, open name, "
+                "close name, sync name,\n"
+                "          read name, write name text, fill name n, lat, "
+                "crash\n" );
+    hio_exit( 1 );
+}
+
+/**
+** Name:  show_lat
+**
+** Prints every histogram that has something in it
+*/
+static void show_lat( void ) {
+    lathist_t h;
+
+    for( int i = 0; i < N_LAT; ++i ) {
+        if( _lat_get( i, &h ) < 0 || h.count == 0 ) {
+            continue;
+        }
+
+        __cio_printf( "%-12s %8u ops  avg %10llu ns  max %10llu ns\n",
+                      lat_names[i], h.count, h.total_ns / h.count,
+                      h.max_ns );
+        for( int b = 0; b < N_LAT_BUCKETS; ++b ) {
+            if( h.bucket[b] != 0 ) {
+                __cio_printf( "    >= %10llu ns %8u\n", 1ULL << b,
+                              h.bucket[b] );
+            }
+        }
+    }
+}
+
+/**
+** Name:  run
+**
+** Performs one command
+**
+** @param av  The command and its arguments
+** @param n   How many of them there are
+**
+** @return how many of them were used, or 0 if the command is bad
+*/
+static int run( char **av, int n ) {
+    char *cmd = av[0];
+    char *name = n > 1 ? av[1] : NULL;
+    unsigned long long len;
+    int result;
+
+    if( __strcmp( cmd, "lat" ) == 0 ) {
+        show_lat();
+        return( 1 );
+    }
+    if( __strcmp( cmd, "crash" ) == 0 ) {
+        __cio_puts( "crash\n" );
+        hio_exit( 0 );
+    }
+
+    if( name == NULL ) {
+        return( 0 );
+    }
+
+    if( __strcmp( cmd, "create" ) == 0 ) {
+        result = _fs_create( name );
+    } else if( __strcmp( cmd, "delete" ) == 0 ) {
+        result = _fs_delete( name );
+    } else if( __strcmp( cmd, "open" ) == 0 ) {
+        result = _fs_open( name );
+    } else if( __strcmp( cmd, "close" ) == 0 ) {
+        result = _fs_close( name );
+    } else if( __strcmp( cmd, "sync" ) == 0 ) {
+        result = _fs_sync( name );
+    } else if( __strcmp( cmd, "read" ) == 0 ) {
+        result = _fs_read( name, buf );
+        if( result > 0 ) {
+            __cio_printf( "%s %s => %d \"%.*s\"%s\n", cmd, name, result,
+                          SHOW_BYTES, buf, result > SHOW_BYTES ? "..." : "" );
+            return( 2 );
+        }
+    } else if( n < 3 ) {
+        return( 0 );
+    } else if( __strcmp( cmd, "write" ) == 0 ) {
+        result = _fs_write( name, av[2], __strlen( av[2] ) );
+        __cio_printf( "%s %s %u => %d\n", cmd, name, __strlen( av[2] ),
+                      result );
+        return( 3 );
+    } else if( __strcmp( cmd, "fill" ) == 0 ) {
+        if( hio_strtoull( av[2], &len ) < 0 || len > MAX_FILE ) {
+            return( 0 );
+        }
+        for( uint32_t i = 0; i < len; ++i ) {
+            buf[i] = 'a' + i % 26;
+        }
+        result = _fs_write( name, buf, len );
+        __cio_printf( "%s %s %llu => %d\n", cmd, name, len, result );
+        return( 3 );
+    } else {
+        return( 0 );
+    }
+
+    __cio_printf( "%s %s => %d\n", cmd, name, result );
+    return( 2 );
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+int main( int ac, char **av ) {
+    unsigned long long size = 0;
+    uint64_t start;
+    int direct = 0;
+    int i;
+
+    for( i = 1; i < ac && av[i][0] == '-'; ++i ) {
+        if( __strcmp( av[i], "-D" ) == 0 ) {
+            direct = 1;
+        } else if( __strcmp( av[i], "-s" ) == 0 && i + 1 < ac ) {
+            if( hio_strtoull( av[++i], &size ) < 0 ) {
+                usage();
+            }
+        } else {
+            usage();
+        }
+    }
+    if( i >= ac ) {
+        usage();
+    }
+
+    if( hio_open( av[i++], size, direct ) < 0 ) {
+        hio_exit( 1 );
+    }
+
+    __cio_puts( "Init:" );
+    _lat_init();
+    _fs_init();
+    __cio_puts( "\n" );
+    if( _blk_super() == NULL ) {
+        hio_exit( 1 );
+    }
+
+    buf = _km_page_alloc( MAX_FILE / PAGE_SIZE + 1 );
+
+    start = _clk_ns();
+    while( i < ac ) {
+        int used = run( &av[i], ac - i );
+        if( used == 0 ) {
+            __cio_printf( "bad command '%s'\n", av[i] );
+            usage();
+        }
+        i += used;
+    }
+
+    __cio_printf( "%llu us\n", ( _clk_ns() - start ) / 1000 );
+
+    if( _jnl_checkpoint() < 0 ) {
+        hio_exit( 1 );
+    }
+    hio_exit( 0 );
+    return( 0 );
+}
@@ -0,0 +1,331 @@
+/*
+** @file hostio.c
+**
+** @author CSCI-452 class of 20205
+**
+** Host services for the hosted storage stack
+**
+** This is the only part of the hosted build that sees the C library;
+** see hostio.h.  The image file is extended with ftruncate(), so the
+** host only allocates space for sectors which have been written.
+**
+** With O_DIRECT, the host requires buffers aligned to its own block
+** size.  The block layer's buffers come from the page allocator and
+** already are; anything else is staged through a bounce buffer.
+*/
+
+#define _GNU_SOURCE
+
+#include "hostio.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+// buffer alignment O_DIRECT is assumed to need
+#define DIRECT_ALIGN    4096
+
+// size of the bounce buffer for unaligned O_DIRECT transfers
+#define BOUNCE_BYTES    (1024 * 1024)
+
+// longest path hio_walk handles
+#define WALK_PATH       4096
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+static int fd = -1;
+static int direct;
+static unsigned long long sectors;
+static char *bounce;
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/**
+** Name:  transfer
+**
+** Moves sectors between memory and the image file, through the
+** bounce buffer if O_DIRECT can't take the caller's buffer
+**
+** @param lba    First sector
+** @param count  Number of sectors
+** @param buf    The memory
+** @param write  Nonzero to write, else read
+**
+** @return 1 on success, else 0
+*/
+static int transfer( unsigned long long lba, unsigned int count, char *buf,
+                     int write ) {
+    off_t off = (off_t) lba * HIO_SECTOR;
+    size_t len = (size_t) count * HIO_SECTOR;
+
+    if( lba + count > sectors ) {
+        fprintf( stderr, "hostio: %s of %u sectors at %llu is past the "
+                 "end of the image\n", write ? "write" : "read", count, lba );
+        return( 0 );
+    }
+
+    while( len > 0 ) {
+        char *src = buf;
+        size_t n = len;
+        ssize_t done;
+
+        if( direct && ( (uintptr_t) buf % DIRECT_ALIGN ) != 0 ) {
+            src = bounce;
+            if( n > BOUNCE_BYTES ) {
+                n = BOUNCE_BYTES;
+            }
+            if( write ) {
+                memcpy( bounce, buf, n );
+            }
+        }
+
+        done = write ? pwrite( fd, src, n, off ) : pread( fd, src, n, off );
+        if( done < 0 && errno == EINTR ) {
+            continue;
+        }
+        if( done <= 0 ) {
+            fprintf( stderr, "hostio: %s at sector %llu: %s\n",
+                     write ? "write" : "read", (unsigned long long)
+                     ( off / HIO_SECTOR ), done < 0 ? strerror( errno ) :
+                     "unexpected end of file" );
+            return( 0 );
+        }
+
+        if( !write && src == bounce ) {
+            memcpy( buf, bounce, done );
+        }
+        buf += done;
+        off += done;
+        len -= done;
+    }
+
+    return( 1 );
+}
+
+/**
+** Name:  walk
+**
+** Visits one directory for hio_walk:  its files, then (recursively)
+** its subdirectories
+**
+** @param path  The directory's host path; there is room to extend it
+** @param top   Length of the top of the tree's path, plus the slash
+** @param fn    The function to call for each file
+**
+** @return 0 on success, else -1
+*/
+static int walk( char *path, size_t top, hio_walk_fn fn ) {
+    struct dirent **ents;
+    size_t len = strlen( path );
+    int result = 0;
+    int n;
+
+    n = scandir( path, &ents, NULL, alphasort );
+    if( n < 0 ) {
+        fprintf( stderr, "hostio: can't read '%s': %s\n", path,
+                 strerror( errno ) );
+        return( -1 );
+    }
+
+    for( int pass = 0; pass < 2; ++pass ) {
+        for( int i = 0; i < n; ++i ) {
+            char *name = ents[i]->d_name;
+            struct stat st;
+
+            if( strcmp( name, "." ) == 0 || strcmp( name, ".." ) == 0 ) {
+                continue;
+            }
+            if( len + 1 + strlen( name ) >= WALK_PATH ) {
+                fprintf( stderr, "hostio: '%s/%s' is too long\n", path, name );
+                result = -1;
+                continue;
+            }
+            sprintf( path + len, "/%s", name );
+
+            if( stat( path, &st ) < 0 ) {
+                fprintf( stderr, "hostio: can't stat '%s': %s\n", path,
+                         strerror( errno ) );
+                result = -1;
+            } else if( pass == 0 && S_ISREG( st.st_mode ) ) {
+                fn( path, path + top, (unsigned long long) st.st_size );
+            } else if( pass == 1 && S_ISDIR( st.st_mode ) ) {
+                if( walk( path, top, fn ) < 0 ) {
+                    result = -1;
+                }
+            }
+            path[len] = '\0';
+        }
+    }
+
+    for( int i = 0; i < n; ++i ) {
+        free( ents[i] );
+    }
+    free( ents );
+
+    return( result );
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+int hio_open( const char *path, unsigned long long bytes, int odirect ) {
+    off_t size;
+
+    fd = open( path, O_RDWR | O_CREAT | ( odirect ? O_DIRECT : 0 ), 0644 );
+    if( fd < 0 ) {
+        fprintf( stderr, "hostio: can't open '%s': %s\n", path,
+                 strerror( errno ) );
+        return( -1 );
+    }
+
+    if( bytes > 0 && ftruncate( fd, (off_t) bytes ) < 0 ) {
+        fprintf( stderr, "hostio: can't size '%s': %s\n", path,
+                 strerror( errno ) );
+        close( fd );
+        return( -1 );
+    }
+
+    size = lseek( fd, 0, SEEK_END );
+    if( size < HIO_SECTOR ) {
+        fprintf( stderr, "hostio: '%s' is empty; give it a size\n", path );
+        close( fd );
+        return( -1 );
+    }
+
+    direct = odirect;
+    sectors = (unsigned long long) size / HIO_SECTOR;
+    if( direct ) {
+        bounce = hio_alloc( BOUNCE_BYTES, DIRECT_ALIGN );
+    }
+
+    return( 0 );
+}
+
+void hio_close( void ) {
+    if( fd >= 0 ) {
+        fsync( fd );
+        close( fd );
+        fd = -1;
+    }
+}
+
+unsigned long long hio_sectors( void ) {
+    return( sectors );
+}
+
+int hio_read( unsigned long long lba, unsigned int count, void *buf ) {
+    return( transfer( lba, count, buf, 0 ) );
+}
+
+int hio_write( unsigned long long lba, unsigned int count, const void *buf ) {
+    return( transfer( lba, count, (char *) buf, 1 ) );
+}
+
+void *hio_alloc( unsigned long bytes, unsigned long align ) {
+    void *ptr;
+
+    if( align < sizeof(void *) ) {
+        align = sizeof(void *);
+    }
+    if( posix_memalign( &ptr, align, bytes ) != 0 ) {
+        fprintf( stderr, "hostio: out of memory (%lu bytes)\n", bytes );
+        exit( EXIT_FAILURE );
+    }
+
+    return( ptr );
+}
+
+void hio_free( void *ptr ) {
+    free( ptr );
+}
+
+unsigned long long hio_ns( void ) {
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec );
+}
+
+void hio_vprintf( const char *fmt, va_list ap ) {
+    vprintf( fmt, ap );
+}
+
+void hio_vsprintf( char *dst, const char *fmt, va_list ap ) {
+    vsprintf( dst, fmt, ap );
+}
+
+int hio_strtoull( const char *str, unsigned long long *val ) {
+    char *end;
+
+    errno = 0;
+    *val = strtoull( str, &end, 10 );
+    if( errno != 0 || end == str ) {
+        return( -1 );
+    }
+
+    switch( *end ) {
+    case 'g': case 'G': *val <<= 10;    // FALL THROUGH
+    case 'm': case 'M': *val <<= 10;    // FALL THROUGH
+    case 'k': case 'K': *val <<= 10; ++end; break;
+    }
+
+    return( *end == '\0' ? 0 : -1 );
+}
+
+int hio_walk( const char *dir, hio_walk_fn fn ) {
+    char path[WALK_PATH];
+    size_t len = strlen( dir );
+
+    // no trailing slashes, so relative names don't start with one
+    while( len > 1 && dir[len - 1] == '/' ) {
+        --len;
+    }
+    if( len >= WALK_PATH ) {
+        return( -1 );
+    }
+    memcpy( path, dir, len );
+    path[len] = '\0';
+
+    return( walk( path, len + 1, fn ) );
+}
+
+int hio_load( const char *path, void *buf, unsigned long long bytes ) {
+    FILE *fp = fopen( path, "rb" );
+    int result = 0;
+
+    if( fp == NULL ) {
+        fprintf( stderr, "hostio: can't open '%s': %s\n", path,
+                 strerror( errno ) );
+        return( -1 );
+    }
+
+    if( fread( buf, 1, bytes, fp ) != bytes ) {
+        fprintf( stderr, "hostio: can't read '%s'\n", path );
+        result = -1;
+    }
+    fclose( fp );
+
+    return( result );
+}
+
+void hio_exit( int status ) {
+    hio_close();
+    fflush( stdout );
+    exit( status );
+}
@@ -0,0 +1,188 @@
+/*
+** @file hostio.h
+**
+** @author CSCI-452 class of 20205
+**
+** Host services for the hosted storage stack
+**
+** The hosted build runs block.c, file.c and filemanager.c as an
+** ordinary Linux program.  Those modules are compiled against the
+** kernel's own headers, whose types and names clash with the C
+** library's, so the program is split in two:  hostio.c is the only
+** file which includes system headers, and the kernel side (kshim.c
+** and fshost.c) reaches the host only through the functions declared
+** here, which use nothing but basic C types.
+**
+** The "disk" is a sparse image file of 512-byte sectors, accessed
+** with pread()/pwrite(); optionally it is opened with O_DIRECT, so
+** that transfers bypass the host's page cache.
+*/
+
+#ifndef HOSTIO_H_
+#define HOSTIO_H_
+
+#include <stdarg.h>
+
+// sector size of the image file
+#define HIO_SECTOR      512
+
+/**
+** Name:  hio_open
+**
+** Opens (creating it if need be) the disk image file
+**
+** @param path    Name of the image file
+** @param bytes   Size to make the image, or 0 to keep its current size
+** @param direct  Nonzero to bypass the host page cache (O_DIRECT)
+**
+** @return 0 on success, else -1
+*/
+int hio_open( const char *path, unsigned long long bytes, int direct );
+
+/**
+** Name:  hio_close
+**
+** Flushes and closes the disk image file
+*/
+void hio_close( void );
+
+/**
+** Name:  hio_sectors
+**
+** @return the number of sectors in the disk image
+*/
+unsigned long long hio_sectors( void );
+
+/**
+** Name:  hio_read
+**
+** Reads sectors from the disk image
+**
+** @param lba    First sector
+** @param count  Number of sectors
+** @param buf    Where to put them
+**
+** @return 1 on success, else 0
+*/
+int hio_read( unsigned long long lba, unsigned int count, void *buf );
+
+/**
+** Name:  hio_write
+**
+** Writes sectors to the disk image
+**
+** @param lba    First sector
+** @param count  Number of sectors
+** @param buf    What to write
+**
+** @return 1 on success, else 0
+*/
+int hio_write( unsigned long long lba, unsigned int count, const void *buf );
+
+/**
+** Name:  hio_alloc
+**
+** Allocates host memory
+**
+** @param bytes  How much
+** @param align  Required alignment (a power of two)
+**
+** @return the memory; exits the program if there is none
+*/
+void *hio_alloc( unsigned long bytes, unsigned long align );
+
+/**
+** Name:  hio_free
+**
+** Returns memory obtained from hio_alloc()
+**
+** @param ptr  The memory
+*/
+void hio_free( void *ptr );
+
+/**
+** Name:  hio_ns
+**
+** @return the host's monotonic clock, in nanoseconds
+*/
+unsigned long long hio_ns( void );
+
+/**
+** Name:  hio_vprintf
+**
+** Formatted output to the standard output
+**
+** @param fmt  printf-style format
+** @param ap   The values
+*/
+void hio_vprintf( const char *fmt, va_list ap );
+
+/**
+** Name:  hio_vsprintf
+**
+** Formatted output to a buffer
+**
+** @param dst  The buffer (assumed to be large enough)
+** @param fmt  printf-style format
+** @param ap   The values
+*/
+void hio_vsprintf( char *dst, const char *fmt, va_list ap );
+
+/**
+** Name:  hio_strtoull
+**
+** Converts a decimal number, with an optional k, m or g suffix
+**
+** @param str  The string
+** @param val  Where to put the value
+**
+** @return 0 on success, else -1
+*/
+int hio_strtoull( const char *str, unsigned long long *val );
+
+/**
+** Type of the function hio_walk calls for each file
+**
+** @param path   The file's host path
+** @param name   Its path relative to the top of the tree
+** @param bytes  Its size
+*/
+typedef void (*hio_walk_fn)( const char *path, const char *name,
+                             unsigned long long bytes );
+
+/**
+** Name:  hio_walk
+**
+** Calls a function for each regular file in a directory tree, in
+** sorted order, each directory's files before its subdirectories'
+**
+** @param dir  The top of the tree
+** @param fn   The function
+**
+** @return 0 on success, else -1
+*/
+int hio_walk( const char *dir, hio_walk_fn fn );
+
+/**
+** Name:  hio_load
+**
+** Reads the start of a host file into memory
+**
+** @param path   The file
+** @param buf    Where to put it
+** @param bytes  How much to read
+**
+** @return 0 if that much was read, else -1
+*/
+int hio_load( const char *path, void *buf, unsigned long long bytes );
+
+/**
+** Name:  hio_exit
+**
+** Ends the program
+**
+** @param status  The exit status
+*/
+void hio_exit( int status );
+
+#endif
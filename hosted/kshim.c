@@ -0,0 +1,202 @@
+/**
+** @file kshim.c
+**
+** @author CSCI-452 class of 20205
+**
+** Kernel services for the hosted storage stack
+**
+** Supplies the parts of the kernel that block.c, file.c, filemanager.c
+** and lathist.c call, built on the host services in hostio.c:
+**
+**    console output and panics         -> standard output, exit
+**    page and object allocation        -> aligned host memory
+**    I/O buffer pool                   -> a pool of the same size
+**    TSC clock                         -> the host's monotonic clock
+**    AHCI device list and transfers    -> one disk, the image file
+**
+** The I/O buffer pool is reimplemented rather than compiled from
+** iobuf.c, which keeps its free list in a 32-bit word.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "kmem.h"
+#include "iobuf.h"
+#include "clock.h"
+#include "ahci.h"
+
+#include "hosted/hostio.h"
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// the I/O buffer pool
+static void *_iobufs[N_IOBUFS];
+static uint32_t _iobufs_free;
+
+/*
+** PUBLIC GLOBAL VARIABLES
+*/
+
+// buffer used by PANIC
+char b512[512];
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/*
+** Console and kernel library
+*/
+
+void __cio_putchar( unsigned int c ) {
+    __cio_printf( "%c", c );
+}
+
+void __cio_puts( char *str ) {
+    __cio_printf( "%s", str );
+}
+
+void __cio_printf( char *fmt, ... ) {
+    va_list ap;
+
+    va_start( ap, fmt );
+    hio_vprintf( fmt, ap );
+    va_end( ap );
+}
+
+void __sprint( char *dst, char *fmt, ... ) {
+    va_list ap;
+
+    va_start( ap, fmt );
+    hio_vsprintf( dst, fmt, ap );
+    va_end( ap );
+}
+
+void __memclr( void *buf, register unsigned int len ) {
+    register uint8_t *dst = buf;
+
+    while( len-- ) {
+        *dst++ = 0;
+    }
+}
+
+void __memcpy( void *dst, register const void *src, register unsigned int len ) {
+    register uint8_t *d = dst;
+    register const uint8_t *s = src;
+
+    while( len-- ) {
+        *d++ = *s++;
+    }
+}
+
+unsigned int __strlen( register const char *str ) {
+    register unsigned int len = 0;
+
+    while( *str++ ) {
+        ++len;
+    }
+
+    return( len );
+}
+
+int __strcmp( register const char *s1, register const char *s2 ) {
+
+    while( *s1 != 0 && (*s1 == *s2) ) {
+        ++s1, ++s2;
+    }
+
+    return( *(const unsigned char *)s1 - *(const unsigned char *)s2 );
+}
+
+void _kpanic( char *mod, char *msg ) {
+    __cio_puts( "\n\n***** KERNEL PANIC *****\n\n" );
+    __cio_printf( "Mod:  %s   Msg: %s\n", mod, msg ? msg : "(none)" );
+    hio_exit( 2 );
+}
+
+/*
+** Memory
+*/
+
+void *_km_page_alloc( uint32_t count ) {
+    return( hio_alloc( count * PAGE_SIZE, PAGE_SIZE ) );
+}
+
+void _km_page_free( void *block ) {
+    hio_free( block );
+}
+
+void *_km_alloc( uint32_t size ) {
+    void *ptr = hio_alloc( size, 16 );
+
+    // objects from the kernel's caches come cleared
+    __memclr( ptr, size );
+    return( ptr );
+}
+
+void _km_free( void *ptr, uint32_t size ) {
+    (void) size;
+    hio_free( ptr );
+}
+
+void *_iob_get( void ) {
+
+    // the buffers are only allocated when first needed
+    if( _iobufs_free == 0 ) {
+        return( _km_page_alloc( IOB_PAGES ) );
+    }
+
+    return( _iobufs[--_iobufs_free] );
+}
+
+void _iob_put( void *buf ) {
+
+    if( _iobufs_free == N_IOBUFS ) {
+        _km_page_free( buf );
+        return;
+    }
+
+    _iobufs[_iobufs_free++] = buf;
+}
+
+/*
+** Clock
+*/
+
+uint64_t _clk_ns( void ) {
+    return( hio_ns() );
+}
+
+/*
+** Disk
+*/
+
+hddDeviceList_t _get_device_list( void ) {
+    hddDeviceList_t list;
+
+    __memclr( &list, sizeof(list) );
+    list.count = 1;
+    list.devices[0].port = NULL;
+    list.devices[0].sector_count = hio_sectors();
+    list.devices[0].total_bytes = hio_sectors() * HIO_SECTOR;
+    list.devices[0].sector_size = HIO_SECTOR;
+    list.devices[0].phys_sector_size = HIO_SECTOR;
+
+    return( list );
+}
+
+bool_t _read_disk( hddDevice_t device, uint64_t lba, uint32_t count,
+                   uint16_t *buf ) {
+    (void) device;
+    return( hio_read( lba, count, buf ) );
+}
+
+bool_t _write_disk( hddDevice_t device, uint64_t lba, uint32_t count,
+                    uint16_t *buf ) {
+    (void) device;
+    return( hio_write( lba, count, buf ) );
+}
@@ -0,0 +1,223 @@
+/**
+** @file mkfs.c
+**
+** @author CSCI-452 class of 20205
+**
+** Hosted file system builder
+**
+** Formats a disk image file with the kernel's own file system code and
+** copies a host directory tree into it, so the kernel boots with the
+** files already there:
+**
+**    mkfs [-s size] [-b block_size] [-n files] image [dir]
+**
+**    -s size        make the image 'size' bytes (k, m and g suffixes
+**                   work); it is created if need be, and sparse
+**    -b block_size  the block size (default: as the kernel picks)
+**    -n files       room for this many files (default: FS_MAX_FILES,
+**                   or the number of files in dir if that's more)
+**
+** The file system has a single flat directory, so each file is named
+** by its path under dir, e.g. "etc/motd", which must be shorter than
+** FS_NAME_LEN.  Files are copied in sorted order, each into a run of
+** blocks exactly big enough for it, so the image ends up packed from
+** the front with no gaps between files.  Files that can't be copied
+** are reported, and make the exit status 1.
+**
+** The kernel mounts the image when it is attached as the only disk.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "filemanager.h"
+#include "file.h"
+#include "block.h"
+#include "journal.h"
+#include "lathist.h"
+#include "kstats.h"
+
+#include "hosted/hostio.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+// largest file that can be copied (_fs_write takes an int)
+#define MAX_COPY    0x7fffffffULL
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// files seen by the counting pass
+static uint32_t counted;
+
+// files and bytes copied, and files that couldn't be
+static uint32_t copied;
+static uint64_t copied_bytes;
+static uint32_t failed;
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/**
+** Name:  usage
+**
+** Describes the command line, and quits
+*/
+static void usage( void ) {
+    __cio_puts( "usage: mkfs [-s size] [-b block_size] [-n files] "
+                "image [dir]\n" );
+    hio_exit( 1 );
+}
+
+/**
+** Name:  count
+**
+** hio_walk function for the counting pass
+*/
+static void count( const char *path, const char *name,
+                   unsigned long long bytes ) {
+    (void) path, (void) name, (void) bytes;
+    ++counted;
+}
+
+/**
+** Name:  copy
+**
+** hio_walk function which copies one file into the file system
+**
+** @param path   The file's host path
+** @param name   Its name in the file system
+** @param bytes  Its size
+*/
+static void copy( const char *path, const char *name,
+                  unsigned long long bytes ) {
+    char fsname[FS_NAME_LEN];
+    char *buf;
+    int ok;
+
+    if( __strlen( name ) >= FS_NAME_LEN ) {
+        __cio_printf( "mkfs: '%s': name is longer than %d characters\n",
+                      name, FS_NAME_LEN - 1 );
+        ++failed;
+        return;
+    }
+    if( bytes > MAX_COPY ) {
+        __cio_printf( "mkfs: '%s': too big\n", name );
+        ++failed;
+        return;
+    }
+    __memcpy( fsname, (void *) name, __strlen( name ) + 1 );
+
+    buf = hio_alloc( bytes + 1, PAGE_SIZE );
+    ok = hio_load( path, buf, bytes ) == 0 &&
+         _fs_create_sized( fsname, bytes ) == 0;
+    if( ok ) {
+        ok = _fs_open( fsname ) == 0;
+        if( ok ) {
+            ok = _fs_write( fsname, buf, bytes ) == 0;
+            ok = _fs_close( fsname ) == 0 && ok;
+        }
+        if( !ok ) {
+            _fs_delete( fsname );
+        }
+    }
+    hio_free( buf );
+
+    if( !ok ) {
+        __cio_printf( "mkfs: '%s': not copied\n", name );
+        ++failed;
+        return;
+    }
+
+    ++copied;
+    copied_bytes += bytes;
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+int main( int ac, char **av ) {
+    unsigned long long size = 0, block_size = FS_BLOCK_SIZE;
+    unsigned long long files = 0;
+    char *dir = NULL;
+    kstats_t ks;
+    int i;
+
+    for( i = 1; i < ac && av[i][0] == '-'; ++i ) {
+        unsigned long long *val = NULL;
+
+        if( __strcmp( av[i], "-s" ) == 0 ) {
+            val = &size;
+        } else if( __strcmp( av[i], "-b" ) == 0 ) {
+            val = &block_size;
+        } else if( __strcmp( av[i], "-n" ) == 0 ) {
+            val = &files;
+        } else {
+            usage();
+        }
+        if( i + 1 >= ac || hio_strtoull( av[++i], val ) < 0 ) {
+            usage();
+        }
+    }
+    if( i >= ac || ac - i > 2 || block_size > BLOCK_SIZE_MAX ||
+        files > 0xffffffffULL ) {
+        usage();
+    }
+    if( ac - i == 2 ) {
+        dir = av[i + 1];
+    }
+
+    // room for everything in the tree, unless told otherwise
+    if( files == 0 ) {
+        files = FS_MAX_FILES;
+        if( dir != NULL ) {
+            if( hio_walk( dir, count ) < 0 ) {
+                hio_exit( 1 );
+            }
+            if( counted > files ) {
+                files = counted;
+            }
+        }
+    }
+
+    if( hio_open( av[i], size, 0 ) < 0 ) {
+        hio_exit( 1 );
+    }
+
+    __cio_puts( "Init:" );
+    _lat_init();
+    if( _fs_format( block_size, files ) < 0 ) {
+        __cio_puts( "\n" );
+        hio_exit( 1 );
+    }
+    _fs_init();
+    __cio_puts( "\n" );
+    if( _blk_super() == NULL ) {
+        hio_exit( 1 );
+    }
+
+    if( dir != NULL && hio_walk( dir, copy ) < 0 ) {
+        ++failed;
+    }
+
+    // the kernel shouldn't have to replay anything
+    if( _jnl_checkpoint() < 0 ) {
+        hio_exit( 1 );
+    }
+
+    _blk_stats( &ks );
+    __cio_printf( "%u files, %llu bytes copied; %llu of %llu %u byte "
+                  "blocks free; room for %llu files\n", copied,
+                  (unsigned long long) copied_bytes,
+                  (unsigned long long) ks.blk_free,
+                  (unsigned long long) ks.blk_total, _blk_size(), files );
+
+    hio_exit( failed == 0 ? 0 : 1 );
+    return( 0 );
+}
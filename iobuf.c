@@ -0,0 +1,144 @@
+/**
+** @file iobuf.c
+**
+** @author  CSCI-452 class of 20205
+**
+** Disk I/O buffer pool implementation
+**
+** A fixed number of buffers is taken from the page allocator when
+** the system starts, and they are never returned.  Each one is a
+** power-of-two number of pages, so the buddy allocator gives it to
+** us aligned on its own size; that keeps every PRDT entry within a
+** single 64KB region and word-aligned, as the controller requires.
+**
+** Getting and putting buffers never touches the general allocator.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "iobuf.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+/*
+** PRIVATE DATA TYPES
+*/
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// buffer management
+//
+// as with stacks, the "free list" uses the first word of
+// each buffer as a pointer to the next free buffer
+
+static void *_free_iobufs;
+
+// number of buffers currently in use
+static uint32_t _iobufs_used;
+
+// buffers handed out, and requests made when none were left
+static uint32_t _iobuf_gets;
+static uint32_t _iobuf_misses;
+
+/*
+** PUBLIC GLOBAL VARIABLES
+*/
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** _iob_init() - initialize the I/O buffer module
+**
+** Allocates the whole pool up front
+**
+** Dependencies:
+**    Cannot be called before kmem is initialized
+**    Must be called before any disk I/O is done
+*/
+void _iob_init( void ) {
+
+    __cio_puts( " Iobuf:" );
+
+    _free_iobufs = NULL;
+    _iobufs_used = N_IOBUFS;
+    _iobuf_gets = _iobuf_misses = 0;
+
+    for( int i = 0; i < N_IOBUFS; ++i ) {
+        void *buf = _km_page_alloc( IOB_PAGES );
+
+        // we can't do disk I/O without these
+        assert( buf != NULL );
+        assert( ((uint32_t) buf & (IOB_SIZE - 1)) == 0 );
+
+        _iob_put( buf );
+    }
+
+    __cio_puts( " done" );
+}
+
+/**
+** _iob_get() - take a buffer from the pool
+**
+** The buffer is physically contiguous, IOB_SIZE bytes long, and
+** aligned on an IOB_SIZE boundary, so it can be handed to the disk
+** controller directly.  Its contents are undefined.
+**
+** @return pointer to the buffer, or NULL if none are available
+*/
+void *_iob_get( void ) {
+    void *buf = _free_iobufs;
+
+    if( buf != NULL ) {
+        _free_iobufs = *(void **) buf;
+        ++_iobufs_used;
+        ++_iobuf_gets;
+    } else {
+        ++_iobuf_misses;
+    }
+
+    return( buf );
+}
+
+/**
+** _iob_put() - return a buffer to the pool
+**
+** @param buf   The buffer
+*/
+void _iob_put( void *buf ) {
+
+    // sanity check!
+    if( buf == NULL ) {
+        return;
+    }
+
+    assert1( _iobufs_used > 0 );
+
+    *(void **) buf = _free_iobufs;
+    _free_iobufs = buf;
+    --_iobufs_used;
+}
+
+/**
+** _iob_stats() - fill in the buffer pool part of a kstats_t
+**
+** @param ks   The statistics to fill in
+*/
+void _iob_stats( kstats_t *ks ) {
+
+    ks->iob_total = N_IOBUFS;
+    ks->iob_used = _iobufs_used;
+    ks->iob_gets = _iobuf_gets;
+    ks->iob_misses = _iobuf_misses;
+}
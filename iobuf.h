@@ -0,0 +1,89 @@
+/*
+** @file iobuf.h
+**
+** @author CSCI-452 class of 20205
+**
+** Disk I/O buffer pool declarations
+*/
+
+#ifndef IOBUF_H_
+#define IOBUF_H_
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+#include "common.h"
+
+#include "kmem.h"
+#include "ahci.h"
+#include "kstats.h"
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+// buffer size, in bytes and pages
+//
+// each buffer holds the largest transfer a single AHCI command
+// can describe
+
+#define IOB_SIZE        AHCI_MAX_BYTES
+#define IOB_PAGES       (IOB_SIZE / PAGE_SIZE)
+
+// number of buffers in the pool
+#define N_IOBUFS        4
+
+/*
+** Types
+*/
+
+/*
+** Globals
+*/
+
+/*
+** Prototypes
+*/
+
+/**
+** _iob_init() - initialize the I/O buffer module
+**
+** Allocates the whole pool up front
+**
+** Dependencies:
+**    Cannot be called before kmem is initialized
+**    Must be called before any disk I/O is done
+*/
+void _iob_init( void );
+
+/**
+** _iob_get() - take a buffer from the pool
+**
+** The buffer is physically contiguous, IOB_SIZE bytes long, and
+** aligned on an IOB_SIZE boundary, so it can be handed to the disk
+** controller directly.  Its contents are undefined.
+**
+** @return pointer to the buffer, or NULL if none are available
+*/
+void *_iob_get( void );
+
+/**
+** _iob_put() - return a buffer to the pool
+**
+** @param buf   The buffer
+*/
+void _iob_put( void *buf );
+
+/**
+** _iob_stats() - fill in the buffer pool part of a kstats_t
+**
+** @param ks   The statistics to fill in
+*/
+void _iob_stats( kstats_t *ks );
+
+#endif
+
+#endif
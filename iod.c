@@ -0,0 +1,350 @@
+/**
+** @file iod.c
+**
+** @author  CSCI-452 class of 20205
+**
+** I/O daemon implementation
+**
+** All file system work is done by a single kernel process, the I/O
+** daemon.  A process making a file system call is blocked and its
+** request is queued for the daemon; the daemon performs the request
+** with interrupts enabled, so the clock keeps ticking and other
+** processes keep running while the disk is busy.  When the request
+** is complete, the daemon stores the result in the caller's context
+** and puts it back on the ready queue.
+**
+** Because only the daemon ever calls into the file system, file
+** system operations are serialized without any further locking.  The
+** daemon also drains the IORING_SQPOLL rings each time it wakes up,
+** and commits the metadata journal's running transaction once it has
+** been open long enough.  It only naps for a set time while there is
+** something to poll; otherwise it blocks until a call is submitted,
+** so an idle system isn't woken up just to find nothing to do.
+**
+** Anything the daemon shares with interrupt-level code (its request
+** queue, the scheduler) is only touched with interrupts disabled.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "iod.h"
+#include "process.h"
+#include "scheduler.h"
+#include "clock.h"
+#include "syscalls.h"
+#include "filemanager.h"
+#include "journal.h"
+#include "ioring.h"
+#include "lathist.h"
+#include "trace.h"
+#include "ulib.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+/*
+** PRIVATE DATA TYPES
+*/
+
+// a pending file system call
+typedef struct iodreq_s {
+    pcb_t *pcb;            // who made the call
+    uint32_t code;         // which call it was
+    uint32_t args[4];      // and its arguments
+    uint64_t start;        // when it was submitted, in ns
+} iodreq_t;
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// requests waiting for the daemon, in arrival order
+static queue_t _iowait;
+
+// where request records come from
+static kmcache_t *_iodreq_cache;
+
+// the daemon itself
+static pcb_t *_iod_pcb;
+
+// requests submitted, and the longest the queue has been
+static uint32_t _iod_requests;
+static uint32_t _iod_depth_max;
+
+/*
+** PUBLIC GLOBAL VARIABLES
+*/
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/**
+** Name:  _iod_perform
+**
+** Carries out a single request
+**
+** @param req   The request
+**
+** @return the value the system call returns
+*/
+static int32_t _iod_perform( iodreq_t *req ) {
+    uint32_t *args = req->args;
+
+    switch( req->code ) {
+
+    case SYS_fcreate:
+        return( _fs_create( (char *) args[0] ) );
+
+    case SYS_fdelete:
+        return( _fs_delete( (char *) args[0] ) );
+
+    case SYS_fopen:
+        return( _fs_open( (char *) args[0] ) );
+
+    case SYS_fclose:
+        return( _fs_close( (char *) args[0] ) );
+
+    case SYS_fread:
+        // the count includes the NUL terminator
+        return( _fs_read( (char *) args[0], (char *) args[1] ) );
+
+    case SYS_fwrite:
+        return( _fs_write( (char *) args[0], (char *) args[1],
+                           (int32_t) args[2] ) );
+
+    case SYS_freadv:
+        return( _fs_readv( (char *) args[0], (iovec_t *) args[1],
+                           (int32_t) args[2] ) );
+
+    case SYS_fwritev:
+        return( _fs_writev( (char *) args[0], (iovec_t *) args[1],
+                            (int32_t) args[2] ) );
+
+    case SYS_ioring_enter:
+        return( _ior_enter( req->pcb, args[0] ) );
+
+    default:
+        return( E_BAD_SYSCALL );
+    }
+}
+
+/**
+** Name:  _iod_lat
+**
+** Maps a system call code to its latency histogram
+**
+** @param code   The SYS_* code
+**
+** @return the LAT_* histogram identifier
+*/
+static uint32_t _iod_lat( uint32_t code ) {
+
+    switch( code ) {
+    case SYS_fcreate:       return( LAT_FCREATE );
+    case SYS_fdelete:       return( LAT_FDELETE );
+    case SYS_fopen:         return( LAT_FOPEN );
+    case SYS_fclose:        return( LAT_FCLOSE );
+    case SYS_fread:         return( LAT_FREAD );
+    case SYS_fwrite:        return( LAT_FWRITE );
+    case SYS_freadv:        return( LAT_FREADV );
+    case SYS_fwritev:       return( LAT_FWRITEV );
+    default:                return( LAT_IORING_ENTER );
+    }
+}
+
+/**
+** Name:  _iod_main
+**
+** The I/O daemon's main routine; never returns
+*/
+static void _iod_main( void ) {
+
+    for(;;) {
+        iodreq_t *req;
+
+        unsigned int flags = __disable_ints();
+        req = _que_deque( _iowait );
+
+        if( req == NULL ) {
+
+            // nothing to do right now.  polled rings and an open
+            // transaction need looking at now and then, so nap for
+            // a while; otherwise wait for a request.  a new request
+            // ends either one.  we check and sleep with interrupts
+            // off so that a request can't sneak in between the two.
+            if( _ior_polled() ) {
+                sleep( IORING_POLL_TICKS / TICKS_PER_MS );
+            } else if( _jnl_pending() ) {
+                sleep( JNL_COMMIT_MS );
+            } else {
+                iodwait();
+            }
+            __set_flags( flags );
+
+            _ior_poll();
+            _jnl_poll();
+            continue;
+        }
+
+        __set_flags( flags );
+
+        // this is the slow part
+        TRACE_EV( TRC_FS_ENTER, req->code, req->pcb->pid );
+        int32_t result = _iod_perform( req );
+        TRACE_EV( TRC_FS_EXIT, req->code, result );
+        _lat_record( _iod_lat(req->code), _clk_ns() - req->start );
+
+        // hand the result back, and let the caller run again
+        flags = __disable_ints();
+        RET(req->pcb) = result;
+        _schedule( req->pcb );
+        _km_cache_free( _iodreq_cache, req );
+        __set_flags( flags );
+    }
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** Name:  _iod_init
+**
+** Initializes the I/O daemon module
+**
+** Dependencies:
+**    Cannot be called before kmem and queues are initialized
+*/
+void _iod_init( void ) {
+
+    __cio_puts( " Iod:" );
+
+    _iodreq_cache = _km_cache_create( "iodreq", sizeof(iodreq_t), NULL );
+    assert( _iodreq_cache != NULL );
+
+    _iowait = _que_alloc( NULL );
+    assert( _iowait != NULL );
+
+    _iod_pcb = NULL;
+    _iod_requests = _iod_depth_max = 0;
+
+    __cio_puts( " done" );
+}
+
+/**
+** Name:  _iod_create
+**
+** Creates the I/O daemon process.  The caller is responsible for
+** scheduling it and entering it in the process table.
+**
+** @return the daemon's PCB, or NULL
+*/
+pcb_t *_iod_create( void ) {
+    uint32_t args[4];
+
+    args[0] = (uint32_t) _iod_main;   // entry point
+    args[1] = PRIO_STD;               // share the CPU with user code
+    args[2] = args[3] = 0;            // no command-line arguments
+
+    // the daemon is a child of init
+    _iod_pcb = _proc_create( args, _next_pid++, PID_INIT );
+
+    return( _iod_pcb );
+}
+
+/**
+** Name:  _iod_submit
+**
+** Hands a file system call from the current process to the daemon.
+** The caller is blocked and a new current process is dispatched;
+** the daemon places the call's return value in the caller's context
+** and reschedules it when the call is complete.
+**
+** @param code   The SYS_* code of the call
+** @param args   The call's arguments
+*/
+void _iod_submit( uint32_t code, uint32_t args[4] ) {
+
+    // the daemon must exist and must not be talking to itself
+    assert( _iod_pcb != NULL && _current != _iod_pcb );
+
+    iodreq_t *req = (iodreq_t *) _km_cache_alloc( _iodreq_cache );
+    if( req == NULL ) {
+        RET(_current) = E_NO_MEMORY;
+        return;
+    }
+
+    req->pcb = _current;
+    req->code = code;
+    req->args[0] = args[0];
+    req->args[1] = args[1];
+    req->args[2] = args[2];
+    req->args[3] = args[3];
+    req->start = _clk_ns();
+
+    if( _que_enque(_iowait,req,0) != E_SUCCESS ) {
+        _km_cache_free( _iodreq_cache, req );
+        RET(_current) = E_NO_QNODES;
+        return;
+    }
+
+    ++_iod_requests;
+    TRACE_EV( TRC_IOD_SUBMIT, code, 0 );
+    uint32_t depth = _que_length( _iowait );
+    if( depth > _iod_depth_max ) {
+        _iod_depth_max = depth;
+    }
+
+    // the caller waits for the daemon
+    _current->state = Blocked;
+
+    // if the daemon is napping or waiting for work, wake it up
+    if( _iod_pcb->state == Blocked ||
+            ( _iod_pcb->state == Sleeping &&
+              _clk_timer_cancel(&_iod_pcb->timer) ) ) {
+        _schedule( _iod_pcb );
+    }
+
+    _dispatch();
+}
+
+/**
+** Name:  _iod_wait
+**
+** Blocks the daemon until a call is submitted; the daemon uses this
+** when it has nothing to poll.  Any other caller gets E_BAD_SYSCALL.
+*/
+void _iod_wait( void ) {
+
+    if( _current != _iod_pcb ) {
+        RET(_current) = E_BAD_SYSCALL;
+        return;
+    }
+
+    RET(_current) = E_SUCCESS;
+    if( _que_length(_iowait) > 0 ) {
+        return;
+    }
+
+    // _iod_submit() puts us back on the ready queue
+    _current->state = Blocked;
+    _dispatch();
+}
+
+/**
+** Name:  _iod_stats
+**
+** Fills in the request queue part of a kstats_t
+**
+** @param ks   The statistics to fill in
+*/
+void _iod_stats( kstats_t *ks ) {
+
+    ks->io_requests = _iod_requests;
+    ks->io_depth = _que_length( _iowait );
+    ks->io_depth_max = _iod_depth_max;
+}
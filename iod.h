@@ -0,0 +1,90 @@
+/*
+** @file iod.h
+**
+** @author CSCI-452 class of 20205
+**
+** I/O daemon declarations
+*/
+
+#ifndef IOD_H_
+#define IOD_H_
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+#include "common.h"
+#include "kstats.h"
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+/*
+** Types
+*/
+
+/*
+** Globals
+*/
+
+/*
+** Prototypes
+*/
+
+/**
+** Name:  _iod_init
+**
+** Initializes the I/O daemon module
+**
+** Dependencies:
+**    Cannot be called before kmem and queues are initialized
+*/
+void _iod_init( void );
+
+/**
+** Name:  _iod_create
+**
+** Creates the I/O daemon process.  The caller is responsible for
+** scheduling it and entering it in the process table.
+**
+** @return the daemon's PCB, or NULL
+*/
+pcb_t *_iod_create( void );
+
+/**
+** Name:  _iod_submit
+**
+** Hands a file system call from the current process to the daemon.
+** The caller is blocked and a new current process is dispatched;
+** the daemon places the call's return value in the caller's context
+** and reschedules it when the call is complete.
+**
+** @param code   The SYS_* code of the call
+** @param args   The call's arguments
+*/
+void _iod_submit( uint32_t code, uint32_t args[4] );
+
+/**
+** Name:  _iod_wait
+**
+** Blocks the daemon until a call is submitted; the daemon uses this
+** when it has nothing to poll.  Any other caller gets E_BAD_SYSCALL.
+*/
+void _iod_wait( void );
+
+/**
+** Name:  _iod_stats
+**
+** Fills in the request queue part of a kstats_t
+**
+** @param ks   The statistics to fill in
+*/
+void _iod_stats( kstats_t *ks );
+
+#endif
+/* SP_ASM_SRC */
+
+#endif
@@ -0,0 +1,355 @@
+/**
+** @file ioring.c
+**
+** @author CSCI-452 class of 20205
+**
+** Submission/completion rings for file system I/O.
+**
+** Requests are taken from a ring's submission queue in order and handed
+** to the file manager; each one produces exactly one completion.  The
+** disk driver completes its commands before returning, so every request
+** submitted by _ior_enter() has been completed by the time it returns.
+** If the completion queue fills up, submission stops early and the rest
+** of the entries stay queued until the process reaps some completions.
+**
+** The I/O daemon drains rings with interrupts enabled, so a ring's owner
+** may exit while one of its entries is being carried out.  The ring is
+** in the owner's memory, so a registration is marked busy while it is
+** being drained, and an owner that exits then is left in the Killed
+** state for the daemon to finish off once the entry is done.
+*/
+
+#define	SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "ioring.h"
+#include "filemanager.h"
+#include "syscalls.h"
+#include "trace.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+// masks for turning free-running indices into slot numbers
+#define SQ_MASK   ( IORING_SQ_ENTRIES - 1 )
+#define CQ_MASK   ( IORING_CQ_ENTRIES - 1 )
+
+/*
+** PRIVATE DATA TYPES
+*/
+
+// a registered ring
+typedef struct ior_reg_s {
+    pcb_t *owner;       // process the ring belongs to, or NULL
+    ioring_t *ring;     // the ring, in that process' memory
+    uint32_t flags;     // IORING_* flags given at setup time
+    bool_t busy;        // the daemon is draining the ring
+    pcb_t *exiting;     // owner whose exit waits for the drain, or NULL
+} ior_reg_t;
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// registered rings; at most one per process
+static ior_reg_t _rings[N_PROCS];
+
+/*
+** PUBLIC GLOBAL VARIABLES
+*/
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/**
+** Name:  _ior_find
+**
+** Locates the registration for a process
+**
+** @param pcb   The process
+**
+** @return the registration, or NULL
+*/
+static ior_reg_t *_ior_find( pcb_t *pcb ) {
+
+    for( int i = 0; i < N_PROCS; ++i ) {
+        if( _rings[i].owner == pcb ) {
+            return( &_rings[i] );
+        }
+    }
+
+    return( NULL );
+}
+
+/**
+** Name:  _ior_perform
+**
+** Carries out a single request
+**
+** @param sqe   The submission queue entry
+**
+** @return the result to post in the completion
+*/
+static int32_t _ior_perform( ior_sqe_t *sqe ) {
+    iovec_t iov;
+
+    switch( sqe->op ) {
+
+    case IOR_NOP:
+        return( E_SUCCESS );
+
+    case IOR_READ:
+        iov.base = sqe->buf;
+        iov.len = sqe->len;
+        return( _fs_readv(sqe->name,&iov,1) );
+
+    case IOR_WRITE:
+        iov.base = sqe->buf;
+        iov.len = sqe->len;
+        return( _fs_writev(sqe->name,&iov,1) );
+
+    case IOR_READV:
+        return( _fs_readv(sqe->name,(iovec_t *) sqe->buf,sqe->len) );
+
+    case IOR_WRITEV:
+        return( _fs_writev(sqe->name,(iovec_t *) sqe->buf,sqe->len) );
+
+    case IOR_FSYNC:
+        return( _fs_sync(sqe->name) );
+
+    default:
+        return( E_BAD_PARAM );
+    }
+}
+
+/**
+** Name:  _ior_live
+**
+** Says whether a ring being drained still has its owner
+**
+** @param reg   The ring's registration
+**
+** @return true if the owner hasn't exited
+*/
+static bool_t _ior_live( ior_reg_t *reg ) {
+
+    unsigned int flags = __disable_ints();
+    bool_t live = reg->owner != NULL;
+    __set_flags( flags );
+
+    return( live );
+}
+
+/**
+** Name:  _ior_drain
+**
+** Takes entries from a ring's submission queue, performs them, and
+** posts their completions.  The ring is busy while this runs; if the
+** owner exits meanwhile, draining stops after the current entry and
+** the owner's exit is finished here.
+**
+** @param reg    The ring's registration
+** @param limit  Most entries to take
+**
+** @return the number of entries taken
+*/
+static int32_t _ior_drain( ior_reg_t *reg, uint32_t limit ) {
+    int32_t count = 0;
+
+    unsigned int flags = __disable_ints();
+    if( reg->owner == NULL ) {
+        __set_flags( flags );
+        return( 0 );
+    }
+    ioring_t *ring = reg->ring;
+    reg->busy = true;
+    __set_flags( flags );
+
+    // a process that scribbled on its indices gets nothing done
+    if( ring->sq_tail - ring->sq_head > IORING_SQ_ENTRIES ) {
+        count = E_BAD_PARAM;
+    }
+
+    while( count >= 0 && count < limit && _ior_live(reg)
+            && ring->sq_head != ring->sq_tail ) {
+
+        // stop if there is nowhere to put the completion
+        if( ring->cq_tail - ring->cq_head >= IORING_CQ_ENTRIES ) {
+            break;
+        }
+
+        ior_sqe_t *sqe = &ring->sq[ ring->sq_head & SQ_MASK ];
+        ior_cqe_t *cqe = &ring->cq[ ring->cq_tail & CQ_MASK ];
+
+        cqe->user_data = sqe->user_data;
+        TRACE_EV( TRC_IOR_ENTER, sqe->op, 0 );
+        cqe->result = _ior_perform( sqe );
+        TRACE_EV( TRC_IOR_EXIT, sqe->op, cqe->result );
+
+        // publish both index updates only once the entry is done
+        ring->sq_head += 1;
+        ring->cq_tail += 1;
+        ++count;
+    }
+
+    // the ring is no longer in use; finish any exit that waited for it
+    flags = __disable_ints();
+    reg->busy = false;
+    pcb_t *victim = reg->exiting;
+    if( victim != NULL ) {
+        reg->exiting = NULL;
+        reg->ring = NULL;
+        reg->flags = 0;
+        _force_exit( victim, victim->exit_status );
+    }
+    __set_flags( flags );
+
+    return( count );
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** Name:  _ior_init
+**
+** Initializes the ring module
+*/
+void _ior_init( void ) {
+
+    __cio_puts( " Ioring:" );
+
+    __memclr( _rings, sizeof(_rings) );
+
+    __cio_puts( " done" );
+}
+
+/**
+** Name:  _ior_setup
+**
+** Registers a ring for a process, replacing any earlier one
+**
+** @param pcb    The owning process
+** @param ring   The ring, in the process' memory
+** @param flags  IORING_* flags
+**
+** @return E_SUCCESS, or an error code
+*/
+int32_t _ior_setup( pcb_t *pcb, ioring_t *ring, uint32_t flags ) {
+
+    if( ring == NULL || (flags & ~IORING_SQPOLL) != 0 ) {
+        return( E_BAD_PARAM );
+    }
+
+    // re-use this process' slot, or find an empty one which the
+    // daemon isn't still draining
+    ior_reg_t *reg = _ior_find( pcb );
+    for( int i = 0; reg == NULL && i < N_PROCS; ++i ) {
+        if( _rings[i].owner == NULL && !_rings[i].busy ) {
+            reg = &_rings[i];
+        }
+    }
+
+    // one slot per possible process, so this "can't happen"
+    assert( reg != NULL );
+
+    // start the ring out empty
+    ring->sq_head = ring->sq_tail = 0;
+    ring->cq_head = ring->cq_tail = 0;
+    ring->flags = flags;
+
+    reg->owner = pcb;
+    reg->ring = ring;
+    reg->flags = flags;
+
+    return( E_SUCCESS );
+}
+
+/**
+** Name:  _ior_enter
+**
+** Submits queued requests from a process' ring
+**
+** @param pcb        The owning process
+** @param to_submit  Most entries to take from the submission queue
+**
+** @return the number of entries submitted, or an error code
+*/
+int32_t _ior_enter( pcb_t *pcb, uint32_t to_submit ) {
+
+    ior_reg_t *reg = _ior_find( pcb );
+    if( reg == NULL ) {
+        return( E_NOT_FOUND );
+    }
+
+    return( _ior_drain(reg,to_submit) );
+}
+
+/**
+** Name:  _ior_release
+**
+** Forgets the ring belonging to a process (if any).  Called with
+** interrupts disabled.
+**
+** @param pcb    The process
+**
+** @return true if the daemon is draining the ring; the process must
+**         not be freed, and the daemon will finish its exit
+*/
+bool_t _ior_release( pcb_t *pcb ) {
+
+    ior_reg_t *reg = _ior_find( pcb );
+    if( reg == NULL ) {
+        return( false );
+    }
+
+    reg->owner = NULL;
+    if( reg->busy ) {
+        reg->exiting = pcb;
+        return( true );
+    }
+
+    reg->ring = NULL;
+    reg->flags = 0;
+    return( false );
+}
+
+/**
+** Name:  _ior_polled
+**
+** Says whether any IORING_SQPOLL ring is registered
+**
+** @return true if the I/O daemon must keep polling
+*/
+bool_t _ior_polled( void ) {
+
+    for( int i = 0; i < N_PROCS; ++i ) {
+        if( _rings[i].owner != NULL &&
+                (_rings[i].flags & IORING_SQPOLL) != 0 ) {
+            return( true );
+        }
+    }
+
+    return( false );
+}
+
+/**
+** Name:  _ior_poll
+**
+** Drains a few entries from every IORING_SQPOLL ring; called by
+** the I/O daemon whenever it wakes up, which is at least every
+** IORING_POLL_TICKS ticks while _ior_polled() says so
+*/
+void _ior_poll( void ) {
+
+    for( int i = 0; i < N_PROCS; ++i ) {
+        if( _rings[i].owner != NULL &&
+                (_rings[i].flags & IORING_SQPOLL) != 0 ) {
+            (void) _ior_drain( &_rings[i], IORING_POLL_BATCH );
+        }
+    }
+}
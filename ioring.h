@@ -0,0 +1,162 @@
+/**
+** @file ioring.h
+**
+** @author CSCI-452 class of 20205
+**
+** Shared submission/completion rings for file system I/O.
+**
+** A process places an ioring_t in its own memory and registers it with
+** ioring_setup().  It then posts any number of requests on the
+** submission queue and hands them to the kernel with one ioring_enter()
+** call; results show up on the completion queue.  A ring registered
+** with IORING_SQPOLL is drained by the kernel on its own, so the
+** process need not trap at all.
+**
+** Both queues are single-producer, single-consumer.  The process owns
+** sq_tail and cq_head; the kernel owns sq_head and cq_tail.  Indices
+** run freely and are masked when used.
+*/
+
+#ifndef IORING_H_
+#define IORING_H_
+
+#include "common.h"
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+// queue sizes (must be powers of two)
+#define IORING_SQ_ENTRIES   16
+#define IORING_CQ_ENTRIES   32
+
+// ring flags
+#define IORING_SQPOLL       0x01    // kernel drains the queue by itself
+
+// ticks between kernel polls of IORING_SQPOLL rings
+#define IORING_POLL_TICKS   10
+
+// most entries the kernel poller handles per ring on each poll
+#define IORING_POLL_BATCH   4
+
+// request operation codes
+#define IOR_NOP         0   // complete immediately
+#define IOR_READ        1   // read the file into buf (at most len bytes)
+#define IOR_WRITE       2   // append len bytes from buf to the file
+#define IOR_READV       3   // buf is an iovec_t array, len is its count
+#define IOR_WRITEV      4   // buf is an iovec_t array, len is its count
+#define IOR_FSYNC       5   // write the file's i-node to the disk
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+/*
+** Types
+*/
+
+// a submission queue entry
+typedef struct ior_sqe_s {
+    uint8_t op;             // IOR_* operation code
+    uint8_t filler[3];
+    uint32_t user_data;     // copied untouched into the completion
+    char *name;             // file to operate on
+    void *buf;              // data buffer or iovec_t array
+    uint32_t len;           // byte count or iovec_t count
+} ior_sqe_t;
+
+// a completion queue entry
+typedef struct ior_cqe_s {
+    uint32_t user_data;     // from the submission
+    int32_t result;         // what the equivalent syscall would return
+} ior_cqe_t;
+
+// the ring itself
+typedef struct ioring_s {
+    volatile uint32_t sq_head;    // next entry the kernel will take
+    volatile uint32_t sq_tail;    // next entry the process will fill
+    volatile uint32_t cq_head;    // next completion the process will reap
+    volatile uint32_t cq_tail;    // next completion the kernel will post
+    uint32_t flags;               // IORING_* flags, set by ioring_setup()
+    ior_sqe_t sq[IORING_SQ_ENTRIES];
+    ior_cqe_t cq[IORING_CQ_ENTRIES];
+} ioring_t;
+
+#ifdef SP_KERNEL_SRC
+
+/*
+** Prototypes
+*/
+
+/**
+** Name:  _ior_init
+**
+** Initializes the ring module
+*/
+void _ior_init( void );
+
+/**
+** Name:  _ior_setup
+**
+** Registers a ring for a process, replacing any earlier one
+**
+** @param pcb    The owning process
+** @param ring   The ring, in the process' memory
+** @param flags  IORING_* flags
+**
+** @return E_SUCCESS, or an error code
+*/
+int32_t _ior_setup( pcb_t *pcb, ioring_t *ring, uint32_t flags );
+
+/**
+** Name:  _ior_enter
+**
+** Submits queued requests from a process' ring
+**
+** @param pcb        The owning process
+** @param to_submit  Most entries to take from the submission queue
+**
+** @return the number of entries submitted, or an error code
+*/
+int32_t _ior_enter( pcb_t *pcb, uint32_t to_submit );
+
+/**
+** Name:  _ior_release
+**
+** Forgets the ring belonging to a process (if any).  Called with
+** interrupts disabled.
+**
+** @param pcb    The process
+**
+** @return true if the daemon is draining the ring; the process must
+**         not be freed, and the daemon will finish its exit
+*/
+bool_t _ior_release( pcb_t *pcb );
+
+/**
+** Name:  _ior_polled
+**
+** Says whether any IORING_SQPOLL ring is registered
+**
+** @return true if the I/O daemon must keep polling
+*/
+bool_t _ior_polled( void );
+
+/**
+** Name:  _ior_poll
+**
+** Drains a few entries from every IORING_SQPOLL ring; called by
+** the I/O daemon whenever it wakes up, which is at least every
+** IORING_POLL_TICKS ticks while _ior_polled() says so
+*/
+void _ior_poll( void );
+
+#endif
+/* SP_KERNEL_SRC */
+
+#endif
+/* SP_ASM_SRC */
+
+#endif
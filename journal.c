@@ -0,0 +1,905 @@
+/**
+** @file journal.c
+**
+** @author CSCI-452 class of 20205
+**
+** Metadata journal implementation
+**
+** Every metadata block changed since the last checkpoint has an entry
+** in the cache, holding its newest contents, and found through a hash
+** table of chains running through the entries.  An entry is dirty if it
+** has changed in the running transaction, and logged if some committed
+** record holds a copy of it.  A commit copies the dirty entries behind
+** a descriptor in the staging buffer and writes them to the log with
+** one transfer; a checkpoint writes every entry home, in block order
+** with runs of neighbouring blocks written together, and then moves
+** the header's tail up to the head of the log.
+**
+** Two things are kept true after every commit, so neither can run out
+** part way through the next transaction:  the log has room for two
+** more of the largest records (one may be wasted by wrapping around),
+** and the cache has room for a transaction's worth of new entries.  A
+** commit that leaves less is followed by a checkpoint.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "journal.h"
+#include "block.h"
+#include "clock.h"
+#include "kmem.h"
+#include "kstats.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+/*
+** PRIVATE DATA TYPES
+*/
+
+// a metadata block which hasn't been checkpointed
+typedef struct jnl_entry_s {
+    blkno_t id;             // its home
+    char *data;             // its newest contents
+    uint32_t next;          // the next entry in its chain, plus one
+    bool_t dirty;           // changed in the running transaction
+    bool_t logged;          // a copy is in a committed record
+} jnl_entry_t;
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// whether the mounted file system is journaled
+static bool_t _active;
+
+// the block size and its log2
+static uint32_t _bsize;
+static uint32_t _shift;
+
+// the header block, and the number of log blocks following it
+static blkno_t _start;
+static uint32_t _len;
+
+// the header's id, and the sequence number of the next record
+static uint32_t _id;
+static uint64_t _seq;
+
+// where the next record goes, and the log blocks used (or skipped
+// over when wrapping) since the last checkpoint
+static uint32_t _head;
+static uint32_t _used;
+
+// the cache, its size, and the number of entries in use
+static jnl_entry_t *_cache;
+static char *_cache_data;
+static uint32_t _cache_max;
+static uint32_t _cache_count;
+
+// the heads of the hash chains (entry index plus one, or 0), and
+// log2 of how many there are
+static uint32_t *_hash;
+static uint32_t _hash_bits;
+
+// the running transaction:  its dirty entries and revoked blocks, the
+// most it may hold, and when its first change was made
+static uint32_t _num_dirty;
+static blkno_t _revoked[ JNL_TX_BLOCKS ];
+static uint32_t _num_revoked;
+static uint32_t _tx_max;
+static uint64_t _tx_start;
+
+// where records are put together, and read back at mount
+static char *_stage;
+
+// for kstats()
+static uint32_t _commits;
+static uint32_t _logged_blocks;
+static uint32_t _checkpoints;
+
+/*
+** PUBLIC GLOBAL VARIABLES
+*/
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/**
+** Name:  _jnl_pages
+**
+** Number of pages needed to hold some number of bytes
+**
+** @param bytes   The number of bytes
+**
+** @return The number of pages
+*/
+static uint32_t _jnl_pages( uint32_t bytes ) {
+    return( ( bytes + PAGE_SIZE - 1 ) / PAGE_SIZE );
+}
+
+/**
+** Name:  _jnl_sum
+**
+** Checksums a record (FNV-1a, a word at a time)
+**
+** @param buf     The record
+** @param bytes   Its length, a multiple of 4
+**
+** @return the checksum
+*/
+static uint32_t _jnl_sum( const char *buf, uint32_t bytes ) {
+    const uint32_t *w = (const uint32_t *) buf;
+    uint32_t h = 2166136261u;
+
+    for( uint32_t i = 0; i < bytes / 4; ++i ) {
+        h = ( h ^ w[i] ) * 16777619u;
+    }
+    return( h );
+}
+
+/**
+** Name:  _jnl_chain
+**
+** Finds the hash chain a block's entry is on
+**
+** @param id   The block
+**
+** @return the head of the chain
+*/
+static uint32_t *_jnl_chain( blkno_t id ) {
+    uint32_t h = (uint32_t) ( id ^ ( id >> 32 ) ) * 2654435761u;
+
+    return( &_hash[ h >> ( 32 - _hash_bits ) ] );
+}
+
+/**
+** Name:  _jnl_link
+**
+** Puts an entry on its hash chain
+**
+** @param i   The entry's index
+*/
+static void _jnl_link( uint32_t i ) {
+    uint32_t *head = _jnl_chain( _cache[i].id );
+
+    _cache[i].next = *head;
+    *head = i + 1;
+}
+
+/**
+** Name:  _jnl_unlink
+**
+** Takes an entry off its hash chain
+**
+** @param i   The entry's index
+*/
+static void _jnl_unlink( uint32_t i ) {
+    uint32_t *link = _jnl_chain( _cache[i].id );
+
+    while( *link != i + 1 ) {
+        link = &_cache[*link - 1].next;
+    }
+    *link = _cache[i].next;
+}
+
+/**
+** Name:  _jnl_rehash
+**
+** Rebuilds the hash chains after the entries have been moved around
+*/
+static void _jnl_rehash( void ) {
+
+    __memclr( _hash, sizeof( uint32_t ) << _hash_bits );
+    for( uint32_t i = 0; i < _cache_count; ++i ) {
+        _jnl_link( i );
+    }
+}
+
+/**
+** Name:  _jnl_find
+**
+** Finds a block's cache entry
+**
+** @param id   The block
+**
+** @return the entry, or NULL
+*/
+static jnl_entry_t *_jnl_find( blkno_t id ) {
+
+    if( _cache_count == 0 ) {
+        return( NULL );
+    }
+    for( uint32_t i = *_jnl_chain( id ); i != 0; i = _cache[i - 1].next ) {
+        if( _cache[i - 1].id == id ) {
+            return( &_cache[i - 1] );
+        }
+    }
+    return( NULL );
+}
+
+/**
+** Name:  _jnl_drop
+**
+** Removes an entry from the cache; the last entry takes its place
+**
+** @param e   The entry
+*/
+static void _jnl_drop( jnl_entry_t *e ) {
+    uint32_t i = e - _cache;
+    uint32_t last = _cache_count - 1;
+    jnl_entry_t tmp;
+
+    if( e->dirty ) {
+        --_num_dirty;
+    }
+    _jnl_unlink( i );
+    if( i != last ) {
+        _jnl_unlink( last );
+        tmp = *e;
+        *e = _cache[last];
+        _cache[last] = tmp;
+        _jnl_link( i );
+    }
+    --_cache_count;
+}
+
+/**
+** Name:  _jnl_add
+**
+** Makes a cache entry for a block
+**
+** @param id   The block
+**
+** @return the entry, which is neither dirty nor logged
+*/
+static jnl_entry_t *_jnl_add( blkno_t id ) {
+    jnl_entry_t *e = &_cache[_cache_count];
+
+    e->id = id;
+    e->dirty = false;
+    e->logged = false;
+    _jnl_link( _cache_count++ );
+    return( e );
+}
+
+/**
+** Name:  _jnl_forget
+**
+** Drops a freed block's entry, and revokes it if it has been logged
+**
+** @param e   The entry
+*/
+static void _jnl_forget( jnl_entry_t *e ) {
+    blkno_t home = e->id;
+    bool_t logged = e->logged;
+
+    _jnl_drop( e );
+    if( !logged ) {
+        return;
+    }
+
+    // a checkpoint after the commit leaves nothing to revoke
+    if( _num_dirty + _num_revoked >= _tx_max ) {
+        if( _jnl_commit() < 0 || _used == 0 ) {
+            return;
+        }
+    }
+    if( _num_dirty + _num_revoked == 0 ) {
+        _tx_start = _clk_ns();
+    }
+    _revoked[_num_revoked++] = home;
+}
+
+/**
+** Name:  _jnl_save_head
+**
+** Writes the header, with the tail at the head of the log
+**
+** @return 0 if successful, -1 if not
+*/
+static int _jnl_save_head( void ) {
+    jnl_head_t *head = (jnl_head_t *) _stage;
+
+    __memclr( _stage, _bsize );
+    head->magic = JNL_MAGIC;
+    head->id = _id;
+    head->seq = _seq;
+    head->tail = _head;
+    return( _blk_save_filecontents( _start, _stage, 1 ) );
+}
+
+/**
+** Name:  _jnl_home
+**
+** Writes every cache entry home, and empties the journal.  The running
+** transaction must be empty.
+**
+** @return 0 if successful, -1 if not
+*/
+static int _jnl_home( void ) {
+    uint32_t gap, i, j;
+
+    // Shell sort by block, so the writes go up the disk
+    for( gap = 1; gap < _cache_count / 3; gap = gap * 3 + 1 ) {
+        ;
+    }
+    for( ; gap > 0; gap /= 3 ) {
+        for( i = gap; i < _cache_count; ++i ) {
+            jnl_entry_t e = _cache[i];
+            for( j = i; j >= gap && _cache[j - gap].id > e.id; j -= gap ) {
+                _cache[j] = _cache[j - gap];
+            }
+            _cache[j] = e;
+        }
+    }
+    _jnl_rehash();
+
+    // one write for each run of neighbours that fits in the stage
+    for( i = 0; i < _cache_count; i = j ) {
+        for( j = i; j < _cache_count && j - i <= _tx_max &&
+                    _cache[j].id == _cache[i].id + ( j - i ); ++j ) {
+            __memcpy( _stage + ( ( j - i ) << _shift ), _cache[j].data,
+                      _bsize );
+        }
+        if( _blk_save_filecontents( _cache[i].id, _stage,
+                                    (int) ( j - i ) ) < 0 ) {
+            return( E_FAILURE );
+        }
+    }
+
+    // only now can the records go
+    if( _jnl_save_head() < 0 ) {
+        return( E_FAILURE );
+    }
+    _cache_count = 0;
+    _jnl_rehash();
+    _used = 0;
+    ++_checkpoints;
+    return( SUCCESS );
+}
+
+/**
+** Name:  _jnl_setup
+**
+** Sets up the in-memory state for a file system's journal
+**
+** @param sb   The file system's superblock
+**
+** @return 0 if successful, -1 if not
+*/
+static int _jnl_setup( const blk_super_t *sb ) {
+    uint32_t per_desc;
+
+    // anything from an earlier mount goes
+    if( _cache != NULL ) {
+        _km_page_free( _cache );
+        _cache = NULL;
+    }
+    if( _cache_data != NULL ) {
+        _km_page_free( _cache_data );
+        _cache_data = NULL;
+    }
+    if( _stage != NULL ) {
+        _km_page_free( _stage );
+        _stage = NULL;
+    }
+    if( _hash != NULL ) {
+        _km_page_free( _hash );
+        _hash = NULL;
+    }
+    _active = false;
+    _cache_count = _num_dirty = _num_revoked = 0;
+    _commits = _logged_blocks = _checkpoints = 0;
+    _head = _used = 0;
+
+    if( sb->journal_blocks == 0 ) {
+        return( SUCCESS );
+    }
+
+    _bsize = sb->block_size;
+    for( _shift = 0; ( 1u << _shift ) < _bsize; ++_shift ) {
+        ;
+    }
+    _start = sb->journal_start;
+    _len = (uint32_t) sb->journal_blocks - 1;
+
+    _cache_max = JNL_CACHE_BYTES >> _shift;
+    if( _cache_max < 8 ) {
+        _cache_max = 8;
+    }
+    per_desc = ( _bsize - sizeof( jnl_desc_t ) ) / sizeof( blkno_t );
+    _tx_max = JNL_TX_BLOCKS;
+    if( _tx_max > per_desc ) {
+        _tx_max = per_desc;
+    }
+    if( _tx_max > _cache_max / 2 ) {
+        _tx_max = _cache_max / 2;
+    }
+    if( _tx_max > _len / 4 ) {
+        _tx_max = _len / 4;
+    }
+
+    _cache = _km_page_alloc( _jnl_pages( _cache_max * sizeof( jnl_entry_t ) ) );
+    _cache_data = _km_page_alloc( _jnl_pages( _cache_max << _shift ) );
+    _stage = _km_page_alloc( _jnl_pages( ( _tx_max + 1 ) << _shift ) );
+    for( _hash_bits = 1; ( 1u << _hash_bits ) < _cache_max; ++_hash_bits ) {
+        ;
+    }
+    _hash = _km_page_alloc( _jnl_pages( sizeof( uint32_t ) << _hash_bits ) );
+    if( _cache == NULL || _cache_data == NULL || _stage == NULL ||
+        _hash == NULL ) {
+        __cio_puts( "Not enough memory for the journal\n" );
+        return( E_FAILURE );
+    }
+    for( uint32_t i = 0; i < _cache_max; ++i ) {
+        _cache[i].data = _cache_data + ( i << _shift );
+    }
+    _jnl_rehash();
+
+    return( SUCCESS );
+}
+
+/**
+** Name:  _jnl_read_record
+**
+** Reads the record at a place in the log into the staging buffer
+**
+** @param pos   Where it is, in log blocks
+**
+** @return the number of blocks in it, or 0 if there isn't a valid
+**         record with the expected sequence number there
+*/
+static uint32_t _jnl_read_record( uint32_t pos ) {
+    jnl_desc_t *desc = (jnl_desc_t *) _stage;
+    uint32_t blocks, sum;
+
+    if( pos >= _len ||
+        _blk_load_filecontents( _start + 1 + pos, _stage, 1 ) < 0 ) {
+        return( 0 );
+    }
+    if( desc->magic != JNL_MAGIC || desc->id != _id || desc->seq != _seq ||
+        desc->count > _tx_max ) {
+        return( 0 );
+    }
+
+    blocks = 1;
+    for( uint32_t i = 0; i < desc->count; ++i ) {
+        if( ( desc->ids[i] & JNL_REVOKE ) == 0 ) {
+            ++blocks;
+        }
+    }
+    if( pos + blocks > _len ) {
+        return( 0 );
+    }
+    if( blocks > 1 && _blk_load_filecontents( _start + 2 + pos,
+                          _stage + _bsize, (int) blocks - 1 ) < 0 ) {
+        return( 0 );
+    }
+
+    sum = desc->sum;
+    desc->sum = 0;
+    if( _jnl_sum( _stage, blocks << _shift ) != sum ) {
+        return( 0 );
+    }
+    return( blocks );
+}
+
+/**
+** Name:  _jnl_replay
+**
+** Replays the committed records, from the header's tail on, into the
+** cache, and writes them all home
+**
+** @return the number of records replayed, or -1 on failure
+*/
+static int32_t _jnl_replay( void ) {
+    jnl_head_t *head = (jnl_head_t *) _stage;
+    jnl_desc_t *desc = (jnl_desc_t *) _stage;
+    int32_t records = 0;
+    uint32_t blocks;
+
+    if( _blk_load_filecontents( _start, _stage, 1 ) < 0 ) {
+        return( E_FAILURE );
+    }
+    if( head->magic != JNL_MAGIC || head->tail > _len ) {
+        __cio_puts( "The journal header is bad\n" );
+        return( E_FAILURE );
+    }
+    _id = head->id;
+    _seq = head->seq;
+    _head = (uint32_t) head->tail;
+
+    for(;;) {
+
+        // a record that wouldn't fit before the end went at the start
+        blocks = _jnl_read_record( _head );
+        if( blocks == 0 && _head != 0 ) {
+            blocks = _jnl_read_record( 0 );
+            if( blocks != 0 ) {
+                _head = 0;
+            }
+        }
+        if( blocks == 0 ) {
+            break;
+        }
+
+        // if the cache can't take it all, what's there goes home and
+        // the record is read again
+        if( _cache_count + blocks - 1 > _cache_max ) {
+            if( _jnl_home() < 0 ) {
+                return( E_FAILURE );
+            }
+            continue;
+        }
+
+        // a record's revokes come before its blocks
+        char *data = _stage + _bsize;
+        for( uint32_t i = 0; i < desc->count; ++i ) {
+            if( desc->ids[i] & JNL_REVOKE ) {
+                jnl_entry_t *e = _jnl_find( desc->ids[i] & ~JNL_REVOKE );
+                if( e != NULL ) {
+                    _jnl_drop( e );
+                }
+            }
+        }
+        for( uint32_t i = 0; i < desc->count; ++i ) {
+            if( ( desc->ids[i] & JNL_REVOKE ) == 0 ) {
+                jnl_entry_t *e = _jnl_find( desc->ids[i] );
+                if( e == NULL ) {
+                    e = _jnl_add( desc->ids[i] );
+                }
+                __memcpy( e->data, data, _bsize );
+                data += _bsize;
+            }
+        }
+
+        _head += blocks;
+        ++_seq;
+        ++records;
+    }
+
+    if( records > 0 && _jnl_home() < 0 ) {
+        return( E_FAILURE );
+    }
+    return( records );
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** Name:  _jnl_mount
+**
+** Starts journaling for a file system being mounted, first replaying
+** and checkpointing what the journal holds.  File systems without a
+** journal are left unjournaled.
+**
+** @param sb   The file system's superblock
+**
+** @return 0 if successful, -1 if not
+*/
+int _jnl_mount( const blk_super_t *sb ) {
+    int32_t records;
+
+    if( _jnl_setup( sb ) < 0 ) {
+        return( E_FAILURE );
+    }
+    if( sb->journal_blocks == 0 ) {
+        return( SUCCESS );
+    }
+
+    records = _jnl_replay();
+    if( records < 0 ) {
+        return( E_FAILURE );
+    }
+    if( records > 0 ) {
+        __cio_printf( " journal replayed (%d transactions),", records );
+    }
+
+    _active = true;
+    return( SUCCESS );
+}
+
+/**
+** Name:  _jnl_format
+**
+** Writes an empty journal for a new file system, and starts journaling
+**
+** @param sb   The file system's superblock
+**
+** @return 0 if successful, -1 if not
+*/
+int _jnl_format( const blk_super_t *sb ) {
+
+    if( _jnl_setup( sb ) < 0 ) {
+        return( E_FAILURE );
+    }
+    if( sb->journal_blocks == 0 ) {
+        return( SUCCESS );
+    }
+
+    // a new id, so nothing left in the log by an earlier file system
+    // can pass for one of this one's records
+    _id = (uint32_t) ( _clk_ns() >> 10 ) ^ (uint32_t) sb->block_count;
+    _seq = 1;
+    if( _jnl_save_head() < 0 ) {
+        return( E_FAILURE );
+    }
+
+    _active = true;
+    return( SUCCESS );
+}
+
+/**
+** Name:  _jnl_active
+**
+** Says whether the mounted file system is journaled
+**
+** @return true if metadata blocks must be written with _jnl_write
+*/
+bool_t _jnl_active( void ) {
+    return( _active );
+}
+
+/**
+** Name:  _jnl_write
+**
+** Adds a metadata block to the running transaction.  If the
+** transaction is full it is committed first.
+**
+** @param id     The block's home
+** @param data   Its new contents (a whole block)
+**
+** @return 0 if successful, -1 if not
+*/
+int _jnl_write( blkno_t id, const char *data ) {
+    jnl_entry_t *e = _jnl_find( id );
+
+    if( e == NULL || !e->dirty ) {
+        if( _num_dirty + _num_revoked >= _tx_max ) {
+            if( _jnl_commit() < 0 ) {
+                return( E_FAILURE );
+            }
+            e = _jnl_find( id );    // it may have gone home
+        }
+        if( e == NULL ) {
+            e = _jnl_add( id );
+        }
+        if( _num_dirty + _num_revoked == 0 ) {
+            _tx_start = _clk_ns();
+        }
+        e->dirty = true;
+        ++_num_dirty;
+    }
+
+    __memcpy( e->data, (void *) data, _bsize );
+    return( SUCCESS );
+}
+
+/**
+** Name:  _jnl_revoke
+**
+** Forgets the logged copies of a run of blocks which have been freed,
+** so replaying the log can't write over whatever they are used for next
+**
+** @param id    The id of the first block
+** @param num   The number of blocks
+*/
+void _jnl_revoke( blkno_t id, uint32_t num ) {
+
+    if( !_active ) {
+        return;
+    }
+
+    // look each block up if there are fewer of them than entries
+    if( num < _cache_count ) {
+        for( uint32_t k = 0; k < num; ++k ) {
+            jnl_entry_t *e = _jnl_find( id + k );
+            if( e != NULL ) {
+                _jnl_forget( e );
+            }
+        }
+        return;
+    }
+
+    // the last entry moves into a dropped one's place, so that place
+    // is looked at again
+    uint32_t i = 0;
+    while( i < _cache_count ) {
+        if( _cache[i].id >= id && _cache[i].id - id < num ) {
+            _jnl_forget( &_cache[i] );
+        } else {
+            ++i;
+        }
+    }
+}
+
+/**
+** Name:  _jnl_lookup
+**
+** Finds the newest contents of a metadata block which hasn't been
+** checkpointed
+**
+** @param id    The block
+**
+** @return its contents, or NULL if the disk has them
+*/
+const char *_jnl_lookup( blkno_t id ) {
+    jnl_entry_t *e = _jnl_find( id );
+
+    return( e == NULL ? NULL : e->data );
+}
+
+/**
+** Name:  _jnl_overlay
+**
+** Brings a run of blocks just read from the disk up to date with any
+** of them which haven't been checkpointed
+**
+** @param id    The id of the first block
+** @param buf   What was read
+** @param num   The number of blocks
+*/
+void _jnl_overlay( blkno_t id, char *buf, uint32_t num ) {
+
+    if( num < _cache_count ) {
+        for( uint32_t k = 0; k < num; ++k ) {
+            jnl_entry_t *e = _jnl_find( id + k );
+            if( e != NULL ) {
+                __memcpy( buf + ( k << _shift ), e->data, _bsize );
+            }
+        }
+        return;
+    }
+
+    for( uint32_t i = 0; i < _cache_count; ++i ) {
+        jnl_entry_t *e = &_cache[i];
+        if( e->id >= id && e->id - id < num ) {
+            __memcpy( buf + ( (uint32_t) ( e->id - id ) << _shift ),
+                      e->data, _bsize );
+        }
+    }
+}
+
+/**
+** Name:  _jnl_pending
+**
+** Says whether a transaction is open
+**
+** @return true if _jnl_poll will have a commit to make
+*/
+bool_t _jnl_pending( void ) {
+    return( _num_dirty + _num_revoked > 0 );
+}
+
+/**
+** Name:  _jnl_poll
+**
+** Commits the running transaction if it is half full, or has been open
+** for JNL_COMMIT_MS.  Called between file system calls, so a call's
+** changes are split across transactions only if it changes more than
+** half a transaction's worth of blocks.
+**
+** @return 0 if successful, -1 if a commit failed
+*/
+int _jnl_poll( void ) {
+    uint32_t n = _num_dirty + _num_revoked;
+
+    if( n == 0 ) {
+        return( SUCCESS );
+    }
+    if( n >= _tx_max / 2 ||
+        _clk_ns() - _tx_start >= JNL_COMMIT_MS * 1000000ULL ) {
+        return( _jnl_commit() );
+    }
+    return( SUCCESS );
+}
+
+/**
+** Name:  _jnl_commit
+**
+** Commits the running transaction:  its revoked blocks and the blocks
+** it changed go to the log as one record, with one write.  The block
+** layer is then told that the blocks freed by it can be reused.
+**
+** @return 0 if successful, -1 if not
+*/
+int _jnl_commit( void ) {
+    jnl_desc_t *desc = (jnl_desc_t *) _stage;
+    uint32_t blocks = 1;
+    uint32_t n = 0;
+
+    if( !_active || _num_dirty + _num_revoked == 0 ) {
+        return( SUCCESS );
+    }
+
+    __memclr( _stage, _bsize );
+    desc->magic = JNL_MAGIC;
+    desc->id = _id;
+    desc->seq = _seq;
+    for( uint32_t i = 0; i < _num_revoked; ++i ) {
+        desc->ids[n++] = _revoked[i] | JNL_REVOKE;
+    }
+    for( uint32_t i = 0; i < _cache_count; ++i ) {
+        if( _cache[i].dirty ) {
+            desc->ids[n++] = _cache[i].id;
+            __memcpy( _stage + ( blocks << _shift ), _cache[i].data, _bsize );
+            ++blocks;
+        }
+    }
+    desc->count = n;
+    desc->sum = _jnl_sum( _stage, blocks << _shift );
+
+    // records don't wrap around the end of the log
+    if( _head + blocks > _len ) {
+        _used += _len - _head;
+        _head = 0;
+    }
+    if( _blk_save_filecontents( _start + 1 + _head, _stage,
+                                (int) blocks ) < 0 ) {
+        return( E_FAILURE );
+    }
+    _head += blocks;
+    _used += blocks;
+    ++_seq;
+    ++_commits;
+    _logged_blocks += blocks;
+
+    for( uint32_t i = 0; i < _cache_count; ++i ) {
+        if( _cache[i].dirty ) {
+            _cache[i].dirty = false;
+            _cache[i].logged = true;
+        }
+    }
+    _num_dirty = 0;
+    _num_revoked = 0;
+    _blk_committed();
+
+    // make sure the next transaction has room
+    if( _used + 2 * ( _tx_max + 1 ) > _len ||
+        _cache_count + _tx_max > _cache_max ) {
+        return( _jnl_home() );
+    }
+    return( SUCCESS );
+}
+
+/**
+** Name:  _jnl_checkpoint
+**
+** Commits the running transaction, then writes every logged block to
+** its home and empties the journal
+**
+** @return 0 if successful, -1 if not
+*/
+int _jnl_checkpoint( void ) {
+
+    if( !_active ) {
+        return( SUCCESS );
+    }
+    if( _jnl_commit() < 0 ) {
+        return( E_FAILURE );
+    }
+    if( _cache_count == 0 && _used == 0 ) {
+        return( SUCCESS );
+    }
+    return( _jnl_home() );
+}
+
+/**
+** Name:  _jnl_stats
+**
+** Fills in the journal part of a kstats_t
+**
+** @param ks   The statistics to fill in
+*/
+void _jnl_stats( kstats_t *ks ) {
+    ks->jnl_commits = _commits;
+    ks->jnl_blocks = _logged_blocks;
+    ks->jnl_checkpoints = _checkpoints;
+    ks->jnl_cached = _cache_count;
+}
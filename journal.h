@@ -0,0 +1,246 @@
+/*
+** @file journal.h
+**
+** @author CSCI-452 class of 20205
+**
+** Metadata journal declarations
+**
+** The file system's own blocks (the bitmap, the file table and the
+** i-nodes) are not written in place as they change.  Each changed
+** block is copied into the running transaction instead, and the
+** transaction is committed by writing all of its blocks, behind a
+** descriptor block naming where they belong, to the journal with one
+** sequential write.  Many file system calls' updates go into each
+** transaction.  The committed blocks are kept in memory, and are
+** written to their homes (checkpointed) only when the journal or that
+** memory is running out, or when asked; mounting a file system replays
+** whatever was committed but not checkpointed.  Each call's updates
+** therefore reach the disk all together or not at all.
+**
+** The journal is the blocks just after the file table:  a header block,
+** recording where the oldest record that hasn't been checkpointed is,
+** followed by a circular log of records.  A record is valid only if it
+** has the expected sequence number and its checksum covers all of it,
+** so a record torn by a crash is simply the end of the log.
+**
+** File contents are written in place, before the metadata naming them
+** is committed.  Blocks freed by a transaction aren't reused until it
+** is committed (see block.c), so a crash can't leave a file which
+** survives it with another file's data.
+*/
+
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include "common.h"
+
+#include "block.h"
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+// identifies the journal's header block and its records
+#define JNL_MAGIC       0x4c4e524a  // "JRNL"
+
+// journal size given to new file systems, in blocks; small disks get
+// less, and none at all if that would be under JNL_BLOCKS_MIN
+#ifndef JNL_BLOCKS
+#define JNL_BLOCKS      1024
+#endif
+#define JNL_BLOCKS_MIN  16
+
+// most blocks one transaction may change
+#ifndef JNL_TX_BLOCKS
+#define JNL_TX_BLOCKS   32
+#endif
+
+// memory for committed blocks which haven't been checkpointed
+#ifndef JNL_CACHE_BYTES
+#define JNL_CACHE_BYTES ( 1024 * 1024 )
+#endif
+
+// longest a transaction stays open before it is committed
+#ifndef JNL_COMMIT_MS
+#define JNL_COMMIT_MS   100
+#endif
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+/*
+** Types
+*/
+
+// the first block of the journal
+typedef struct jnl_head_s {
+    uint32_t magic;         // JNL_MAGIC
+    uint32_t id;            // chosen when the file system was formatted
+    uint64_t seq;           // sequence number of the record at tail
+    uint64_t tail;          // the oldest record to replay, in log blocks
+} jnl_head_t;
+
+/*
+** The descriptor at the start of each record.  Each id is the home of
+** one of the blocks following it, in order, or a block freed since it
+** was last logged (flagged with JNL_REVOKE), which has no copy in the
+** record and mustn't be replayed from earlier ones.  The checksum is
+** of the whole record, with the sum field 0.
+*/
+typedef struct jnl_desc_s {
+    uint32_t magic;         // JNL_MAGIC
+    uint32_t id;            // as in the header
+    uint64_t seq;           // one more than the previous record's
+    uint32_t count;         // number of ids
+    uint32_t sum;           // checksum
+    blkno_t ids[];
+} jnl_desc_t;
+
+#define JNL_REVOKE      ( (blkno_t) 1 << 63 )
+
+#ifdef SP_KERNEL_SRC
+
+/*
+** Globals
+*/
+
+/*
+** Prototypes
+*/
+
+/**
+** Name:  _jnl_mount
+**
+** Starts journaling for a file system being mounted, first replaying
+** and checkpointing what the journal holds.  File systems without a
+** journal are left unjournaled.
+**
+** @param sb   The file system's superblock
+**
+** @return 0 if successful, -1 if not
+*/
+int _jnl_mount( const blk_super_t *sb );
+
+/**
+** Name:  _jnl_format
+**
+** Writes an empty journal for a new file system, and starts journaling
+**
+** @param sb   The file system's superblock
+**
+** @return 0 if successful, -1 if not
+*/
+int _jnl_format( const blk_super_t *sb );
+
+/**
+** Name:  _jnl_active
+**
+** Says whether the mounted file system is journaled
+**
+** @return true if metadata blocks must be written with _jnl_write
+*/
+bool_t _jnl_active( void );
+
+/**
+** Name:  _jnl_write
+**
+** Adds a metadata block to the running transaction
+**
+** @param id     The block's home
+** @param data   Its new contents (a whole block)
+**
+** @return 0 if successful, -1 if not
+*/
+int _jnl_write( blkno_t id, const char *data );
+
+/**
+** Name:  _jnl_revoke
+**
+** Forgets the logged copies of a run of blocks which have been freed
+**
+** @param id    The id of the first block
+** @param num   The number of blocks
+*/
+void _jnl_revoke( blkno_t id, uint32_t num );
+
+/**
+** Name:  _jnl_lookup
+**
+** Finds the newest contents of a metadata block which hasn't been
+** checkpointed
+**
+** @param id    The block
+**
+** @return its contents, or NULL if the disk has them
+*/
+const char *_jnl_lookup( blkno_t id );
+
+/**
+** Name:  _jnl_overlay
+**
+** Brings a run of blocks just read from the disk up to date with any
+** of them which haven't been checkpointed
+**
+** @param id    The id of the first block
+** @param buf   What was read
+** @param num   The number of blocks
+*/
+void _jnl_overlay( blkno_t id, char *buf, uint32_t num );
+
+/**
+** Name:  _jnl_pending
+**
+** Says whether a transaction is open
+**
+** @return true if _jnl_poll will have a commit to make
+*/
+bool_t _jnl_pending( void );
+
+/**
+** Name:  _jnl_poll
+**
+** Commits the running transaction if it is half full, or has been open
+** for JNL_COMMIT_MS.  Called between file system calls.
+**
+** @return 0 if successful, -1 if a commit failed
+*/
+int _jnl_poll( void );
+
+/**
+** Name:  _jnl_commit
+**
+** Commits the running transaction
+**
+** @return 0 if successful, -1 if not
+*/
+int _jnl_commit( void );
+
+/**
+** Name:  _jnl_checkpoint
+**
+** Commits the running transaction, then writes every logged block to
+** its home and empties the journal
+**
+** @return 0 if successful, -1 if not
+*/
+int _jnl_checkpoint( void );
+
+/**
+** Name:  _jnl_stats
+**
+** Fills in the journal part of a kstats_t
+**
+** @param ks   The statistics to fill in
+*/
+void _jnl_stats( kstats_t *ks );
+
+#endif
+/* SP_KERNEL_SRC */
+
+#endif
+/* SP_ASM_SRC */
+
+#endif
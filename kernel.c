@@ -22,7 +22,13 @@
 #include "scheduler.h"
 #include "support.h"
 #include "ahci.h"
+#include "iobuf.h"
 #include "filemanager.h"
+#include "ioring.h"
+#include "iod.h"
+#include "lathist.h"
+#include "profile.h"
+#include "trace.h"
 
 // need init() and idle() addresses
 #include "users.h"
@@ -135,9 +141,15 @@ void _init( void ) {
     _sys_init();
     _sched_init();
     _clk_init();
+    _lat_init();
+    _prof_init();
+    _trc_init();
     _sio_init();
+    _iob_init();   // MUST BE BEFORE AHCI INIT
     _ahci_init();
     _fs_init(); // MUST BE AFTER AHCI INIT
+    _ior_init();
+    _iod_init();
 
     __cio_puts( "\nModule initialization complete.\n" );
     __cio_puts( "-------------------------------\n" );
@@ -165,6 +177,18 @@ void _init( void ) {
     _ptable[0] = pcb;
     _active_procs = 1;
 
+    /*
+    ** Create the I/O daemon, which does all file system work
+    */
+
+    pcb = _iod_create();
+    assert( pcb != NULL );
+
+    _schedule( pcb );
+
+    _ptable[1] = pcb;
+    _active_procs = 2;
+
     /*
     ** Turn on the SIO receiver (the transmitter will be turned
     ** on/off as characters are being sent)
@@ -218,7 +242,7 @@ void _shell( int ch ) {
             break;
 
         case 'q':  // dump the queues
-            _que_dump( "Sleep queue", _sleeping );
+            _clk_timer_dump( "Timers" );
             _que_dump( "Reading queue", _reading );
             _que_dump( "Ready queue 0", _ready[0] );
             _que_dump( "Ready queue 1", _ready[1] );
@@ -262,6 +262,31 @@ void __outl( int port, int value );
 */
 unsigned int __get_flags( void );
 
+/**
+** Name:	__set_flags
+**
+** Description:	Replace the processor flags
+**
+** @param flags  The new EFLAGS value
+*/
+void __set_flags( unsigned int flags );
+
+/**
+** Name:	__disable_ints
+**
+** Description:	Disable interrupts
+**
+** Used with __set_flags() to protect code that may run with
+** interrupts enabled:
+**
+**	unsigned int flags = __disable_ints();
+**	...
+**	__set_flags( flags );
+**
+** @return The EFLAGS register before interrupts were disabled
+*/
+unsigned int __disable_ints( void );
+
 /**
 ** Name:	__pause
 **
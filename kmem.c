@@ -14,33 +14,45 @@
 ** chunks of memory from the free pool.  The free pool is initialized
 ** using the memory map provided by the BIOS during the boot sequence,
 ** and contains a series of blocks which are multiples of 4K bytes and
-** which are aligned at 4K boundaries; they are held in the free list
-** in order by base address.
-**
-** The "page" allocator allows allocation of one or more 4K blocks
-** at a time.  Requests are made for a specific number of 4K pages;
-** the allocator locates the first free list entry that contains at
-** least the requested amount of space.  If that entry is the exact
-** size requested, it is unlinked and returned; otherwise, the entry
-** is split into a chunk of the requested size and the remainder.
-** The chunk is returned, and the remainder replaces the original
-** block in the free list.  On deallocation, the block is inserted
-** at the appropriate place in the free list, and physically adjacent
-** blocks are coalesced into single, larger blocks.  If a multi-page
-** block is allocated, it should be deallocated one page at a time,
-** because there is no record of the size of the original allocation -
-** all we know is that it is N*4K bytes in length, so it's up to the
-** requesting code to figure this out.
-**
-** The "slice" allocator operates by taking blocks from the "page"
-** allocator and splitting them into four 1K slices, which it then
-** manages.  Requests are made for slices one at a time.  If the free
-** list contains an available slice, it is unlinked and returned;
-** otherwise, a page is requested from the page allocator, split into
-** slices, and the slices are added to the free list, after which the
-** first one is returned.  The slice free list is a simple linked list
-** of these 1K blocks; because they are all the same size, no ordering
-** is done on the free list, and no coalescing is performed.
+** which are aligned at 4K boundaries.
+**
+** The "page" allocator is a binary buddy system.  Free memory is kept
+** as blocks of 2^k pages (0 <= k <= MAX_ORDER), each aligned on a
+** multiple of its own size, with one doubly-linked free list per order.
+** The page frame metadata records which blocks are free, so
+** the "buddy" of a block (the other half of the block of the next
+** larger order) can be checked in constant time.  A request for N
+** pages is rounded up to the next power of two; the smallest free
+** block at least that large is removed from its list and split in
+** half until it is the right size, and any pages beyond the N that
+** were asked for are immediately handed back.  On deallocation, the
+** range is broken into aligned power-of-two blocks, and each block is
+** merged with its buddy for as long as the buddy is also free.  Both
+** operations take O(log n) steps.
+**
+** Every page frame has a small metadata entry.  The first frame of a
+** free block records that the block is free and its order, which is
+** how buddies are recognized; the first frame of an allocation records
+** its length in pages.  This means a multi-page block is freed with a
+** single call, given only its address.
+**
+** Smaller objects come from "caches".  Each cache hands out objects
+** of a single size; it takes pages ("slabs") from the page allocator
+** as needed, carves each one into as many objects as will fit, and
+** keeps the unused objects on a free list.  Objects go back on the
+** free list when they are released, and slabs are never returned to
+** the page allocator.  A cache may have a constructor, which is run
+** on each object as it is handed out; otherwise, the object is
+** cleared.  Subsystems with objects of a fixed type create their own
+** caches; everything else uses the general-purpose size classes
+** (powers of two from 16 bytes to 2KB) through _km_alloc().
+**
+** The older "slice" interface is kept for code that wants 1K chunks;
+** it is simply the 1K size class.
+**
+** The I/O daemon calls in here from process context, with interrupts
+** enabled, so the public page and cache entry points disable
+** interrupts while they manipulate the free lists.
 **
 */
 
@@ -73,30 +85,73 @@
 #define P2B(x)   ((x) << LOG2_OF_PAGE_SIZE)
 #define B2P(x)   ((x) >> LOG2_OF_PAGE_SIZE)
 
+// page frame numbers <-> addresses
+
+#define PFN(addr)   (B2P((uint32_t) (addr)))
+#define PADDR(pfn)  ((void *) P2B((uint32_t) (pfn)))
+
+// largest buddy block is 2^MAX_ORDER pages (4MB)
+
+#define MAX_ORDER   10
+
+// most usable memory regions we will track during initialization
+
+#define N_REGIONS   32
+
+// object caches:  how many there can be, and the size classes
+
+#define N_CACHES        32
+
+#define LOG2_MIN_CLASS  4
+#define LOG2_MAX_CLASS  11
+#define N_CLASSES       (LOG2_MAX_CLASS - LOG2_MIN_CLASS + 1)
+
 /*
-** Name:    adjacent
-**
-** Arguments:   addresses of two blocks
-**
-** Description: Determines whether the second block immediately
-**      follows the first one.
+** PRIVATE DATA TYPES
 */
-#define adjacent(first,second)  \
-    ( (void *) (first) + P2B((first)->pages) == (void *) (second) )
 
 /*
-** PRIVATE DATA TYPES
+** A free object in a cache.
 */
 
+typedef struct freeobj_s {
+    struct freeobj_s *next;   // pointer to the next free object
+} Freeobj;
+
 /*
-** This structure keeps track of a single block of memory.  All blocks
-** are multiples of the base size (currently, 4KB).
+** An object cache.  The type is opaque outside this module.
 */
 
-typedef struct blkinfo_s {
-    uint32_t pages;           // length of this block, in pages
-    struct   blkinfo_s *next; // pointer to the next free block
-} Blockinfo;
+struct kmcache_s {
+    char *name;               // for _km_dump()
+    uint32_t size;            // object size, in bytes
+    void (*ctor)( void * );   // object constructor, or NULL
+    Freeobj *free;            // available objects
+    uint32_t slabs;           // pages taken from the page allocator
+    uint32_t in_use;          // objects currently allocated
+};
+
+/*
+** Metadata for one page frame.  Only the entry for the first frame of
+** a block is meaningful; the others are zero.
+*/
+
+typedef struct pageinfo_s {
+    uint32_t pages : 24;    // allocation length, in pages (if allocated)
+    uint32_t order : 6;     // block order (if free)
+    uint32_t free  : 1;     // first frame of a free block
+    uint32_t head  : 1;     // first frame of any block
+} Pageinfo;
+
+/*
+** A free block in the buddy system.  The header lives in the first
+** page of the block itself.
+*/
+
+typedef struct buddy_s {
+    struct buddy_s *next;   // next free block of this order
+    struct buddy_s *prev;   // previous free block of this order
+} Buddy;
 
 /*
 ** Memory region information returned by the BIOS
@@ -156,8 +211,34 @@ typedef struct memregion_s {
 */
 
 // freespace pools
-static Blockinfo *_free_pages;
-static Blockinfo *_free_slices;
+static Buddy *_free_pages[MAX_ORDER+1];
+
+// number of pages on those lists
+static uint32_t _pages_free;
+
+// object caches, and the general-purpose size classes among them
+static kmcache_t _caches[N_CACHES];
+static int _num_caches;
+static kmcache_t *_classes[N_CLASSES];
+
+static char *_class_names[N_CLASSES] = {
+    "size-16", "size-32", "size-64", "size-128",
+    "size-256", "size-512", "size-1K", "size-2K"
+};
+
+// page frame metadata, indexed by (pfn - _first_pfn)
+static Pageinfo *_frames;
+
+// range of page frames covered by _frames
+static uint32_t _first_pfn;
+static uint32_t _last_pfn;
+
+// usable regions found during initialization
+static struct region_s {
+    uint32_t base;
+    uint32_t length;
+} _regions[N_REGIONS];
+static int _num_regions;
 
 // initialization status
 static int _km_initialized = 0;
@@ -176,16 +257,211 @@ extern int _end;    // end of the BSS section - provided by the linker
 ** FREE LIST MANAGEMENT
 */
 
+/**
+** Name:    _frame
+**
+** Locate the metadata entry for a page frame
+**
+** @param pfn    The page frame number
+**
+** @return a pointer to the entry
+*/
+static Pageinfo *_frame( uint32_t pfn ) {
+    return( &_frames[ pfn - _first_pfn ] );
+}
+
+/**
+** Name:    _is_free
+**
+** Determine whether a block of the given order is on a free list
+**
+** @param pfn    First page frame of the block
+** @param order  Order of the block
+**
+** @return non-zero if the block is free
+*/
+static int _is_free( uint32_t pfn, int order ) {
+    Pageinfo *info;
+
+    if( pfn < _first_pfn || pfn + (1u << order) > _last_pfn ) {
+        return( 0 );
+    }
+
+    info = _frame( pfn );
+    return( info->free && info->order == order );
+}
+
+/**
+** Name:    _push_block
+**
+** Put a block on the free list for its order
+**
+** @param pfn    First page frame of the block
+** @param order  Order of the block
+*/
+static void _push_block( uint32_t pfn, int order ) {
+    Buddy *block = (Buddy *) PADDR(pfn);
+    Pageinfo *info = _frame( pfn );
+
+    block->prev = NULL;
+    block->next = _free_pages[order];
+    if( block->next != NULL ) {
+        block->next->prev = block;
+    }
+    _free_pages[order] = block;
+    _pages_free += 1u << order;
+
+    info->pages = 0;
+    info->order = order;
+    info->free = 1;
+    info->head = 1;
+}
+
+/**
+** Name:    _pull_block
+**
+** Take a block off the free list for its order
+**
+** @param pfn    First page frame of the block
+** @param order  Order of the block
+*/
+static void _pull_block( uint32_t pfn, int order ) {
+    Buddy *block = (Buddy *) PADDR(pfn);
+
+    if( block->prev != NULL ) {
+        block->prev->next = block->next;
+    } else {
+        _free_pages[order] = block->next;
+    }
+    if( block->next != NULL ) {
+        block->next->prev = block->prev;
+    }
+    _pages_free -= 1u << order;
+
+    *_frame( pfn ) = (Pageinfo) { 0 };
+}
+
+/**
+** Name:    _free_block
+**
+** Return an aligned block to the buddy system, merging it with its
+** buddy for as long as the buddy is also free
+**
+** @param pfn    First page frame of the block
+** @param order  Order of the block
+*/
+static void _free_block( uint32_t pfn, int order ) {
+
+    while( order < MAX_ORDER ) {
+        uint32_t buddy = pfn ^ (1u << order);
+
+        if( !_is_free(buddy,order) ) {
+            break;
+        }
+
+        // absorb the buddy; the merged block starts at the lower one
+        _pull_block( buddy, order );
+        pfn &= ~(1u << order);
+        ++order;
+    }
+
+    _push_block( pfn, order );
+}
+
+/**
+** Name:    _free_range
+**
+** Return a run of pages to the buddy system by breaking it into
+** the largest aligned power-of-two blocks it contains
+**
+** @param pfn    First page frame of the run
+** @param count  Length of the run, in pages
+*/
+static void _free_range( uint32_t pfn, uint32_t count ) {
+
+    while( count > 0 ) {
+        int order = 0;
+
+        while( order < MAX_ORDER && (pfn & (1u << order)) == 0 &&
+               (2u << order) <= count ) {
+            ++order;
+        }
+
+        _free_block( pfn, order );
+        pfn += 1u << order;
+        count -= 1u << order;
+    }
+}
+
+/**
+** Name:    _buddy_setup
+**
+** Size and allocate the page frame metadata, taking the space from
+** the first usable region large enough to hold it, then release
+** all the usable regions into the buddy system.
+*/
+static void _buddy_setup( void ) {
+    int i;
+
+    // find the range of page frames we must describe
+    _first_pfn = ~0u;
+    _last_pfn = 0;
+    for( i = 0; i < _num_regions; ++i ) {
+        uint32_t first = PFN(_regions[i].base);
+        uint32_t last = first + B2P(_regions[i].length);
+        if( first < _first_pfn ) {
+            _first_pfn = first;
+        }
+        if( last > _last_pfn ) {
+            _last_pfn = last;
+        }
+    }
+
+    // start on a boundary of the largest block size, so that
+    // every aligned block lies entirely within the table
+    _first_pfn &= ~((1u << MAX_ORDER) - 1);
+
+    uint32_t bytes = (_last_pfn - _first_pfn) * sizeof(Pageinfo);
+    uint32_t pages = B2P( bytes + PAGE_SIZE - 1 );
+
+    for( i = 0; i < _num_regions; ++i ) {
+        if( B2P(_regions[i].length) >= pages ) {
+            break;
+        }
+    }
+
+    // can't proceed without the metadata
+    assert( i < _num_regions );
+
+    _frames = (Pageinfo *) _regions[i].base;
+    _regions[i].base += P2B(pages);
+    _regions[i].length -= P2B(pages);
+    __memclr( _frames, bytes );
+
+    for( i = 0; i < _num_regions; ++i ) {
+        _free_range( PFN(_regions[i].base), B2P(_regions[i].length) );
+    }
+}
+
 /**
 ** Name:    _add_block
 **
-** Add a block to the free list
+** Remember a usable region for _buddy_setup()
 **
 ** @param base   Base address of the block
 ** @param length Block length, in bytes
 */
 static void _add_block( uint32_t base, uint32_t length ) {
-    Blockinfo *block;
+
+    // only want whole pages; round the base up to a 4K boundary
+    if( (base & 0xfff) != 0 ) {
+        uint32_t loss = PAGE_SIZE - (base & 0xfff);
+        if( length <= loss ) {
+            return;
+        }
+        base += loss;
+        length -= loss;
+    }
 
     // don't add it if it isn't at least 4K
     if( length < PAGE_SIZE ) {
@@ -198,57 +474,14 @@ static void _add_block( uint32_t base, uint32_t length ) {
         length &= 0xfffff000;
     }
 
-    // create the "block"
-
-    block = (Blockinfo *) base;
-    block->pages = B2P(length);
-    block->next = NULL;
-
-    /*
-    ** We maintain the free list in order by address, to simplify
-    ** coalescing adjacent free blocks.
-    **
-    ** Handle the easiest case first.
-    */
-
-    if( _free_pages == NULL ) {
-        _free_pages = block;
+    if( _num_regions >= N_REGIONS ) {
+        __cio_printf( " (region 0x%08x ignored)", base );
         return;
     }
 
-    /*
-    ** Unfortunately, it's not always that easy....
-    **
-    ** Find the correct insertion spot.
-    */
-
-    Blockinfo *prev, *curr;
-
-    prev = NULL;
-    curr = _free_pages;
-
-    while( curr && curr < block ) {
-        prev = curr;
-        curr = curr->next;
-    }
-
-    // the new block always points to its successor
-    block->next = curr;
-
-    /*
-    ** If prev is NULL, we're adding at the front; otherwise,
-    ** we're adding after some other entry (middle or end).
-    */
-
-    if( prev == NULL ) {
-        // sanity check - both pointers can't be NULL
-        assert( curr );
-        // add at the beginning
-        _free_pages = block;
-    } else {
-        // inserting in the middle or at the end
-        prev->next = block;
-    }
+    _regions[_num_regions].base = base;
+    _regions[_num_regions].length = length;
+    ++_num_regions;
 }
 
 /**
@@ -270,8 +503,12 @@ void _km_init( void ) {
     __cio_puts( " Kmem:" );
 
     // initially, nothing in the free lists
-    _free_slices = NULL;
-    _free_pages = NULL;
+    _num_caches = 0;
+    for( int i = 0; i <= MAX_ORDER; ++i ) {
+        _free_pages[i] = NULL;
+    }
+    _pages_free = 0;
+    _num_regions = 0;
 
     /*
     ** We ignore all memory below the end of our OS.  In theory,
@@ -380,9 +617,24 @@ void _km_init( void ) {
         _add_block( b32, l32 );
     }
 
+    // nothing usable?
+    if( _num_regions < 1 ) {
+        return;
+    }
+
+    // now that we know the extent of memory, build the free lists
+    _buddy_setup();
+
     // record the initialization
     _km_initialized = 1;
 
+    // finally, the general-purpose caches
+    for( int i = 0; i < N_CLASSES; ++i ) {
+        _classes[i] = _km_cache_create( _class_names[i],
+                                        1u << (i + LOG2_MIN_CLASS), NULL );
+        assert( _classes[i] != NULL );
+    }
+
     // announce that we have completed initialization
     __cio_puts( " done" );
 }
@@ -390,20 +642,39 @@ void _km_init( void ) {
 /**
 ** Name:    _km_dump
 **
-** Dump the current contents of the free list to the console
+** Dump the current contents of the free lists to the console
 */
 void _km_dump( void ) {
-    Blockinfo *block;
+    uint32_t total = 0;
+
+    __cio_printf( "&_free_pages=%08x  pfns 0x%05x-0x%05x\n",
+                  _free_pages, _first_pfn, _last_pfn );
 
-    __cio_printf( "&_free_pages=%08x\n", &_free_pages );
+    for( int i = 0; i <= MAX_ORDER; ++i ) {
+        uint32_t n = 0;
 
-    for( block = _free_pages; block != NULL; block = block->next ) {
-        __cio_printf(
-            "block @ 0x%08x 0x%08x pages (ends at 0x%08x) next @ 0x%08x\n",
-                block, block->pages, P2B(block->pages) + (uint32_t) block,
-                block->next );
+        for( Buddy *block = _free_pages[i]; block != NULL;
+                block = block->next ) {
+            ++n;
+        }
+
+        if( n == 0 ) {
+            continue;
+        }
+
+        __cio_printf( "order %2d (%4d pages): %d free, first @ 0x%08x\n",
+                      i, 1 << i, n, _free_pages[i] );
+        total += n << i;
     }
 
+    __cio_printf( "%d pages free\n", total );
+
+    for( int i = 0; i < _num_caches; ++i ) {
+        kmcache_t *cache = &_caches[i];
+        __cio_printf( "cache %-10s size %4d slabs %3d in use %4d\n",
+                      cache->name, cache->size, cache->slabs,
+                      cache->in_use );
+    }
 }
 
 /*
@@ -411,16 +682,17 @@ void _km_dump( void ) {
 */
 
 /**
-** Name:    _km_page_alloc
+** Name:    _page_alloc
 **
-** Allocate a page of memory from the free list.
+** Allocate pages from the buddy lists; interrupts must be disabled
 **
 ** @param count  Number of contiguous pages desired
 **
 ** @return a pointer to the beginning of the first allocated page,
 **         or NULL if no memory is available
 */
-void *_km_page_alloc( uint32_t count ) {
+static void *_page_alloc( uint32_t count ) {
+    int want, order;
 
     assert( _km_initialized );
 
@@ -429,220 +701,332 @@ void *_km_page_alloc( uint32_t count ) {
         return( NULL );
     }
 
-    /*
-    ** Look for the first entry that is large enough.
-    */
+    // round the request up to a power of two
+    for( want = 0; (1u << want) < count; ++want ) {
+        if( want == MAX_ORDER ) {
+            return( NULL );
+        }
+    }
+
+    // find the smallest free block that is big enough
+    for( order = want; order <= MAX_ORDER; ++order ) {
+        if( _free_pages[order] != NULL ) {
+            break;
+        }
+    }
 
-    // pointer to the current block
-    Blockinfo *block = _free_pages;
+    if( order > MAX_ORDER ) {
+        return( NULL );
+    }
 
-    // pointer to where the pointer to the current block is
-    Blockinfo **pointer = &_free_pages;
+    uint32_t pfn = PFN( _free_pages[order] );
+    _pull_block( pfn, order );
 
-    while( block != NULL && block->pages < count ){
-        pointer = &block->next;
-        block = *pointer;
+    // split it until it's the size we want; the upper halves go back
+    while( order > want ) {
+        --order;
+        _push_block( pfn + (1u << order), order );
     }
 
-    // did we find a big enough block?
-    if( block == NULL ){
-        // nope!
-        return( NULL );
+    // give back any pages beyond those requested
+    if( (1u << want) > count ) {
+        _free_range( pfn + count, (1u << want) - count );
     }
 
-    // found one!  check the length
+    // remember how much we handed out
+    Pageinfo *info = _frame( pfn );
+    info->pages = count;
+    info->head = 1;
 
-    if( block->pages == count ) {
+    return( PADDR(pfn) );
+}
 
-        // exactly the right size - unlink it from the list
+/**
+** Name:    _page_free
+**
+** Return a block to the buddy lists; interrupts must be disabled
+**
+** @param block   Pointer to the first page of the block
+*/
+static void _page_free( void *block ){
+    Pageinfo *info;
+    uint32_t pfn, count;
 
-        *pointer = block->next;
+    assert( _km_initialized );
 
-    } else {
+    /*
+    ** Don't do anything if the address is NULL.
+    */
+    if( block == NULL ){
+        return;
+    }
 
-        // bigger than we need - carve the amount we need off
-        // the beginning of this block
+    pfn = PFN( block );
 
-        // remember where this chunk begins
-        Blockinfo *chunk = block;
+    // must be the start of a block we handed out
+    assert( ((uint32_t) block & 0xfff) == 0 );
+    assert( pfn >= _first_pfn && pfn < _last_pfn );
 
-        // how much space will be left over?
-        int excess = block->pages - count;
+    info = _frame( pfn );
+    assert( info->head && !info->free );
 
-        // find the start of the new fragment
-        Blockinfo *fragment = (Blockinfo *) ( (uint8_t *) block + P2B(count) );
+    count = info->pages;
+    *info = (Pageinfo) { 0 };
 
-        // set the length and link for the new fragment
-        fragment->pages = excess;
-        fragment->next  = block->next;
+    _free_range( pfn, count );
+}
 
-        // replace this chunk with the fragment
-        *pointer = fragment;
+/**
+** Name:    _km_page_alloc
+**
+** Allocate a page of memory from the free list.
+**
+** @param count  Number of contiguous pages desired
+**
+** @return a pointer to the beginning of the first allocated page,
+**         or NULL if no memory is available
+*/
+void *_km_page_alloc( uint32_t count ) {
+    unsigned int flags = __disable_ints();
 
-        // return this chunk
-        block = chunk;
-    }
+    void *block = _page_alloc( count );
 
+    __set_flags( flags );
     return( block );
 }
 
 /**
 ** Name:    _km_page_free
 **
-** Returns a memory block to the list of available blocks,
-** combining it with adjacent blocks if they're present.
-**
-** CRITICAL ASSUMPTION:  multi-page blocks will be freed one page
-** at a time!
+** Returns a block obtained from _km_page_alloc() to the free pool,
+** combining it with its buddies where possible.  All the pages in
+** the block are released.
 **
-** @param block   Pointer to the page to be returned to the free list
+** @param block   Pointer to the first page of the block
 */
 void _km_page_free( void *block ){
-    Blockinfo *used;
-    Blockinfo *prev;
-    Blockinfo *curr;
+    unsigned int flags = __disable_ints();
+
+    _page_free( block );
+
+    __set_flags( flags );
+}
+
+/**
+** Name:    _km_pages_free
+**
+** Number of pages currently available from the free pool
+**
+** @return the page count
+*/
+uint32_t _km_pages_free( void ) {
+    return( _pages_free );
+}
+
+/*
+** OBJECT CACHES
+*/
+
+/**
+** Name:    _km_cache_create
+**
+** Create a cache of objects of a single size
+**
+** @param name   Name of the cache (used by _km_dump)
+** @param size   Size of each object, in bytes (at most one page)
+** @param ctor   Routine to initialize each object as it is allocated,
+**               or NULL to have the object cleared instead
+**
+** @return a pointer to the new cache, or NULL
+*/
+kmcache_t *_km_cache_create( char *name, uint32_t size,
+                             void (*ctor)( void * ) ) {
+    kmcache_t *cache;
 
     assert( _km_initialized );
 
-    /*
-    ** Don't do anything if the address is NULL.
-    */
-    if( block == NULL ){
-        return;
+    if( size < 1 || size > PAGE_SIZE || _num_caches >= N_CACHES ) {
+        return( NULL );
     }
 
-    used = (Blockinfo *) block;
+    // every object must be able to hold a free list link,
+    // and should be word-aligned
+    if( size < sizeof(Freeobj) ) {
+        size = sizeof(Freeobj);
+    }
+    size = (size + WORD_SIZE - 1) & ~(WORD_SIZE - 1);
 
-    /*
-    ** CRITICAL ASSUMPTION
-    **
-    ** We assume that any multi-page block that is being freed will
-    ** be freed one page at a time.  We make this assumption because we
-    ** don't track allocation sizes.  We can't use the simple "allocate
-    ** four extra bytes before the returned pointer" scheme to do this
-    ** because we're managing pages, and the pointers we return must point
-    ** to page boundaries, so we would wind up allocating an extra page
-    ** for each allocation.
-    **
-    ** Alternatively, we could keep an array of addresses and block
-    ** sizes ourselves, but that feels clunky, and would risk running out
-    ** of table entries if there are lots of allocations (assuming we use
-    ** a 4KB page to hold the table, at eight bytes per entry we would have
-    ** 512 entries per page).
-    **
-    ** IF THIS ASSUMPTION CHANGES, THIS CODE MUST BE FIXED!!!
-    */
+    cache = &_caches[_num_caches++];
+    cache->name = name;
+    cache->size = size;
+    cache->ctor = ctor;
+    cache->free = NULL;
+    cache->slabs = 0;
+    cache->in_use = 0;
 
-    used->pages = 1;
+    return( cache );
+}
 
-    /*
-    ** Advance through the list until current and previous
-    ** straddle the place where the new block should be inserted.
-    */
-    prev = NULL;
-    curr = _free_pages;
+/**
+** Name:    _cache_grow
+**
+** Add another slab's worth of objects to a cache
+**
+** @param cache  The cache to be expanded
+**
+** @return true on success, else false
+*/
+static bool_t _cache_grow( kmcache_t *cache ) {
+    uint8_t *slab = (uint8_t *) _page_alloc( 1 );
 
-    while( curr != NULL && curr < used ){
-        prev = curr;
-        curr = curr->next;
+    if( slab == NULL ) {
+        return( false );
     }
 
-    /*
-    ** At this point, we have the following list structure:
-    **
-    **   ....    BLOCK       BLOCK      ....
-    **          (*prev)  ^  (*curr)
-    **                   |
-    **                "used" goes here
-    **
-    ** We may need to merge the inserted block with either its
-    ** predecessor or its successor (or both).
-    */
+    // N.B.:  if the page size is not an integral multiple of the
+    // object size, this leaves a small fragment at the end of the slab
+    for( uint32_t off = 0; off + cache->size <= PAGE_SIZE;
+            off += cache->size ) {
+        Freeobj *obj = (Freeobj *) (slab + off);
+        obj->next = cache->free;
+        cache->free = obj;
+    }
 
-    /*
-    ** If this is not the first block in the resulting list,
-    ** we may need to merge it with its predecessor.
-    */
-    if( prev != NULL ){
+    ++cache->slabs;
 
-        // There is a predecessor.  Check to see if we need to merge.
-        if( adjacent( prev, used ) ){
+    return( true );
+}
 
-            // yes - merge them
-            prev->pages += used->pages;
+/**
+** Name:    _km_cache_alloc
+**
+** Allocate an object from a cache
+**
+** @param cache  The cache to allocate from
+**
+** @return a pointer to the object, or NULL if no memory is available
+*/
+void *_km_cache_alloc( kmcache_t *cache ) {
+    Freeobj *obj;
 
-            // the predecessor becomes the "newly inserted" block,
-            // because we still need to check to see if we should
-            // merge with the successor
-            used = prev;
+    assert1( cache != NULL );
 
-        } else {
+    unsigned int flags = __disable_ints();
 
-            // Not adjacent - just insert the new block
-            // between the predecessor and the successor.
-            used->next = prev->next;
-            prev->next = used;
+    if( cache->free == NULL && !_cache_grow(cache) ) {
+        __set_flags( flags );
+        return( NULL );
+    }
 
-        }
+    obj = cache->free;
+    cache->free = obj->next;
+    ++cache->in_use;
 
+    __set_flags( flags );
+
+    // make it nice and shiny for the caller
+    if( cache->ctor != NULL ) {
+        cache->ctor( obj );
     } else {
+        __memclr( obj, cache->size );
+    }
+
+    return( obj );
+}
+
+/**
+** Name:    _km_cache_free
+**
+** Return an object to its cache
+**
+** @param cache  The cache the object came from
+** @param ptr    The object
+*/
+void _km_cache_free( kmcache_t *cache, void *ptr ) {
+    Freeobj *obj = (Freeobj *) ptr;
 
-        // Yes, it is first.  Update the list pointer to insert it.
-        used->next = _free_pages;
-        _free_pages = used;
+    assert1( cache != NULL );
 
+    if( obj == NULL ) {
+        return;
     }
 
-    /*
-    ** If this is not the last block in the resulting list,
-    ** we may (also) need to merge it with its successor.
-    */
-    if( curr != NULL ){
+    assert( cache->in_use > 0 );
+
+    unsigned int flags = __disable_ints();
 
-        // No.  Check to see if it should be merged with the successor.
-        if( adjacent( used, curr ) ){
+    obj->next = cache->free;
+    cache->free = obj;
+    --cache->in_use;
+
+    __set_flags( flags );
+}
+
+/**
+** Name:    _size_class
+**
+** Find the general-purpose cache for objects of a given size
+**
+** @param size  Object size, in bytes
+**
+** @return the cache, or NULL if the size is out of range
+*/
+static kmcache_t *_size_class( uint32_t size ) {
+    int i;
 
-            // Yes, combine them.
-            used->next = curr->next;
-            used->pages += curr->pages;
+    if( size < 1 ) {
+        return( NULL );
+    }
 
+    for( i = 0; i < N_CLASSES; ++i ) {
+        if( size <= (1u << (i + LOG2_MIN_CLASS)) ) {
+            return( _classes[i] );
         }
     }
+
+    return( NULL );
 }
 
-/*
-** SLICE MANAGEMENT
+/**
+** Name:    _km_alloc
+**
+** Allocate a cleared object from the smallest size class that will
+** hold it
+**
+** @param size  Size of the object, in bytes (at most 2KB)
+**
+** @return a pointer to the object, or NULL
 */
+void *_km_alloc( uint32_t size ) {
+    kmcache_t *cache = _size_class( size );
 
-/*
-** Slices are 1024-byte fragments from pages.  We maintain a free list of
-** slices for those parts of the OS which don't need full 4096-byte chunks
-** of space (e.g., the QNode and Queue allocators).
-*/
+    if( cache == NULL ) {
+        return( NULL );
+    }
+
+    return( _km_cache_alloc(cache) );
+}
 
 /**
-** Name:        _carve_slices
+** Name:    _km_free
+**
+** Return an object obtained from _km_alloc()
 **
-** Allocate a page and split it into four slices;  If no
-**              memory is available, we panic.
+** @param ptr   The object
+** @param size  The size that was passed to _km_alloc()
 */
-static void _carve_slices( void ) {
-    void *page;
+void _km_free( void *ptr, uint32_t size ) {
+    kmcache_t *cache = _size_class( size );
 
-    // get a page
-    page = _km_page_alloc( 1 );
+    assert1( cache != NULL );
 
-    // allocation failure is a show-stopping problem
-    assert( page );
-
-    // we have the page; create the four slices from it
-    uint8_t *ptr = (uint8_t *) page;
-    for( int i = 0; i < 4; ++i ) {
-        _km_slice_free( (void *) ptr );
-        ptr += SLICE_SIZE;
-    }
+    _km_cache_free( cache, ptr );
 }
 
+/*
+** SLICE MANAGEMENT
+*/
+
 /**
 ** Name:        _km_slice_alloc
 **
@@ -652,24 +1036,14 @@ static void _carve_slices( void ) {
 ** @return a pointer to the allocated slice
 */
 void *_km_slice_alloc( void ) {
-    Blockinfo *slice;
+    void *slice;
 
     assert( _km_initialized );
 
-    // if we are out of slices, create a few more
-    if( _free_slices == NULL ) {
-        _carve_slices();
-    }
-
-    // take the first one from the free list
-    slice = _free_slices;
-    assert( slice);
-
-    // unlink it
-    _free_slices = slice->next;
+    slice = _km_alloc( SLICE_SIZE );
 
-    // make it nice and shiny for the caller
-    __memclr( (void *) slice, SLICE_SIZE );
+    // allocation failure is a show-stopping problem
+    assert( slice );
 
     return( slice );
 }
@@ -679,18 +1053,8 @@ void *_km_slice_alloc( void ) {
 **
 ** Returns a slice to the list of available slices.
 **
-** We make no attempt to merge slices, as they are independent
-** blocks of memory (unlike pages).
-**
 ** @param block  Pointer to the slice (1/4 page) to be freed
 */
 void _km_slice_free( void *block ) {
-    Blockinfo *slice = (Blockinfo *) block;
-
-    assert( _km_initialized );
-
-    // just add it to the front of the free list
-    slice->pages = SLICE_SIZE;
-    slice->next = _free_slices;
-    _free_slices = slice;
+    _km_free( block, SLICE_SIZE );
 }
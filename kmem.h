@@ -8,14 +8,14 @@
 ** Structures and functions to support dynamic memory
 ** allocation within the OS.
 **
-**      The list of free blocks is ordered by address to facilitate
-**      combining freed blocks with adjacent blocks that are already
-**      free.
-**
-**      All requests for memory are satisfied with blocks that are
-**      an integral number of 4-byte words.  More memory may be
-**      provided than was requested if the fragment left over after
-**      the allocation would not be large enough to be useable.
+**      Pages are managed by a binary buddy allocator, so freed
+**      blocks are combined with their free buddies to form larger
+**      blocks.
+**
+**      Page requests are satisfied with exactly the number of
+**      pages asked for.  Smaller objects come from caches of
+**      fixed-size objects, either created for a specific type or
+**      one of the general-purpose size classes (16 bytes to 2KB).
 */
 
 #ifndef KMEM_H_
@@ -38,6 +38,10 @@
 
 #define PAGE_SIZE   SLAB_SIZE
 
+// Largest object _km_alloc() will hand out, in bytes
+
+#define KM_ALLOC_MAX    2048
+
 #ifndef SP_ASM_SRC
 
 /*
@@ -48,6 +52,9 @@
 ** Types
 */
 
+// a cache of fixed-size objects
+typedef struct kmcache_s kmcache_t;
+
 /*
 ** Globals
 */
@@ -94,16 +101,85 @@ void *_km_page_alloc( uint32_t count );
 /**
 ** Name:    _km_page_free
 **
-** Returns a memory block to the list of available blocks,
-** combining it with adjacent blocks if they're present.
-**
-** CRITICAL ASSUMPTION:  multi-page blocks will be freed one page
-** at a time!
+** Returns a block obtained from _km_page_alloc() to the free pool,
+** combining it with its buddies where possible.  All the pages in
+** the block are released.
 **
-** @param block   Pointer to the page to be returned to the free list
+** @param block   Pointer to the first page of the block
 */
 void _km_page_free( void *block );
 
+/**
+** Name:    _km_pages_free
+**
+** Number of pages currently available from the free pool
+**
+** @return the page count
+*/
+uint32_t _km_pages_free( void );
+
+/*
+** Functions that manage object caches.
+*/
+
+/**
+** Name:    _km_cache_create
+**
+** Create a cache of objects of a single size
+**
+** @param name   Name of the cache (used by _km_dump)
+** @param size   Size of each object, in bytes (at most one page)
+** @param ctor   Routine to initialize each object as it is allocated,
+**               or NULL to have the object cleared instead
+**
+** @return a pointer to the new cache, or NULL
+*/
+kmcache_t *_km_cache_create( char *name, uint32_t size,
+                             void (*ctor)( void * ) );
+
+/**
+** Name:    _km_cache_alloc
+**
+** Allocate an object from a cache
+**
+** @param cache  The cache to allocate from
+**
+** @return a pointer to the object, or NULL if no memory is available
+*/
+void *_km_cache_alloc( kmcache_t *cache );
+
+/**
+** Name:    _km_cache_free
+**
+** Return an object to its cache
+**
+** @param cache  The cache the object came from
+** @param ptr    The object
+*/
+void _km_cache_free( kmcache_t *cache, void *ptr );
+
+/**
+** Name:    _km_alloc
+**
+** Allocate a cleared object from the smallest size class that will
+** hold it
+**
+** @param size  Size of the object, in bytes (at most 2KB)
+**
+** @return a pointer to the object, or NULL
+*/
+void *_km_alloc( uint32_t size );
+
+/**
+** Name:    _km_free
+**
+** Return an object obtained from _km_alloc()
+**
+** @param ptr   The object
+** @param size  The size that was passed to _km_alloc()
+*/
+void _km_free( void *ptr, uint32_t size );
+
 /**
 ** Name:    _km_slice_alloc
 **
@@ -119,9 +195,6 @@ void *_km_slice_alloc( void );
 **
 ** Returns a slice to the list of available slices.
 **
-** We make no attempt to merge slices, as they are independent
-** blocks of memory (unlike pages).
-**
 ** @param block  Pointer to the slice (1/4 page) to be freed
 */
 void _km_slice_free( void *block );
@@ -0,0 +1,89 @@
+/*
+** @file kstats.h
+**
+** @author CSCI-452 class of 20205
+**
+** Kernel statistics declarations
+**
+** Each module keeps its own counters as plain variables, updated in
+** line with the work being counted, so they cost next to nothing to
+** maintain.  The kstats() system call gathers them into a kstats_t,
+** along with gauges (free blocks, free pages, open files, etc.) which
+** are computed at the time of the call.
+*/
+
+#ifndef KSTATS_H_
+#define KSTATS_H_
+
+#include "common.h"
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+// most devices reported on
+#define KS_MAX_DEVICES      8
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+/*
+** Types
+*/
+
+// traffic to one disk device
+typedef struct ksdev_s {
+    uint32_t reads;             // read commands issued
+    uint32_t writes;            // write commands issued
+    uint32_t errors;            // commands which failed
+    uint64_t read_bytes;        // bytes read
+    uint64_t write_bytes;       // bytes written
+} ksdev_t;
+
+// everything kstats() reports
+typedef struct kstats_s {
+    // disk devices
+    uint32_t num_devices;       // devices holding blocks
+    ksdev_t dev[KS_MAX_DEVICES];
+
+    // I/O daemon request queue
+    uint32_t io_requests;       // requests submitted
+    uint32_t io_depth;          // requests waiting right now
+    uint32_t io_depth_max;      // most ever waiting at once
+
+    // I/O buffer pool
+    uint32_t iob_total;         // buffers in the pool
+    uint32_t iob_used;          // buffers in use right now
+    uint32_t iob_gets;          // buffers handed out
+    uint32_t iob_misses;        // requests made while the pool was empty
+
+    // block allocator
+    uint64_t blk_total;         // blocks on all devices
+    uint64_t blk_free;          // blocks not allocated
+    uint32_t blk_extents;       // runs of free blocks
+    uint32_t blk_largest;       // longest run of free blocks
+    uint32_t blk_allocs;        // successful allocations
+    uint32_t blk_alloc_fails;   // allocations which found no room
+    uint32_t blk_frees;         // blocks freed
+
+    // metadata journal
+    uint32_t jnl_commits;       // transactions committed
+    uint32_t jnl_blocks;        // blocks written to the log
+    uint32_t jnl_checkpoints;   // times the log was emptied
+    uint32_t jnl_cached;        // blocks waiting for a checkpoint
+
+    // files
+    uint32_t files;             // files in the name map
+    uint32_t open_files;        // files open right now
+
+    // memory
+    uint32_t pages_free;        // pages in the kmem free pool
+} kstats_t;
+
+#endif
+/* SP_ASM_SRC */
+
+#endif
@@ -0,0 +1,124 @@
+/**
+** @file lathist.c
+**
+** @author  CSCI-452 class of 20205
+**
+** Latency histogram implementation
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "lathist.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+/*
+** PRIVATE DATA TYPES
+*/
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// the histograms
+static lathist_t _hists[N_LAT];
+
+/*
+** PUBLIC GLOBAL VARIABLES
+*/
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/**
+** Name:  _lat_bucket
+**
+** Chooses the bucket for a latency
+**
+** @param ns   The latency
+**
+** @return floor(log2(ns)), limited to the range of buckets
+*/
+static uint32_t _lat_bucket( uint64_t ns ) {
+    uint32_t hi = (uint32_t) (ns >> 32);
+    uint32_t lo = (uint32_t) ns;
+    uint32_t n;
+
+    // bit scan reverse finds the highest set bit
+    if( hi != 0 ) {
+        __asm( "bsrl %1,%0" : "=r" (n) : "rm" (hi) );
+        n += 32;
+    } else if( lo != 0 ) {
+        __asm( "bsrl %1,%0" : "=r" (n) : "rm" (lo) );
+    } else {
+        n = 0;
+    }
+
+    return( n < N_LAT_BUCKETS ? n : N_LAT_BUCKETS - 1 );
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** Name:  _lat_init
+**
+** Initializes the latency histogram module
+*/
+void _lat_init( void ) {
+
+    __cio_puts( " Lat:" );
+
+    __memclr( _hists, sizeof(_hists) );
+
+    __cio_puts( " done" );
+}
+
+/**
+** Name:  _lat_record
+**
+** Adds one operation to a histogram
+**
+** @param which  The histogram (LAT_*)
+** @param ns     How long the operation took
+*/
+void _lat_record( uint32_t which, uint64_t ns ) {
+
+    assert1( which < N_LAT );
+
+    lathist_t *h = &_hists[which];
+
+    h->count += 1;
+    h->bucket[ _lat_bucket(ns) ] += 1;
+    h->total_ns += ns;
+    if( ns > h->max_ns ) {
+        h->max_ns = ns;
+    }
+}
+
+/**
+** Name:  _lat_get
+**
+** Copies out a histogram
+**
+** @param which  The histogram (LAT_*)
+** @param dst    Where to put the copy
+**
+** @return E_SUCCESS, or E_BAD_PARAM
+*/
+int32_t _lat_get( uint32_t which, lathist_t *dst ) {
+
+    if( which >= N_LAT || dst == NULL ) {
+        return( E_BAD_PARAM );
+    }
+
+    __memcpy( dst, &_hists[which], sizeof(lathist_t) );
+
+    return( E_SUCCESS );
+}
@@ -0,0 +1,110 @@
+/*
+** @file lathist.h
+**
+** @author CSCI-452 class of 20205
+**
+** Latency histogram declarations
+**
+** The kernel keeps a histogram of completion times for each kind of
+** disk and file system operation.  Times are measured in nanoseconds
+** with the TSC-based clock; bucket i counts the operations which took
+** at least 2^i but less than 2^(i+1) ns (bucket 0 also counts any
+** which took no measurable time, and the last bucket holds everything
+** too long for the others).  User code retrieves a histogram with the
+** getlat() system call.
+*/
+
+#ifndef LATHIST_H_
+#define LATHIST_H_
+
+#include "common.h"
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+// number of buckets in each histogram
+#define N_LAT_BUCKETS   32
+
+// histogram identifiers
+#define LAT_AHCI_READ       0   // one AHCI read command
+#define LAT_AHCI_WRITE      1   // one AHCI write command
+#define LAT_BLK_READ        2   // one block-layer read request
+#define LAT_BLK_WRITE       3   // one block-layer write request
+#define LAT_FCREATE         4   // file system calls, from submission
+#define LAT_FDELETE         5   //   to completion (including time
+#define LAT_FOPEN           6   //   spent waiting for the I/O daemon)
+#define LAT_FCLOSE          7
+#define LAT_FREAD           8
+#define LAT_FWRITE          9
+#define LAT_FREADV          10
+#define LAT_FWRITEV         11
+#define LAT_IORING_ENTER    12
+
+// UPDATE THIS DEFINITION IF MORE HISTOGRAMS ARE ADDED!
+#define N_LAT               13
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+/*
+** Types
+*/
+
+// one histogram
+typedef struct lathist_s {
+    uint32_t count;                 // operations recorded
+    uint32_t bucket[N_LAT_BUCKETS]; // log2(ns) distribution
+    uint64_t total_ns;              // sum of all latencies
+    uint64_t max_ns;                // longest latency seen
+} lathist_t;
+
+#ifdef SP_KERNEL_SRC
+
+/*
+** Globals
+*/
+
+/*
+** Prototypes
+*/
+
+/**
+** Name:  _lat_init
+**
+** Initializes the latency histogram module
+*/
+void _lat_init( void );
+
+/**
+** Name:  _lat_record
+**
+** Adds one operation to a histogram
+**
+** @param which  The histogram (LAT_*)
+** @param ns     How long the operation took
+*/
+void _lat_record( uint32_t which, uint64_t ns );
+
+/**
+** Name:  _lat_get
+**
+** Copies out a histogram
+**
+** @param which  The histogram (LAT_*)
+** @param dst    Where to put the copy
+**
+** @return E_SUCCESS, or E_BAD_PARAM
+*/
+int32_t _lat_get( uint32_t which, lathist_t *dst );
+
+#endif
+/* SP_KERNEL_SRC */
+
+#endif
+/* SP_ASM_SRC */
+
+#endif
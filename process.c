@@ -34,7 +34,7 @@ void exit_helper( void );
 */
 
 // PCB management
-static pcb_t *_free_pcbs;
+static kmcache_t *_pcb_cache;
 
 /*
 ** PUBLIC GLOBAL VARIABLES
@@ -53,38 +53,6 @@ pcb_t *_ptable[N_PROCS];
 ** PRIVATE FUNCTIONS
 */
 
-/**
-** _new_pcbs() - allocate a slice and carve it into PCBs
-**
-** @param critical  Should we panic on allocation failure?
-**
-** @return true on success, else false
-*/
-static bool_t _new_pcbs( bool_t critical ) {
-    pcb_t *slice;
-
-    // start by carving off a slice of memory
-    slice = (pcb_t *) _km_slice_alloc();
-
-    // if this is a critical allocation and slice is NULL, we're done
-    assert( !critical || slice != NULL );
-
-    // whew - not critical; NULL slice is still a problem, though
-    if( slice == NULL ) {
-        return( false );
-    }
-
-    // clear out the allocated space
-    __memclr( slice, SLICE_SIZE );
-
-    for( int i = 0; i < (SLICE_SIZE / sizeof(pcb_t)); ++i ) {
-        _pcb_free( slice + i );
-    }
-
-    // all done!
-    return( true );
-}
-
 /*
 ** PUBLIC FUNCTIONS
 */
@@ -101,29 +69,9 @@ static bool_t _new_pcbs( bool_t critical ) {
 ** @return a pointer to the allocated PCB, or NULL
 */
 pcb_t *_pcb_alloc( void ) {
-    pcb_t *new;
-
-    // see if there is an available PCB
-    if( _free_pcbs == NULL ) {
-
-        // no - see if we can create some
-        if( !_new_pcbs(false) ) {
-            // no!  let's just leave quietly
-            return( NULL );
-        }
-    }
-
-    // OK, we know that there is at least one free PCB;
-    // just take the first one from the list
-
-    new = _free_pcbs;
-    _free_pcbs = (pcb_t *) new->context;
-
-    // clear out the fields in this one just to be safe
-    __memclr( new, sizeof(pcb_t) );
 
-    // pass it back to the caller
-    return( new );
+    // the cache hands it back already cleared
+    return( (pcb_t *) _km_cache_alloc(_pcb_cache) );
 }
 
 /**
@@ -143,9 +91,7 @@ void _pcb_free( pcb_t *pcb ) {
     // mark it as unused (just in case)
     pcb->state = Unused;
 
-    // stick it at the front of the list
-    pcb->context = (context_t *) _free_pcbs;
-    _free_pcbs = pcb;
+    _km_cache_free( _pcb_cache, pcb );
 }
 
 /**
@@ -212,7 +158,7 @@ void _pcb_cleanup( pcb_t *pcb ) {
 /**
 ** _proc_init() - initialize the PCB module
 **
-** Allocates the initial set of PCBs, does whatever else is
+** Creates the PCB cache, does whatever else is
 ** needed to make it possible to create processes
 **
 ** Dependencies:
@@ -223,9 +169,9 @@ void _proc_init( void ) {
 
     __cio_puts( " Process:" );
 
-    // allocate an initial slice of PCBs
-    _free_pcbs = NULL;
-    _new_pcbs( true );
+    // PCBs come from their own cache
+    _pcb_cache = _km_cache_create( "pcb", sizeof(pcb_t), NULL );
+    assert( _pcb_cache != NULL );
 
     // reset the "active" variables
     _active_procs = 0;
@@ -23,6 +23,7 @@
 
 #include "stacks.h"
 #include "queues.h"
+#include "clock.h"
 
 // PID for the init() process
 #define PID_INIT     1
@@ -100,6 +101,8 @@ typedef struct pcb_s {
     int32_t exit_status;    // termination status, for parent's use
     event_t event;          // what this process is waiting for
 
+    ktimer_t timer;         // wakeup timer for sleep()
+
     // two-byte values
     pid_t pid;              // unique PID for this process
     pid_t ppid;             // PID of the parent
@@ -111,9 +114,9 @@ typedef struct pcb_s {
     uint8_t quantum;        // quantum for this process
     uint8_t ticks;          // ticks remaining in current slice
 
-    // filler, to round us up to 32 bytes
+    // filler, to round us up to 48 bytes
     // adjust this as fields are added/removed/changed
-    uint8_t filler[8];
+    uint8_t filler[4];
 
 } pcb_t;
 
@@ -0,0 +1,143 @@
+/**
+** @file profile.c
+**
+** @author  CSCI-452 class of 20205
+**
+** Sampling profiler implementation
+**
+** The ring buffer is filled by the clock ISR and emptied by system
+** calls, both of which run with interrupts disabled, so no further
+** locking is needed.  When the buffer is full, new samples are
+** counted and discarded rather than overwriting the oldest ones, so
+** whatever is drained is always a contiguous stretch of time.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "profile.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+/*
+** PRIVATE DATA TYPES
+*/
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// the ring buffer, and the oldest and next free slots in it
+static profsample_t _samples[PROF_SAMPLES];
+static uint32_t _prof_head;
+static uint32_t _prof_tail;
+static uint32_t _prof_count;
+
+// samples discarded because the buffer was full
+static uint32_t _prof_dropped;
+
+// ticks since the last sample
+static uint32_t _prof_ticks;
+
+/*
+** PUBLIC GLOBAL VARIABLES
+*/
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** Name:  _prof_init
+**
+** Initializes the profiler module
+*/
+void _prof_init( void ) {
+
+    __cio_puts( " Prof:" );
+
+    _prof_head = _prof_tail = _prof_count = 0;
+    _prof_dropped = 0;
+    _prof_ticks = 0;
+
+#ifdef PROFILE
+    __cio_printf( " done (every %d ticks)", PROFILE );
+#else
+    __cio_puts( " off" );
+#endif
+}
+
+/**
+** Name:  _prof_tick
+**
+** Called from the clock ISR on each tick; takes a sample of the
+** interrupted process every PROFILE ticks
+**
+** @param pcb   The interrupted process
+*/
+void _prof_tick( pcb_t *pcb ) {
+
+#ifdef PROFILE
+    if( ++_prof_ticks < PROFILE ) {
+        return;
+    }
+    _prof_ticks = 0;
+
+    if( _prof_count == PROF_SAMPLES ) {
+        ++_prof_dropped;
+        return;
+    }
+
+    _samples[_prof_tail].eip = pcb->context->eip;
+    _samples[_prof_tail].pid = pcb->pid;
+    _prof_tail = (_prof_tail + 1) % PROF_SAMPLES;
+    ++_prof_count;
+#else
+    (void) pcb;
+#endif
+}
+
+/**
+** Name:  _prof_read
+**
+** Removes the oldest samples from the ring buffer
+**
+** @param buf   Where to put them
+** @param max   Most samples to remove
+**
+** @return the number of samples removed
+*/
+uint32_t _prof_read( profsample_t *buf, uint32_t max ) {
+    uint32_t n = 0;
+
+    while( n < max && _prof_count > 0 ) {
+        buf[n++] = _samples[_prof_head];
+        _prof_head = (_prof_head + 1) % PROF_SAMPLES;
+        --_prof_count;
+    }
+
+    return( n );
+}
+
+/**
+** Name:  _prof_dropped_count
+**
+** Reports how many samples were discarded because the ring buffer
+** was full, and resets the count
+**
+** @return the number discarded since the last call
+*/
+uint32_t _prof_dropped_count( void ) {
+    uint32_t n = _prof_dropped;
+
+    _prof_dropped = 0;
+
+    return( n );
+}
@@ -0,0 +1,101 @@
+/*
+** @file profile.h
+**
+** @author CSCI-452 class of 20205
+**
+** Sampling profiler declarations
+**
+** When the kernel is built with PROFILE=n, every n'th clock tick
+** records the EIP and PID of the interrupted process in a ring
+** buffer.  The buffer is drained by the profread() system call; in
+** a profiling build, init also starts the profd process, which
+** writes the samples to the serial line for ProfReport to symbolize
+** against prog.nll on the host.
+*/
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include "common.h"
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+// number of samples the ring buffer holds
+#define PROF_SAMPLES    2048
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+/*
+** Types
+*/
+
+// one sample
+typedef struct profsample_s {
+    uint32_t eip;       // where the process was interrupted
+    uint32_t pid;       // and which process it was
+} profsample_t;
+
+#ifdef SP_KERNEL_SRC
+
+#include "process.h"
+
+/*
+** Globals
+*/
+
+/*
+** Prototypes
+*/
+
+/**
+** Name:  _prof_init
+**
+** Initializes the profiler module
+*/
+void _prof_init( void );
+
+/**
+** Name:  _prof_tick
+**
+** Called from the clock ISR on each tick; takes a sample of the
+** interrupted process every PROFILE ticks
+**
+** @param pcb   The interrupted process
+*/
+void _prof_tick( pcb_t *pcb );
+
+/**
+** Name:  _prof_read
+**
+** Removes the oldest samples from the ring buffer
+**
+** @param buf   Where to put them
+** @param max   Most samples to remove
+**
+** @return the number of samples removed
+*/
+uint32_t _prof_read( profsample_t *buf, uint32_t max );
+
+/**
+** Name:  _prof_dropped_count
+**
+** Reports how many samples were discarded because the ring buffer
+** was full, and resets the count
+**
+** @return the number discarded since the last call
+*/
+uint32_t _prof_dropped_count( void );
+
+#endif
+/* SP_KERNEL_SRC */
+
+#endif
+/* SP_ASM_SRC */
+
+#endif
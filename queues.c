@@ -21,6 +21,13 @@
 // alternate version that actually invokes the function
 // #define QLEN(q)    _que_length(q)
 
+// initial number of slots in a heap array; doubled as needed
+#define HEAP_INITIAL    16
+
+// heap index arithmetic (zero-based)
+#define H_PARENT(i)     (((i) - 1) >> 1)
+#define H_LEFT(i)       (((i) << 1) + 1)
+
 /*
 ** PRIVATE DATA TYPES
 */
@@ -40,6 +47,13 @@
 ** is always done at the end of the queue.  Otherwise, the insertion is
 ** ordered according to the results from the comparison function.
 **
+** An ordered queue may instead be allocated as a binary heap (see
+** _que_alloc_heap()).  Heap queues keep their entries in a growable
+** array rather than in qnodes, so insertion and removal are O(log n)
+** instead of O(n).  Each entry carries an insertion sequence number,
+** which breaks ties between equal keys so that heap queues preserve
+** the same FIFO-among-equals behavior as the list version.
+**
 ** Neither of these types are visible to the rest of the system.  The
 ** queue_t type is a pointer to the queue_s struct.
 */
@@ -52,33 +66,32 @@ typedef struct qn_s {
     void *data;          // what's in this entry
 } qnode_t;
 
+// heap entries
+typedef struct hent_s {
+    uint_t key;          // key to whatever's in this entry
+    uint32_t seq;        // insertion order, for breaking ties
+    void *data;          // what's in this entry
+} hent_t;
+
 // the queue itself is a pointer to this structure
 struct queue_s {
     qnode_t *head;       // first element
     qnode_t *tail;       // last element
     uint_t length;       // current occupancy count
     int (*order)( const void *, const void * ); // how to compare entries
+    hent_t *heap;        // heap array (heap queues only)
+    uint_t size;         // number of slots in the heap array
+    uint32_t seq;        // next insertion sequence number
+    bool_t is_heap;      // is this a heap queue?
 };
 
 /*
 ** PRIVATE GLOBAL VARIABLES
 */
 
-/*
-** The list of free qnodes.
-**
-** Organized as a singly-linked list using the 'next' pointer
-** in the qnode structure.
-*/
-static qnode_t *_free_qnodes;
-
-/*
-** The list of free queues.
-**
-** Organized as a singly-linked list using the 'data' pointer
-** in the queue_s structure.
-*/
-static queue_t _free_queues;
+// caches for qnodes and queues
+static kmcache_t *_qnode_cache;
+static kmcache_t *_queue_cache;
 
 /*
 ** PUBLIC GLOBAL VARIABLES
@@ -88,125 +101,178 @@ static queue_t _free_queues;
 ** PRIVATE FUNCTIONS
 */
 
-// forward references
-static void _qn_free( qnode_t * );
-void _que_free( queue_t );
-
 /**
-** _new_qnodes() - allocate a slice and carve it into qnodes
+** _qn_alloc() - allocate a qnode
 **
-** @param critical  Should we panic on allocation failure?
+** Removes the first qnode from the free list.
 **
-** @return true on success, else false
+** @return A pointer to the allocated node, or NULL
 */
-static bool_t _new_qnodes( bool_t critical ) {
-    qnode_t *slice;
-
-    // start by carving off a slice of memory
-    slice = (qnode_t *) _km_slice_alloc();
+static qnode_t *_qn_alloc( void ) {
 
-    // if this is a critical allocation and slice is NULL, we're done
-    assert( !critical || slice != NULL );
+    // the cache hands it back already cleared
+    return( (qnode_t *) _km_cache_alloc(_qnode_cache) );
+}
 
-    // whew - not critical; NULL slice is still a problem, though
-    if( slice == NULL ) {
-        return( false );
-    }
+/**
+** _qn_free() - return a qnode to the free list
+**
+** Deallocates the supplied qnode
+**
+** @param qn   The qnode to be put on the free list
+*/
+static void _qn_free( qnode_t *qn ) {
+    _km_cache_free( _qnode_cache, qn );
+}
 
-    // clear out the allocated space
-    __memclr( slice, SLICE_SIZE );
+/**
+** _heap_mem_alloc() - allocate space for a heap array
+**
+** Small arrays come from the size-class caches; anything bigger
+** than the largest class is taken directly as pages.
+**
+** @param slots   Number of entries in the array
+**
+** @return A pointer to the array, or NULL
+*/
+static hent_t *_heap_mem_alloc( uint_t slots ) {
+    uint32_t bytes = slots * sizeof(hent_t);
 
-    // free the qnodes!
-    for( int i = 0; i < (SLICE_SIZE / sizeof(qnode_t)); ++i ) {
-        // N.B.: if the slice size is not an integral multiple of
-        // the qnode size, this will leave a small internal fragment
-        // at the end of the allocated block of memory
-        _qn_free( slice + i );
+    if( bytes <= KM_ALLOC_MAX ) {
+        return( (hent_t *) _km_alloc(bytes) );
     }
 
-    // all done!
-    return( true );
+    return( (hent_t *) _km_page_alloc( (bytes + PAGE_SIZE - 1) / PAGE_SIZE ) );
 }
 
 /**
-** _new_queues() - allocate a slice and carve it into queues
-**
-** @param critical  Should we panic on allocation failure?
+** _heap_mem_free() - release a heap array
 **
-** @return true on success, else false
+** @param heap    The array
+** @param slots   Number of entries it was allocated with
 */
-static bool_t _new_queues( bool_t critical ) {
-    struct queue_s *slice;
+static void _heap_mem_free( hent_t *heap, uint_t slots ) {
+    uint32_t bytes = slots * sizeof(hent_t);
 
-    // start by carving off a slice of memory
-    slice = (struct queue_s *) _km_slice_alloc();
-
-    // if this is a critical allocation and slice is NULL, we're done
-    assert( !critical || slice != NULL );
-
-    // whew - not critical; NULL slice is still a problem, though
-    if( slice == NULL ) {
-        return( false );
+    if( bytes <= KM_ALLOC_MAX ) {
+        _km_free( heap, bytes );
+    } else {
+        _km_page_free( heap );
     }
+}
 
-    // clear out the allocated space
-    __memclr( slice, SLICE_SIZE );
+/**
+** _heap_before() - does heap entry a belong ahead of entry b?
+**
+** @param q   The queue
+** @param a   First entry
+** @param b   Second entry
+**
+** @return true if a should be dequeued before b
+*/
+static bool_t _heap_before( queue_t q, hent_t *a, hent_t *b ) {
+    int cmp = q->order( (void *)(a->key), (void *)(b->key) );
 
-    // 
-    for( int i = 0; i < (SLICE_SIZE / sizeof(struct queue_s)); ++i ) {
-        _que_free( slice + i );
+    if( cmp != 0 ) {
+        return( cmp < 0 );
     }
 
-    // all done!
-    return( true );
+    // equal keys:  the older entry wins (wraparound-safe)
+    return( (int32_t)(a->seq - b->seq) < 0 );
 }
 
 /**
-** _qn_alloc() - allocate a qnode
+** _heap_enque() - add an element to a heap queue
 **
-** Removes the first qnode from the free list.
+** @param q     The queue to be manipulated
+** @param data  The data to be added
+** @param key   The key value to be used when ordering the queue
 **
-** @return A pointer to the allocated node, or NULL
+** @return the status of the insertion attempt
 */
-static qnode_t *_qn_alloc( void ) {
-    qnode_t *new;
-
-    // see if there is an available node
-    if( _free_qnodes == NULL ) {
-
-        // no - see if we can create some
-        if( !_new_qnodes(false) ) {
-            // no!  let's just leave quietly
-            return( NULL );
+static status_t _heap_enque( queue_t q, void *data, uint_t key ) {
+
+    // make sure there's room for one more
+    if( q->length >= q->size ) {
+        uint_t nsize = q->size ? q->size * 2 : HEAP_INITIAL;
+        hent_t *nheap = _heap_mem_alloc( nsize );
+        if( nheap == NULL ) {
+            return( E_NO_MEMORY );
+        }
+        if( q->heap != NULL ) {
+            __memcpy( nheap, q->heap, q->length * sizeof(hent_t) );
+            _heap_mem_free( q->heap, q->size );
         }
+        q->heap = nheap;
+        q->size = nsize;
     }
 
-    // OK, we know that there is at least one free qnode;
-    // just take the first one from the list
-
-    new = _free_qnodes;
-    _free_qnodes = new->next;
+    hent_t ent;
+    ent.key = key;
+    ent.seq = q->seq++;
+    ent.data = data;
 
-    // clear out the fields in this one just to be safe
-    new->prev = new->next = new->data = NULL;
-    new->key = 0;
+    // sift the hole up from the bottom until the new entry fits
+    uint_t i = q->length;
+    while( i > 0 && _heap_before(q,&ent,&q->heap[H_PARENT(i)]) ) {
+        q->heap[i] = q->heap[H_PARENT(i)];
+        i = H_PARENT(i);
+    }
+    q->heap[i] = ent;
+    q->length += 1;
 
-    // pass it back to the caller
-    return( new );
+    return( E_SUCCESS );
 }
 
 /**
-** _qn_free() - return a qnode to the free list
+** _heap_take() - remove any element from a heap queue
 **
-** Deallocates the supplied qnode
+** The last entry fills the hole, and is sifted up or down from there
+** until it fits.
 **
-** @param qn   The qnode to be put on the free list
+** @param q     The queue to be manipulated
+** @param i     Where the element is in the heap array
+**
+** @return the removed element
 */
-static void _qn_free( qnode_t *qn ) {
+static void *_heap_take( queue_t q, uint_t i ) {
+    void *data = q->heap[i].data;
+
+    q->length -= 1;
+    if( i == q->length ) {
+        return( data );
+    }
+
+    hent_t last = q->heap[q->length];
 
-    // just stick this one at the front of the list
-    qn->next = _free_qnodes;
-    _free_qnodes = qn;
+    // it may belong above the hole (never when the hole is the root)
+    if( i > 0 && _heap_before(q,&last,&q->heap[H_PARENT(i)]) ) {
+        while( i > 0 && _heap_before(q,&last,&q->heap[H_PARENT(i)]) ) {
+            q->heap[i] = q->heap[H_PARENT(i)];
+            i = H_PARENT(i);
+        }
+        q->heap[i] = last;
+        return( data );
+    }
+
+    // otherwise, sift it down
+    uint_t child;
+
+    while( (child = H_LEFT(i)) < q->length ) {
+        // pick the earlier of the two children
+        if( child + 1 < q->length &&
+            _heap_before(q,&q->heap[child+1],&q->heap[child]) ) {
+            ++child;
+        }
+        if( !_heap_before(q,&q->heap[child],&last) ) {
+            break;
+        }
+        q->heap[i] = q->heap[child];
+        i = child;
+    }
+    q->heap[i] = last;
+
+    return( data );
 }
 
 /*
@@ -216,7 +282,7 @@ static void _qn_free( qnode_t *qn ) {
 /**
 ** _que_init() - initialize the queue module
 **
-** Allocates the initial set of qnodes and set of queues.
+** Creates the caches for qnodes and queues.
 **
 ** Dependencies:
 **    Cannot be called before kmem is initialized
@@ -227,12 +293,12 @@ void _que_init( void ) {
     __cio_puts( " Queue:" );
 
     // start with the qnodes
-    _free_qnodes = NULL;
-    _new_qnodes( true );
+    _qnode_cache = _km_cache_create( "qnode", sizeof(qnode_t), NULL );
+    assert( _qnode_cache != NULL );
 
     // next, the queues
-    _free_queues = NULL;
-    _new_queues( true );
+    _queue_cache = _km_cache_create( "queue", sizeof(struct queue_s), NULL );
+    assert( _queue_cache != NULL );
 
     // all done!
     __cio_puts( " done" );
@@ -250,31 +316,45 @@ void _que_init( void ) {
 queue_t _que_alloc( int (*order)(const void *,const void *) ) {
     queue_t new;
 
-    // see if there is an available node
-    if( _free_queues == NULL ) {
-
-        // no - see if we can create some
-        if( !_new_queues(false) ) {
-            // no!  let's just leave quietly
-            return( NULL );
-        }
+    new = (queue_t) _km_cache_alloc( _queue_cache );
+    if( new == NULL ) {
+        // no!  let's just leave quietly
+        return( NULL );
     }
 
-    // OK, we know that there is at least one free qnode;
-    // just take the first one from the list
-
-    new = _free_queues;
-    _free_queues = (queue_t) new->head;
-
-    // clear out the fields in this one just to be safe
-    new->head = new->tail = NULL;
-    new->length = 0;
+    // the cache cleared the rest of it
     new->order = order;
 
     // pass it back to the caller
     return( new );
 }
 
+/**
+** _que_alloc_heap() - allocate a heap-backed ordered queue
+**
+** Allocates a queue which is kept as a binary heap rather than as
+** an ordered list.  Enqueue and dequeue are O(log n); the ordering
+** seen through _que_deque() and _que_peek() is the same as for an
+** ordered queue from _que_alloc().
+**
+** @param order   The ordering function to be used (must not be NULL)
+**
+** @return a pointer to the allocated queue, or NULL
+*/
+queue_t _que_alloc_heap( int (*order)(const void *,const void *) ) {
+
+    // a heap needs something to order by
+    assert1( order != NULL );
+
+    queue_t new = _que_alloc( order );
+    if( new != NULL ) {
+        // the array itself is allocated on first insertion
+        new->is_heap = true;
+    }
+
+    return( new );
+}
+
 /**
 ** _que_free() - return a queue to the free list
 **
@@ -287,9 +367,12 @@ void _que_free( queue_t q ) {
     // sanity check!
     assert1( q != NULL );
 
-    // just stick this one at the front of the list
-    q->head = (qnode_t *) _free_queues;
-    _free_queues = q;
+    // heap queues carry their own array
+    if( q->heap != NULL ) {
+        _heap_mem_free( q->heap, q->size );
+    }
+
+    _km_cache_free( _queue_cache, q );
 }
 
 /**
@@ -320,6 +403,11 @@ status_t _que_enque( queue_t q, void *data, uint_t key ) {
     // sanity check!
     assert1( q != NULL );
 
+    // heap queues don't use qnodes
+    if( q->is_heap ) {
+        return( _heap_enque(q,data,key) );
+    }
+
     // need to use a qnode
     qnode_t *qn = _qn_alloc();
     if( qn == NULL ) {
@@ -420,6 +508,10 @@ void *_que_deque( queue_t q ) {
         return( NULL );
     }
 
+    if( q->is_heap ) {
+        return( _heap_take(q,0) );
+    }
+
     // OK, we have something to return; take it from the queue
     qnode_t *qn = q->head;
 
@@ -446,6 +538,57 @@ void *_que_deque( queue_t q ) {
     return( data );
 }
 
+/**
+** _que_remove() - remove a particular element from a queue
+**
+** The queue is searched from the front, so this is O(n); removing
+** the found entry from a heap queue is then O(log n).
+**
+** @param q     The queue to be manipulated
+** @param data  The element to be removed
+**
+** @return the removed element, or NULL if it wasn't in the queue
+*/
+void *_que_remove( queue_t q, void *data ) {
+
+    // sanity check!
+    assert1( q != NULL );
+
+    if( q->is_heap ) {
+        for( uint_t i = 0; i < q->length; ++i ) {
+            if( q->heap[i].data == data ) {
+                return( _heap_take(q,i) );
+            }
+        }
+        return( NULL );
+    }
+
+    qnode_t *qn = q->head;
+    while( qn != NULL && qn->data != data ) {
+        qn = qn->next;
+    }
+    if( qn == NULL ) {
+        return( NULL );
+    }
+
+    // unlink it from its neighbors (or the ends of the list)
+    if( qn->prev != NULL ) {
+        qn->prev->next = qn->next;
+    } else {
+        q->head = qn->next;
+    }
+    if( qn->next != NULL ) {
+        qn->next->prev = qn->prev;
+    } else {
+        q->tail = qn->prev;
+    }
+    q->length -= 1;
+
+    _qn_free( qn );
+
+    return( data );
+}
+
 /**
 ** _que_peek() - peek at the first element in a queue
 **
@@ -463,6 +606,10 @@ void *_que_peek( queue_t q ) {
         return( NULL );
     }
 
+    if( q->is_heap ) {
+        return( q->heap[0].data );
+    }
+
     return( q->head->data );
 }
 
@@ -488,8 +635,13 @@ void _que_dump( const char *msg, queue_t q ) {
     }
 
     // first, the basic data
-    __cio_printf( "head %08x tail %08x %d items",
-                  (uint32_t) q->head, (uint32_t) q->tail, q->length );
+    if( q->is_heap ) {
+        __cio_printf( "heap %08x size %d %d items",
+                      (uint32_t) q->heap, q->size, q->length );
+    } else {
+        __cio_printf( "head %08x tail %08x %d items",
+                      (uint32_t) q->head, (uint32_t) q->tail, q->length );
+    }
 
     // next, how the queue is ordered
     if( q->order ) {
@@ -499,7 +651,18 @@ void _que_dump( const char *msg, queue_t q ) {
     }
 
     // if there are members in the queue, dump the first five data pointers
-    if( q->length > 0 ) {
+    if( q->length > 0 && q->is_heap ) {
+        // heap order, not dequeue order, but the root is first
+        __cio_puts( " data: " );
+        uint_t i;
+        for( i = 0; i < 5 && i < q->length; ++i ) {
+            __cio_printf( " [%08x]", (uint32_t) q->heap[i].data );
+        }
+        if( i < q->length ) {
+            __cio_puts( " ..." );
+        }
+        __cio_putchar( '\n' );
+    } else if( q->length > 0 ) {
         __cio_puts( " data: " );
         qnode_t *tmp;
         int i = 0;
@@ -61,6 +61,18 @@ void _que_init( void );
 */
 queue_t _que_alloc( int (*order)(const void *,const void *) );
 
+/**
+** _que_alloc_heap() - allocate a heap-backed ordered queue
+**
+** Like _que_alloc(), but the queue is kept as a binary heap, so
+** insertion and removal are O(log n) rather than O(n).
+**
+** @param order   The ordering function to be used (must not be NULL)
+**
+** @return a pointer to the allocated queue, or NULL
+*/
+queue_t _que_alloc_heap( int (*order)(const void *,const void *) );
+
 /**
 ** _que_free() - return a queue to the free list
 **
@@ -97,6 +109,16 @@ status_t _que_enque( queue_t q, void *data, uint32_t key );
 */
 void *_que_deque( queue_t q );
 
+/**
+** _que_remove() - remove a particular element from a queue
+**
+** @param q     The queue to be manipulated
+** @param data  The element to be removed
+**
+** @return the removed element, or NULL if it wasn't in the queue
+*/
+void *_que_remove( queue_t q, void *data );
+
 /**
 ** _que_peek() - peek at the first element in a queue
 **
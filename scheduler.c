@@ -10,6 +10,7 @@
 
 #include "common.h"
 #include "syscalls.h"
+#include "trace.h"
 
 /*
 ** PRIVATE DEFINITIONS
@@ -23,6 +24,11 @@
 ** PRIVATE GLOBAL VARIABLES
 */
 
+// bitmap of non-empty ready queues:  bit n is set iff _ready[n]
+// has something in it, so the lowest set bit is the highest
+// priority level with a runnable process
+static uint32_t _ready_map;
+
 /*
 ** PUBLIC GLOBAL VARIABLES
 */
@@ -37,6 +43,22 @@ pcb_t *_current;
 ** PRIVATE FUNCTIONS
 */
 
+/**
+** _first_ready() - locate the highest-priority non-empty ready queue
+**
+** The ready map must not be empty.
+**
+** @return the index of the queue
+*/
+static int _first_ready( void ) {
+    int n;
+
+    // bit scan forward finds the lowest set bit in one instruction
+    __asm( "bsfl %1,%0" : "=r" (n) : "rm" (_ready_map) );
+
+    return( n );
+}
+
 /*
 ** PUBLIC FUNCTIONS
 */
@@ -53,6 +75,9 @@ pcb_t *_current;
 void _sched_init( void ) {
 
     __cio_puts( " Sched:" );
+
+    // the ready map needs a bit for each level
+    assert( N_QUEUES <= 32 );
     
     // allocate the ready queues
     for( int i = 0; i < N_QUEUES; ++i ) {
@@ -63,6 +88,9 @@ void _sched_init( void ) {
     
     // reset the "current process" pointer
     _current = NULL;
+
+    // nothing is ready yet
+    _ready_map = 0;
     
     __cio_puts( " done" );
 }
@@ -96,6 +124,16 @@ void _schedule( pcb_t *pcb ) {
 
     // failure is not an option!
     assert( status == E_SUCCESS );
+
+    // this level now has something in it
+    _ready_map |= (1 << pcb->priority);
+
+#ifdef TICKLESS_IDLE
+    // someone besides idle can run, so bring the clock back
+    if( pcb->priority < PRIO_LOWEST ) {
+        _clk_wake();
+    }
+#endif
 }
 
 /**
@@ -112,23 +150,24 @@ void _dispatch( void ) {
 
     while( 1 ) {
 
-        // find a ready queue that has an available process
-        for( n = 0; n < N_QUEUES; ++n ) {
-            if( _que_length(_ready[n]) > 0 ) {
-                break;
-            }
-        }
-    
         // this should never happen - if nothing else, the
         // idle process should be on the "Deferred" queue
-        assert( n < N_QUEUES );
+        assert( _ready_map != 0 );
+
+        // find the highest-priority queue with an available process
+        n = _first_ready();
     
-        // OK, we found a queue; pull the first process from it
+        // pull the first process from it
         new = _que_deque( _ready[n] );
 
         // failure to deque means something serious has gone wrong
         assert( new != NULL );
 
+        // if that emptied the queue, clear its bit
+        if( _que_length(_ready[n]) == 0 ) {
+            _ready_map &= ~(1 << n);
+        }
+
         // if this process is a delayed 'kill', we need to take care
         // of it; otherwise, we've found our new current process
 
@@ -164,4 +203,18 @@ void _dispatch( void ) {
     // set its state and remaining quantum
     new->state = Running;
     new->ticks = new->quantum;
+
+    TRACE_EV( TRC_DISPATCH, new->pid, new->priority );
+}
+
+/**
+** _sched_idle() - is the idle process all there is to run?
+**
+** @return true if the current process is at the lowest priority
+**         and nothing at a higher priority is ready
+*/
+bool_t _sched_idle( void ) {
+
+    return( _current != NULL && _current->priority == PRIO_LOWEST &&
+            (_ready_map & ((1 << PRIO_LOWEST) - 1)) == 0 );
 }
@@ -75,6 +75,14 @@ void _schedule( pcb_t *pcb );
 */
 void _dispatch( void );
 
+/**
+** _sched_idle() - is the idle process all there is to run?
+**
+** @return true if the current process is at the lowest priority
+**         and nothing at a higher priority is ready
+*/
+bool_t _sched_idle( void );
+
 #endif
 /* SP_ASM_SRC */
 
@@ -25,6 +25,15 @@
 #include "cio.h"
 #include "sio.h"
 
+#include "ioring.h"
+#include "iod.h"
+#include "lathist.h"
+#include "kstats.h"
+#include "profile.h"
+#include "trace.h"
+#include "block.h"
+#include "journal.h"
+#include "iobuf.h"
 #include "filemanager.h"
 
 // copied from ulib.h
@@ -110,6 +119,9 @@ static void _sys_isr( int vector, int code ) {
 **
 ** Values being returned to the user are placed into the EAX
 ** field in the context save area for that process.
+**
+** The file system calls are carried out by the I/O daemon; their
+** handlers just block the caller and pass the request along.
 */
 
 
@@ -120,15 +132,7 @@ static void _sys_isr( int vector, int code ) {
 **    int fcreate( char *filename );
 */
 static void _sys_fcreate( uint32_t args[4] ) {
-
-    // the only argument is the file name
-    char *filename = ( char *) args[0];
-
-    // call the function in filemanager
-    int result = _fs_create( filename );
-
-    // return the success value given by filemanager
-    RET(_current) = result;
+    _iod_submit( SYS_fcreate, args );
 }
 
 /**
@@ -138,15 +142,7 @@ static void _sys_fcreate( uint32_t args[4] ) {
 **    int fdelete( char *filename );
 */
 static void _sys_fdelete( uint32_t args[4] ) {
-
-    // the only argument is the file name
-    char *filename = ( char *) args[0];
-
-    // call the function in filemanager
-    int result = _fs_delete( filename );
-
-    // return the success value given by filemanager
-    RET(_current) = result;
+    _iod_submit( SYS_fdelete, args );
 }
 
 /**
@@ -156,15 +152,7 @@ static void _sys_fdelete( uint32_t args[4] ) {
 **    int fopen( char *filename );
 */
 static void _sys_fopen( uint32_t args[4] ) {
-
-    // the only argument is the file name
-    char *filename = ( char *) args[0];
-
-    // call the function in filemanager
-    int result = _fs_open( filename );
-
-    // return the success value given by filemanager
-    RET(_current) = result;
+    _iod_submit( SYS_fopen, args );
 }
 
 /**
@@ -174,15 +162,7 @@ static void _sys_fopen( uint32_t args[4] ) {
 **    int fclose( char *filename );
 */
 static void _sys_fclose( uint32_t args[4] ) {
-
-    // the only argument is the file name
-    char *filename = ( char *) args[0];
-
-    // call the function in filemanager
-    int result = _fs_close( filename );
-
-    // return the success value given by filemanager
-    RET(_current) = result;
+    _iod_submit( SYS_fclose, args );
 }
 
 /**
@@ -192,43 +172,228 @@ static void _sys_fclose( uint32_t args[4] ) {
 **    int fread( char *filename, char *buf );
 */
 static void _sys_fread( uint32_t args[4] ) {
+    _iod_submit( SYS_fread, args );
+}
 
-    // first argument is the file name
-    char *filename = ( char *) args[0];
+/**
+** _sys_fwrite - write to a file
+**
+** implements:
+**    int fwrite( char *filename, char *buf, int size );
+*/
+static void _sys_fwrite( uint32_t args[4] ) {
+    _iod_submit( SYS_fwrite, args );
+}
 
-    // second argument is the buffer to store file contents in
-    char *buf = ( char * ) args[1];
+/**
+** _sys_freadv - read from a file into several buffers
+**
+** implements:
+**    int freadv( char *filename, iovec_t *iov, int iovcnt );
+*/
+static void _sys_freadv( uint32_t args[4] ) {
+    _iod_submit( SYS_freadv, args );
+}
+
+/**
+** _sys_fwritev - append several buffers to a file
+**
+** implements:
+**    int fwritev( char *filename, iovec_t *iov, int iovcnt );
+*/
+static void _sys_fwritev( uint32_t args[4] ) {
+    _iod_submit( SYS_fwritev, args );
+}
 
-    // call the function in filemanager
-    int size = _fs_read( filename, buf );
+/**
+** _sys_ioring_setup - register a submission/completion ring
+**
+** implements:
+**    int ioring_setup( ioring_t *ring, uint32_t flags );
+*/
+static void _sys_ioring_setup( uint32_t args[4] ) {
+    RET(_current) = _ior_setup( _current, (ioring_t *) args[0], args[1] );
+}
 
-    // return the number of characters read
-    // includes the NULL terminator
-    RET(_current) = size;
+/**
+** _sys_ioring_enter - submit queued ring entries
+**
+** implements:
+**    int ioring_enter( uint32_t to_submit );
+*/
+static void _sys_ioring_enter( uint32_t args[4] ) {
+    _iod_submit( SYS_ioring_enter, args );
 }
 
 /**
-** _sys_fwrite - write to a file
+** _sys_batch - perform several system calls in one trap
 **
 ** implements:
-**    int fwrite( char *filename, char *buf, int size );
+**    int32_t batch( batch_rec_t *recs, uint32_t count );
+**
+** The records are carried out in order, each through the normal
+** second-level handler, and each one's return value is stored in its
+** result field.  Calls that can block or terminate the caller (exit,
+** read, sleep, wait, the file system calls, ioring_enter, iodwait,
+** and batch itself) are refused with E_BAD_SYSCALL.
+** If a call takes the CPU away from the caller anyway (e.g., kill of
+** itself), the rest of the batch is abandoned.
+**
+** Returns the number of records processed.
 */
-static void _sys_fwrite( uint32_t args[4] ) {
+static void _sys_batch( uint32_t args[4] ) {
+    batch_rec_t *recs = (batch_rec_t *) args[0];
+    uint32_t count = args[1];
+    pcb_t *self = _current;
+    uint32_t n;
+
+    if( recs == NULL || count > N_BATCH ) {
+        RET(self) = E_BAD_PARAM;
+        return;
+    }
+
+    for( n = 0; n < count; ++n ) {
+        batch_rec_t *rec = &recs[n];
+
+        switch( rec->code ) {
+        case SYS_exit:   // FALL THROUGH
+        case SYS_read:   // FALL THROUGH
+        case SYS_sleep:  // FALL THROUGH
+        case SYS_wait:   // FALL THROUGH
+        case SYS_fcreate:  // FALL THROUGH
+        case SYS_fdelete:  // FALL THROUGH
+        case SYS_fopen:    // FALL THROUGH
+        case SYS_fclose:   // FALL THROUGH
+        case SYS_fread:    // FALL THROUGH
+        case SYS_fwrite:   // FALL THROUGH
+        case SYS_freadv:   // FALL THROUGH
+        case SYS_fwritev:  // FALL THROUGH
+        case SYS_ioring_enter:  // FALL THROUGH
+        case SYS_iodwait:  // FALL THROUGH
+        case SYS_batch:
+            rec->result = E_BAD_SYSCALL;
+            continue;
+        }
+
+        if( rec->code >= N_SYSCALLS ) {
+            rec->result = E_BAD_SYSCALL;
+            continue;
+        }
+
+        _syscalls[rec->code]( rec->args );
+
+        // did we lose the CPU?
+        if( _current != self ) {
+            return;
+        }
+
+        rec->result = (int32_t) RET(self);
+    }
+
+    RET(self) = n;
+}
+
+/**
+** _sys_getlat - retrieve a latency histogram
+**
+** implements:
+**    int32_t getlat( uint32_t which, lathist_t *hist );
+*/
+static void _sys_getlat( uint32_t args[4] ) {
+    RET(_current) = _lat_get( args[0], (lathist_t *) args[1] );
+}
+
+/**
+** _sys_kstats - retrieve the kernel statistics
+**
+** implements:
+**    int32_t kstats( kstats_t *stats );
+*/
+static void _sys_kstats( uint32_t args[4] ) {
+    kstats_t *ks = (kstats_t *) args[0];
+
+    if( ks == NULL ) {
+        RET(_current) = E_BAD_PARAM;
+        return;
+    }
+
+    __memclr( ks, sizeof(kstats_t) );
+
+    _blk_stats( ks );
+    _jnl_stats( ks );
+    _iob_stats( ks );
+    _iod_stats( ks );
+    _fs_stats( ks );
+    ks->pages_free = _km_pages_free();
+
+    RET(_current) = E_SUCCESS;
+}
+
+/**
+** _sys_profread - drain samples from the profiler's ring buffer
+**
+** implements:
+**    int32_t profread( profsample_t *buf, uint32_t max, uint32_t *dropped );
+*/
+static void _sys_profread( uint32_t args[4] ) {
+    profsample_t *buf = (profsample_t *) args[0];
+    uint32_t *dropped = (uint32_t *) args[2];
+
+    if( buf == NULL ) {
+        RET(_current) = E_BAD_PARAM;
+        return;
+    }
+
+    RET(_current) = _prof_read( buf, args[1] );
+
+    if( dropped != NULL ) {
+        *dropped = _prof_dropped_count();
+    }
+}
 
-    // first argument is the file name
-    char *filename = ( char *) args[0];
+/**
+** _sys_traceread - drain records from the I/O trace
+**
+** implements:
+**    int32_t traceread( trace_rec_t *buf, uint32_t max, trace_info_t *info );
+*/
+static void _sys_traceread( uint32_t args[4] ) {
+    trace_rec_t *buf = (trace_rec_t *) args[0];
+
+    if( buf == NULL ) {
+        RET(_current) = E_BAD_PARAM;
+        return;
+    }
 
-    // second argument is the string to be written
-    char *buf = ( char * ) args[1];
+    RET(_current) = _trc_read( buf, args[1], (trace_info_t *) args[2] );
+}
 
-    // third argument is length of the string(not including NULL-terminator)
-    int32_t buf_size = ( int32_t ) args[2];
+/**
+** _sys_nanotime - retrieve the time since boot, in nanoseconds
+**
+** implements:
+**    int32_t nanotime( uint64_t *ns );
+*/
+static void _sys_nanotime( uint32_t args[4] ) {
+    uint64_t *ns = (uint64_t *) args[0];
 
-    // call the function in filemanager
-    int size = _fs_write( filename, buf, buf_size );
+    if( ns == NULL ) {
+        RET(_current) = E_BAD_PARAM;
+        return;
+    }
 
-    // return the success value given by filemanager
-    RET(_current) = size;
+    *ns = _clk_ns();
+    RET(_current) = E_SUCCESS;
+}
+
+/**
+** _sys_iodwait - block the I/O daemon until there is work for it
+**
+** implements:
+**    int32_t iodwait( void );
+*/
+static void _sys_iodwait( uint32_t args[4] ) {
+    _iod_wait();
 }
 
 /**
@@ -465,6 +630,15 @@ static void _sys_kill( uint32_t args[4] ) {
     }
 }
 
+/**
+** _sys_wakeup - timer callback for a sleeping process
+**
+** @param t   The process' wakeup timer
+*/
+static void _sys_wakeup( ktimer_t *t ) {
+    _schedule( (pcb_t *) t->arg );
+}
+
 /**
 ** _sys_sleep - put the current process to sleep for some length of time
 **
@@ -485,13 +659,9 @@ static void _sys_sleep( uint32_t args[4] ) {
         _current->event.wakeup = _system_time + ticks;
         _current->state = Sleeping;
 
-        // add to the sleep queue
-        if( _que_enque(_sleeping,_current,_current->event.wakeup) !=
-                E_SUCCESS ) {
-            // something went wrong!
-            WARNING( "cannot enque(_sleeping,_current)" );
-            _schedule( _current );
-        }
+        // arm its wakeup timer
+        _clk_timer_init( &_current->timer, _sys_wakeup, _current );
+        _clk_timer_add( &_current->timer, ticks );
     }
 
     // either way, need a new "current" process
@@ -661,6 +831,17 @@ void _sys_init( void ) {
     _syscalls[ SYS_fclose ]   = _sys_fclose;
     _syscalls[ SYS_fread ]    = _sys_fread;
     _syscalls[ SYS_fwrite ]   = _sys_fwrite;
+    _syscalls[ SYS_freadv ]   = _sys_freadv;
+    _syscalls[ SYS_fwritev ]  = _sys_fwritev;
+    _syscalls[ SYS_ioring_setup ] = _sys_ioring_setup;
+    _syscalls[ SYS_ioring_enter ] = _sys_ioring_enter;
+    _syscalls[ SYS_getlat ]   = _sys_getlat;
+    _syscalls[ SYS_kstats ]   = _sys_kstats;
+    _syscalls[ SYS_profread ] = _sys_profread;
+    _syscalls[ SYS_traceread ] = _sys_traceread;
+    _syscalls[ SYS_nanotime ] = _sys_nanotime;
+    _syscalls[ SYS_iodwait ]  = _sys_iodwait;
+    _syscalls[ SYS_batch ]    = _sys_batch;
 
     // install the second-stage ISR
     __install_isr( INT_VEC_SYSCALL, _sys_isr );
@@ -680,6 +861,16 @@ void _sys_init( void ) {
 void _force_exit( pcb_t *victim, int32_t status ) {
     pid_t us = victim->pid;
 
+    // the kernel must stop looking at this process' ring; if the
+    // daemon is in the middle of an entry from it, the ring (and so
+    // the process' memory) is still in use, so leave the process
+    // Killed and let the daemon finish the exit when it is done
+    if( _ior_release(victim) ) {
+        victim->exit_status = status;
+        victim->state = Killed;
+        return;
+    }
+
     // reparent all the children of this process so that
     // when they terminate init() will collect them
     for( int i = 0; i < N_PROCS; ++i ) {
@@ -39,9 +39,20 @@
 #define SYS_fclose    15
 #define SYS_fread     16
 #define SYS_fwrite    17
+#define SYS_freadv    18
+#define SYS_fwritev   19
+#define SYS_ioring_setup  20
+#define SYS_ioring_enter  21
+#define SYS_batch     22
+#define SYS_getlat    23
+#define SYS_kstats    24
+#define SYS_profread  25
+#define SYS_traceread 26
+#define SYS_nanotime  27
+#define SYS_iodwait   28
 
 // UPDATE THIS DEFINITION IF MORE SYSCALLS ARE ADDED!
-#define N_SYSCALLS    18
+#define N_SYSCALLS    29
 
 // dummy system call code for testing our ISR
 #define SYS_bogus     0xbad
@@ -58,10 +69,25 @@
 ** the C compiler should be put here.
 */
 
+// most records accepted by a single batch() call
+#define N_BATCH       32
+
 /*
 ** Types
 */
 
+/*
+** One system call in a batch.  The result field receives what the
+** call would have returned had it been made on its own.
+*/
+typedef struct batch_rec_s {
+    uint32_t code;        // SYS_* code
+    uint32_t args[4];     // arguments, in the usual order
+    int32_t result;       // filled in by the kernel
+} batch_rec_t;
+
+#ifdef SP_KERNEL_SRC
+
 /*
 ** Globals
 */
@@ -87,6 +113,9 @@ void _sys_init( void );
 */
 void _force_exit( pcb_t *victim, int32_t status );
 
+#endif
+/* SP_KERNEL_SRC */
+
 #endif
 /* SP_ASM_SRC */
 
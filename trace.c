@@ -0,0 +1,165 @@
+/**
+** @file trace.c
+**
+** @author  CSCI-452 class of 20205
+**
+** I/O path event tracing implementation
+**
+** Tracepoints fire both in system calls (interrupts disabled) and in
+** the I/O daemon (interrupts enabled), so a writer can be interrupted
+** by another writer.  Neither takes a lock:  each reserves a slot with
+** a single atomic increment of the write position, fills it in, and
+** then commits it by storing its sequence number.  The reader only
+** runs with interrupts disabled, and stops at the first slot which
+** isn't committed yet.
+**
+** The buffer is a flight recorder:  writers never wait for the reader,
+** and records it hasn't gotten to are overwritten and counted as lost.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "trace.h"
+#include "process.h"
+#include "scheduler.h"
+#include "clock.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+/*
+** PRIVATE DATA TYPES
+*/
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// the ring buffer
+static trace_rec_t _trace[TRACE_RECS];
+
+// records reserved so far, and records read so far
+static volatile uint32_t _trc_next;
+static uint32_t _trc_read_pos;
+
+// records lost since the last _trc_read()
+static uint32_t _trc_lost;
+
+/*
+** PUBLIC GLOBAL VARIABLES
+*/
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/**
+** Name:  _trc_reserve
+**
+** Atomically claims the next position in the trace
+**
+** @return the position
+*/
+static uint32_t _trc_reserve( void ) {
+    uint32_t pos = 1;
+
+    __asm( "lock; xaddl %0,%1" : "+r" (pos), "+m" (_trc_next) );
+
+    return( pos );
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** Name:  _trc_init
+**
+** Initializes the tracing module
+*/
+void _trc_init( void ) {
+
+    __cio_puts( " Trace:" );
+
+    __memclr( _trace, sizeof(_trace) );
+    _trc_next = _trc_read_pos = 0;
+    _trc_lost = 0;
+
+#ifdef IOTRACE
+    __cio_printf( " done (mask %02x)", IOTRACE );
+#else
+    __cio_puts( " off" );
+#endif
+}
+
+/**
+** Name:  _trc_record
+**
+** Adds a record to the trace; may be called with interrupts enabled
+**
+** @param event  The TRC_* event code
+** @param a0     The first argument
+** @param a1     The second argument
+*/
+void _trc_record( uint32_t event, uint32_t a0, uint32_t a1 ) {
+    uint32_t pos = _trc_reserve();
+    volatile trace_rec_t *rec = &_trace[pos & (TRACE_RECS - 1)];
+
+    // the slot is not valid until we're done with it
+    rec->seq = 0;
+
+    rec->event = event;
+    rec->pid = _current != NULL ? _current->pid : 0;
+    rec->tsc = _clk_tsc();
+    rec->arg[0] = a0;
+    rec->arg[1] = a1;
+
+    // commit
+    rec->seq = pos + 1;
+}
+
+/**
+** Name:  _trc_read
+**
+** Removes the oldest unread records from the trace; must be called
+** with interrupts disabled
+**
+** @param buf    Where to put them
+** @param max    Most records to remove
+** @param info   If not NULL, receives the lost count and TSC rate
+**
+** @return the number of records removed
+*/
+uint32_t _trc_read( trace_rec_t *buf, uint32_t max, trace_info_t *info ) {
+    uint32_t next = _trc_next;
+    uint32_t n = 0;
+
+    // skip whatever has already been overwritten
+    if( next - _trc_read_pos > TRACE_RECS ) {
+        _trc_lost += next - _trc_read_pos - TRACE_RECS;
+        _trc_read_pos = next - TRACE_RECS;
+    }
+
+    while( n < max && _trc_read_pos != next ) {
+        trace_rec_t *rec = &_trace[_trc_read_pos & (TRACE_RECS - 1)];
+
+        // an interrupted writer hasn't finished this one
+        if( rec->seq != _trc_read_pos + 1 ) {
+            break;
+        }
+
+        buf[n++] = *rec;
+        ++_trc_read_pos;
+    }
+
+    if( info != NULL ) {
+        info->lost = _trc_lost;
+        info->tsc_khz = _clk_tsc_khz();
+        _trc_lost = 0;
+    }
+
+    return( n );
+}
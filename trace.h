@@ -0,0 +1,141 @@
+/*
+** @file trace.h
+**
+** @author CSCI-452 class of 20205
+**
+** I/O path event tracing declarations
+**
+** When the kernel is built with IOTRACE=mask, tracepoints along the
+** I/O path write fixed-size records into a ring buffer.  The mask
+** selects which classes of event are recorded (TRC_FS, TRC_BLK,
+** TRC_AHCI, TRC_SCHED); tracepoints in other classes, and all of
+** them when IOTRACE is not defined, compile to nothing.
+**
+** The buffer keeps the most recent TRACE_RECS records.  It is drained
+** with the traceread() system call; in a tracing build, init starts
+** the traced process, which writes the records to the serial line for
+** TraceDecode to turn into per-request latency breakdowns.
+*/
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "common.h"
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+// number of records the ring buffer holds (must be a power of two)
+#define TRACE_RECS      1024
+
+// event classes, for the IOTRACE mask
+#define TRC_FS          0x01    // file system calls and the I/O daemon
+#define TRC_BLK         0x02    // block layer disk requests
+#define TRC_AHCI        0x04    // AHCI commands
+#define TRC_SCHED       0x08    // dispatches
+
+// the class of an event is given by its upper four bits
+#define TRC_CLASS(ev)   (1 << ((ev) >> 4))
+
+// events, and what their arguments are
+#define TRC_IOD_SUBMIT  0x01    // call queued for daemon: SYS code, 0
+#define TRC_FS_ENTER    0x02    // daemon starts call: SYS code, caller PID
+#define TRC_FS_EXIT     0x03    // daemon finishes call: SYS code, result
+#define TRC_IOR_ENTER   0x04    // ring entry starts: IOR op, 0
+#define TRC_IOR_EXIT    0x05    // ring entry finishes: IOR op, result
+#define TRC_BLK_ISSUE   0x11    // disk request: first block, count
+#define TRC_BLK_DONE    0x12    // request complete: write?, success?
+#define TRC_AHCI_ISSUE  0x21    // command issued: slot, LBA (low 32 bits)
+#define TRC_AHCI_DONE   0x22    // command complete: slot, success?
+#define TRC_DISPATCH    0x31    // new current process: PID, priority
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+/*
+** Types
+*/
+
+// one trace record
+typedef struct trace_rec_s {
+    uint32_t seq;       // position in the trace, starting at 1
+    uint16_t event;     // TRC_* event code
+    uint16_t pid;       // current process when it happened
+    uint64_t tsc;       // time stamp counter when it happened
+    uint32_t arg[2];    // event-specific
+} trace_rec_t;
+
+// what traceread() reports besides the records
+typedef struct trace_info_s {
+    uint32_t lost;      // records overwritten before they were read
+    uint32_t tsc_khz;   // TSC rate, for converting time stamps
+} trace_info_t;
+
+#ifdef SP_KERNEL_SRC
+
+/*
+** Tracepoint macro
+*/
+
+#ifdef IOTRACE
+#define TRACE_EV(ev,a0,a1) \
+    do { \
+        if( (IOTRACE) & TRC_CLASS(ev) ) { \
+            _trc_record( (ev), (uint32_t) (a0), (uint32_t) (a1) ); \
+        } \
+    } while(0)
+#else
+#define TRACE_EV(ev,a0,a1)  ((void) 0)
+#endif
+
+/*
+** Globals
+*/
+
+/*
+** Prototypes
+*/
+
+/**
+** Name:  _trc_init
+**
+** Initializes the tracing module
+*/
+void _trc_init( void );
+
+/**
+** Name:  _trc_record
+**
+** Adds a record to the trace; may be called with interrupts enabled
+**
+** @param event  The TRC_* event code
+** @param a0     The first argument
+** @param a1     The second argument
+*/
+void _trc_record( uint32_t event, uint32_t a0, uint32_t a1 );
+
+/**
+** Name:  _trc_read
+**
+** Removes the oldest unread records from the trace; must be called
+** with interrupts disabled
+**
+** @param buf    Where to put them
+** @param max    Most records to remove
+** @param info   If not NULL, receives the lost count and TSC rate
+**
+** @return the number of records removed
+*/
+uint32_t _trc_read( trace_rec_t *buf, uint32_t max, trace_info_t *info );
+
+#endif
+/* SP_KERNEL_SRC */
+
+#endif
+/* SP_ASM_SRC */
+
+#endif
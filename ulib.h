@@ -10,6 +10,12 @@
 #define ULIB_H_
 
 #include "common.h"
+#include "syscalls.h"
+#include "ioring.h"
+#include "lathist.h"
+#include "kstats.h"
+#include "profile.h"
+#include "trace.h"
 
 /*
 ** General (C and/or assembly) definitions
@@ -25,6 +31,14 @@
 ** Types
 */
 
+/*
+** A batch of system calls being built up by batch_add()
+*/
+typedef struct batch_s {
+    uint32_t count;             // records in use
+    batch_rec_t rec[N_BATCH];   // the records
+} batch_t;
+
 /*
 ** Globals
 */
@@ -182,6 +196,224 @@ pid_t spawn( int (*entry)(uint32_t,uint32_t), prio_t, uint32_t, uint32_t );
 */
 int32_t wait( int32_t *status );
 
+/**
+** fcreate - create a file
+**
+** usage:   n = fcreate(name);
+**
+** @param name  The name of the file (at most 15 characters)
+**
+** @returns 0 on success, else an error code
+*/
+int32_t fcreate( char *name );
+
+/**
+** fdelete - delete a file
+**
+** usage:   n = fdelete(name);
+**
+** @param name  The name of the file
+**
+** @returns 0 on success, else an error code
+*/
+int32_t fdelete( char *name );
+
+/**
+** fopen - open a file for reading and writing
+**
+** usage:   n = fopen(name);
+**
+** @param name  The name of the file
+**
+** @returns 0 on success, else an error code
+*/
+int32_t fopen( char *name );
+
+/**
+** fclose - close an open file
+**
+** usage:   n = fclose(name);
+**
+** @param name  The name of the file
+**
+** @returns 0 on success, else an error code
+*/
+int32_t fclose( char *name );
+
+/**
+** fread - read the contents of an open file
+**
+** usage:   n = fread(name,buf);
+**
+** @param name  The name of the file
+** @param buf   Buffer to read into; must hold the file plus a NUL
+**
+** @returns The count of bytes transferred (including the NUL),
+**          or an error code
+*/
+int32_t fread( char *name, char *buf );
+
+/**
+** fwrite - append to an open file
+**
+** usage:   n = fwrite(name,buf,length);
+**
+** @param name   The name of the file
+** @param buf    Buffer to write from
+** @param length Number of bytes to write
+**
+** @returns 0 on success, else an error code
+*/
+int32_t fwrite( char *name, char *buf, int length );
+
+/**
+** freadv - read the contents of an open file into several buffers
+**
+** usage:   n = freadv(name,iov,iovcnt);
+**
+** @param name   The name of the file
+** @param iov    The buffers to fill, in order
+** @param iovcnt Number of entries in iov (at most N_IOVECS)
+**
+** @returns The count of bytes transferred, or an error code
+*/
+int32_t freadv( char *name, iovec_t *iov, int iovcnt );
+
+/**
+** fwritev - append several buffers to an open file
+**
+** usage:   n = fwritev(name,iov,iovcnt);
+**
+** The buffers are written in order with a single system call.
+**
+** @param name   The name of the file
+** @param iov    The buffers to write, in order
+** @param iovcnt Number of entries in iov (at most N_IOVECS)
+**
+** @returns The count of bytes transferred, or an error code
+*/
+int32_t fwritev( char *name, iovec_t *iov, int iovcnt );
+
+/**
+** ioring_setup - register a submission/completion ring
+**
+** usage:   n = ioring_setup(ring,flags);
+**
+** The ring is emptied; any ring registered earlier is forgotten.
+**
+** @param ring  The ring, which must stay valid until the process exits
+** @param flags IORING_SQPOLL to have the kernel drain it without
+**              ioring_enter() calls, else 0
+**
+** @returns 0 on success, else an error code
+*/
+int32_t ioring_setup( ioring_t *ring, uint32_t flags );
+
+/**
+** ioring_enter - submit entries from the registered ring
+**
+** usage:   n = ioring_enter(count);
+**
+** Every entry submitted has completed when this returns.
+**
+** @param to_submit Most entries to take from the submission queue
+**
+** @returns The number of entries submitted, or an error code
+*/
+int32_t ioring_enter( uint32_t to_submit );
+
+/**
+** batch - perform several system calls with a single trap
+**
+** usage:   n = batch(recs,count);
+**
+** Each record's result field receives that call's return value.
+** Calls that can block (exit, read, sleep, wait, the file calls,
+** ioring_enter and batch) may not be batched; their records get
+** E_BAD_SYSCALL.
+**
+** @param recs  The calls to make, in order
+** @param count Number of records (at most N_BATCH)
+**
+** @returns The number of records processed, or an error code
+*/
+int32_t batch( batch_rec_t *recs, uint32_t count );
+
+/**
+** getlat - retrieve one of the kernel's latency histograms
+**
+** usage:   status = getlat(which,&hist);
+**
+** @param which The histogram to retrieve (LAT_*)
+** @param hist  Where to put it
+**
+** @returns E_SUCCESS, or E_BAD_PARAM for an unknown histogram
+*/
+int32_t getlat( uint32_t which, lathist_t *hist );
+
+/**
+** kstats - retrieve the kernel's file system, disk and memory statistics
+**
+** usage:   status = kstats(&stats);
+**
+** @param stats Where to put them
+**
+** @returns E_SUCCESS, or E_BAD_PARAM
+*/
+int32_t kstats( kstats_t *stats );
+
+/**
+** profread - drain samples from the kernel profiler
+**
+** usage:   n = profread(buf,max,&dropped);
+**
+** @param buf     Where to put the samples, oldest first
+** @param max     Most samples to take
+** @param dropped If not NULL, receives the number of samples lost
+**                to a full buffer since the last call
+**
+** @returns the number of samples taken, or E_BAD_PARAM
+*/
+int32_t profread( profsample_t *buf, uint32_t max, uint32_t *dropped );
+
+/**
+** traceread - drain records from the kernel's I/O trace
+**
+** usage:   n = traceread(buf,max,&info);
+**
+** @param buf   Where to put the records, oldest first
+** @param max   Most records to take
+** @param info  If not NULL, receives the number of records lost since
+**              the last call and the TSC rate
+**
+** @returns the number of records taken, or E_BAD_PARAM
+*/
+int32_t traceread( trace_rec_t *buf, uint32_t max, trace_info_t *info );
+
+/**
+** nanotime - retrieve the time since the system started, in nanoseconds
+**
+** usage:   status = nanotime(&ns);
+**
+** Measured with the TSC, so much finer-grained than gettime()
+**
+** @param ns  Where to put it
+**
+** @returns E_SUCCESS, or E_BAD_PARAM
+*/
+int32_t nanotime( uint64_t *ns );
+
+/**
+** iodwait - block the I/O daemon until a file system call is submitted
+**
+** usage:   status = iodwait();
+**
+** Only the I/O daemon may use this; anyone else gets E_BAD_SYSCALL
+**
+** @returns E_SUCCESS, or E_BAD_SYSCALL
+*/
+int32_t iodwait( void );
+
 /**
 ** bogus - a bogus system call, for testing our syscall ISR
 **
@@ -252,6 +484,73 @@ int32_t swrites( const char *str );
 */
 int32_t swrite( const char *buf, uint32_t size );
 
+/*
+**********************************************
+** SYSTEM CALL BATCH HELPERS
+**********************************************
+*/
+
+/**
+** batch_init(b) - start an empty batch
+**
+** @param b  The batch
+*/
+void batch_init( batch_t *b );
+
+/**
+** batch_add(b,code,a1,a2,a3,a4) - append a call to a batch
+**
+** @param b     The batch
+** @param code  SYS_* code of the call
+** @param a1-a4 Arguments to the call (unused ones are ignored)
+**
+** @returns The index of the new record, or E_FAILURE if the batch is full
+*/
+int32_t batch_add( batch_t *b, uint32_t code, uint32_t a1, uint32_t a2,
+                   uint32_t a3, uint32_t a4 );
+
+/**
+** batch_run(b) - make all the calls in a batch, then empty it
+**
+** Results stay in b->rec[i].result until the next batch_add().
+**
+** @param b  The batch
+**
+** @returns The return value from calling batch()
+*/
+int32_t batch_run( batch_t *b );
+
+/*
+**********************************************
+** SUBMISSION/COMPLETION RING HELPERS
+**********************************************
+*/
+
+/**
+** ioring_prep(ring,op,name,buf,len,user_data) - queue a ring request
+**
+** @param ring      The ring
+** @param op        IOR_* operation code
+** @param name      The file to operate on
+** @param buf       Data buffer (or iovec_t array)
+** @param len       Byte count (or iovec_t count)
+** @param user_data Value to be returned with the completion
+**
+** @returns 0 on success, or E_FAILURE if the submission queue is full
+*/
+int32_t ioring_prep( ioring_t *ring, uint8_t op, char *name, void *buf,
+                     uint32_t len, uint32_t user_data );
+
+/**
+** ioring_reap(ring,cqe) - take the next completion from a ring
+**
+** @param ring  The ring
+** @param cqe   Where to copy the completion
+**
+** @returns 1 if a completion was copied, 0 if there was none
+*/
+int32_t ioring_reap( ioring_t *ring, ior_cqe_t *cqe );
+
 /*
 **********************************************
 ** STRING MANIPULATION FUNCTIONS
@@ -107,6 +107,123 @@ int32_t swrite( const char *buf, uint32_t size ) {
    return( write(CHAN_SIO,buf,size) );
 }
 
+/*
+**********************************************
+** SYSTEM CALL BATCH HELPERS
+**********************************************
+*/
+
+/**
+** batch_init(b) - start an empty batch
+**
+** @param b  The batch
+*/
+void batch_init( batch_t *b ) {
+    b->count = 0;
+}
+
+/**
+** batch_add(b,code,a1,a2,a3,a4) - append a call to a batch
+**
+** @param b     The batch
+** @param code  SYS_* code of the call
+** @param a1-a4 Arguments to the call (unused ones are ignored)
+**
+** @returns The index of the new record, or E_FAILURE if the batch is full
+*/
+int32_t batch_add( batch_t *b, uint32_t code, uint32_t a1, uint32_t a2,
+                   uint32_t a3, uint32_t a4 ) {
+
+    if( b->count >= N_BATCH ) {
+        return( E_FAILURE );
+    }
+
+    batch_rec_t *rec = &b->rec[ b->count ];
+    rec->code = code;
+    rec->args[0] = a1;
+    rec->args[1] = a2;
+    rec->args[2] = a3;
+    rec->args[3] = a4;
+    rec->result = 0;
+
+    return( b->count++ );
+}
+
+/**
+** batch_run(b) - make all the calls in a batch, then empty it
+**
+** Results stay in b->rec[i].result until the next batch_add().
+**
+** @param b  The batch
+**
+** @returns The return value from calling batch()
+*/
+int32_t batch_run( batch_t *b ) {
+    int32_t n = batch( b->rec, b->count );
+    b->count = 0;
+    return( n );
+}
+
+/*
+**********************************************
+** SUBMISSION/COMPLETION RING HELPERS
+**********************************************
+*/
+
+/**
+** ioring_prep(ring,op,name,buf,len,user_data) - queue a ring request
+**
+** @param ring      The ring
+** @param op        IOR_* operation code
+** @param name      The file to operate on
+** @param buf       Data buffer (or iovec_t array)
+** @param len       Byte count (or iovec_t count)
+** @param user_data Value to be returned with the completion
+**
+** @returns 0 on success, or E_FAILURE if the submission queue is full
+*/
+int32_t ioring_prep( ioring_t *ring, uint8_t op, char *name, void *buf,
+                     uint32_t len, uint32_t user_data ) {
+    uint32_t tail = ring->sq_tail;
+
+    if( tail - ring->sq_head >= IORING_SQ_ENTRIES ) {
+        return( E_FAILURE );
+    }
+
+    ior_sqe_t *sqe = &ring->sq[ tail & (IORING_SQ_ENTRIES - 1) ];
+    sqe->op = op;
+    sqe->name = name;
+    sqe->buf = buf;
+    sqe->len = len;
+    sqe->user_data = user_data;
+
+    // the entry must be complete before the kernel can see it
+    ring->sq_tail = tail + 1;
+
+    return( E_SUCCESS );
+}
+
+/**
+** ioring_reap(ring,cqe) - take the next completion from a ring
+**
+** @param ring  The ring
+** @param cqe   Where to copy the completion
+**
+** @returns 1 if a completion was copied, 0 if there was none
+*/
+int32_t ioring_reap( ioring_t *ring, ior_cqe_t *cqe ) {
+    uint32_t head = ring->cq_head;
+
+    if( head == ring->cq_tail ) {
+        return( 0 );
+    }
+
+    *cqe = ring->cq[ head & (IORING_CQ_ENTRIES - 1) ];
+    ring->cq_head = head + 1;
+
+    return( 1 );
+}
+
 /*
 **********************************************
 ** STRING MANIPULATION FUNCTIONS
@@ -0,0 +1,422 @@
+#ifndef FSBENCH_H_
+#define FSBENCH_H_
+
+/**
+** File system benchmark:  fcreate, fdelete, fopen, fclose, fread,
+** fwrite, nanotime, write, sleep, exit
+**
+** Times each file system call it makes with nanotime(), and writes
+** one line of results per test to the SIO in CSV form:
+**
+**      @B test,size,ops,errors,usec,ops_per_sec,kb_per_sec,p50_ns,p90_ns,p99_ns,max_ns
+**
+** The first line is that header; after the last test, "@E n" gives
+** the total number of failed calls.  Each line starts with a newline
+** so that characters written by other processes can't run into it.
+** 'usec' is the time spent in the timed calls only, and the
+** latencies are percentiles of the individual calls.  The tests are
+**
+**      create, open, close, delete     size = number of files
+**      append                          size = bytes per fwrite()
+**      write, read                     size = file size
+**      randread                        size = file size
+**      scale_create, scale_open        size = files in existence
+**
+** write creates, fills, closes and deletes a file each time, timing
+** only the fwrite().  The file system has no positional reads, so
+** randread reads whole files chosen at random from a small set.  The
+** scale_ tests grow the file system to 16, 32, ... n files, timing
+** the creates needed for each step and then open/close pairs on
+** random files at that size.  The write and read sizes go up to the
+** first one the file system can't hold, which is reported as a write
+** error but not counted in the total.
+**
+** The same code is built into hosted/fsbench, which runs the file
+** system directly over a disk image file.
+**
+** Invoked as:  fsbench  x  n
+**   where x is ignored
+**         n is the most files to create (defaults to, and is limited
+**           to, FSB_MAX_FILES)
+*/
+
+// limits
+#define FSB_MAX_FILES   256     // most files in existence at once
+#define FSB_MAX_SIZE    65536   // largest file size tried
+#define FSB_SAMPLES     256     // most calls timed in one test
+
+// test parameters
+#define FSB_ITERS       16      // files written or read at each size
+#define FSB_APPENDS     64      // appends to one file
+#define FSB_APPEND_SIZE 64      // bytes in each
+#define FSB_RAND_FILES  16      // files randread chooses among
+#define FSB_RAND_SIZE   4096    // size of each
+#define FSB_RAND_READS  256     // reads it does
+#define FSB_LOOKUPS     64      // open/close pairs at each scale step
+
+// latencies of the calls in the current test
+static uint32_t fsb_lat[FSB_SAMPLES];
+static uint32_t fsb_ops;
+static uint32_t fsb_errors;
+static uint64_t fsb_elapsed;
+static uint64_t fsb_bytes;
+
+// failed calls in all tests
+static uint32_t fsb_total_errors;
+
+// file contents
+static char fsb_buf[FSB_MAX_SIZE + 1];
+
+// for choosing files at random (fixed, so runs are repeatable)
+static uint32_t fsb_seed = 1;
+
+/*
+** Current time, in nanoseconds
+*/
+static uint64_t fsb_now( void ) {
+    uint64_t ns;
+
+    nanotime( &ns );
+    return( ns );
+}
+
+/*
+** 64-bit division, without help from libgcc
+*/
+static uint64_t fsb_div( uint64_t n, uint64_t d ) {
+    uint64_t q = 0, r = 0;
+
+    if( d == 0 ) {
+        return( 0 );
+    }
+
+    for( int i = 63; i >= 0; --i ) {
+        r = (r << 1) | ((n >> i) & 1);
+        if( r >= d ) {
+            r -= d;
+            q |= 1ULL << i;
+        }
+    }
+
+    return( q );
+}
+
+/*
+** Pseudo-random number
+*/
+static uint32_t fsb_rand( void ) {
+    fsb_seed = fsb_seed * 1103515245 + 12345;
+    return( fsb_seed >> 16 );
+}
+
+/*
+** Writes a line to the SIO, then gives the SIO time to send it
+*/
+static void fsb_put( const char *line ) {
+    sleep( swrites( line ) );
+}
+
+/*
+** Name of the i'th file with a given prefix
+*/
+static void fsb_name( char *dst, char prefix, int i ) {
+    sprint( dst, "fsb%c%d", prefix, i );
+}
+
+/*
+** Starts a test
+*/
+static void fsb_begin( void ) {
+    fsb_ops = fsb_errors = 0;
+    fsb_elapsed = fsb_bytes = 0;
+}
+
+/*
+** Records one timed call
+**
+** @param start  When it started
+** @param ok     Did it succeed?
+** @param bytes  Bytes it transferred
+*/
+static void fsb_sample( uint64_t start, int ok, uint32_t bytes ) {
+    uint64_t ns = fsb_now() - start;
+
+    fsb_elapsed += ns;
+    if( !ok ) {
+        ++fsb_errors;
+        return;
+    }
+
+    if( fsb_ops < FSB_SAMPLES ) {
+        fsb_lat[fsb_ops] = ns > 0xffffffffULL ? 0xffffffff : (uint32_t) ns;
+    }
+    ++fsb_ops;
+    fsb_bytes += bytes;
+}
+
+/*
+** Writes the results of a test
+**
+** @param test  Name of the test
+** @param size  Its size parameter
+*/
+static void fsb_report( const char *test, uint32_t size ) {
+    uint32_t n = fsb_ops < FSB_SAMPLES ? fsb_ops : FSB_SAMPLES;
+    uint32_t pct[4] = { 0, 0, 0, 0 };
+    char line[160];
+
+    // insertion sort; there aren't many
+    for( uint32_t i = 1; i < n; ++i ) {
+        uint32_t v = fsb_lat[i];
+        uint32_t j = i;
+        while( j > 0 && fsb_lat[j-1] > v ) {
+            fsb_lat[j] = fsb_lat[j-1];
+            --j;
+        }
+        fsb_lat[j] = v;
+    }
+
+    if( n > 0 ) {
+        pct[0] = fsb_lat[(n - 1) * 50 / 100];
+        pct[1] = fsb_lat[(n - 1) * 90 / 100];
+        pct[2] = fsb_lat[(n - 1) * 99 / 100];
+        pct[3] = fsb_lat[n - 1];
+    }
+
+    sprint( line, "\n@B %s,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n", test, size,
+            fsb_ops, fsb_errors, (uint32_t) fsb_div( fsb_elapsed, 1000 ),
+            (uint32_t) fsb_div( (uint64_t) fsb_ops * 1000000000, fsb_elapsed ),
+            (uint32_t) fsb_div( fsb_bytes * 1000000000, fsb_elapsed * 1024 ),
+            pct[0], pct[1], pct[2], pct[3] );
+    fsb_put( line );
+
+    fsb_total_errors += fsb_errors;
+}
+
+/*
+** create, open, close and delete n files
+*/
+static void fsb_meta( int n ) {
+    char name[16];
+    uint64_t t;
+    int i;
+
+    fsb_begin();
+    for( i = 0; i < n; ++i ) {
+        fsb_name( name, 'm', i );
+        t = fsb_now();
+        fsb_sample( t, fcreate( name ) >= 0, 0 );
+    }
+    fsb_report( "create", n );
+
+    fsb_begin();
+    for( i = 0; i < n; ++i ) {
+        fsb_name( name, 'm', i );
+        t = fsb_now();
+        fsb_sample( t, fopen( name ) >= 0, 0 );
+    }
+    fsb_report( "open", n );
+
+    fsb_begin();
+    for( i = 0; i < n; ++i ) {
+        fsb_name( name, 'm', i );
+        t = fsb_now();
+        fsb_sample( t, fclose( name ) >= 0, 0 );
+    }
+    fsb_report( "close", n );
+
+    fsb_begin();
+    for( i = 0; i < n; ++i ) {
+        fsb_name( name, 'm', i );
+        t = fsb_now();
+        fsb_sample( t, fdelete( name ) >= 0, 0 );
+    }
+    fsb_report( "delete", n );
+}
+
+/*
+** Small writes to the end of one file
+*/
+static void fsb_append( void ) {
+    char *name = "fsba";
+    uint64_t t;
+
+    fcreate( name );
+    fopen( name );
+
+    fsb_begin();
+    for( int i = 0; i < FSB_APPENDS; ++i ) {
+        t = fsb_now();
+        fsb_sample( t, fwrite( name, fsb_buf, FSB_APPEND_SIZE ) >= 0,
+                    FSB_APPEND_SIZE );
+    }
+    fsb_report( "append", FSB_APPEND_SIZE );
+
+    fclose( name );
+    fdelete( name );
+}
+
+/*
+** Whole-file writes and reads of one size
+**
+** @return false if files of this size don't fit in the file system
+*/
+static bool_t fsb_rw( uint32_t size ) {
+    char *name = "fsbw";
+    uint64_t t;
+    int ok;
+
+    fsb_begin();
+    for( int i = 0; i < FSB_ITERS; ++i ) {
+        fcreate( name );
+        fopen( name );
+        t = fsb_now();
+        ok = fwrite( name, fsb_buf, size ) >= 0;
+        fsb_sample( t, ok, size );
+        fclose( name );
+        fdelete( name );
+        if( !ok ) {
+            break;
+        }
+    }
+    fsb_report( "write", size );
+
+    // too big for the file system, rather than a failure
+    if( fsb_ops == 0 ) {
+        fsb_total_errors -= fsb_errors;
+        return( false );
+    }
+
+    fsb_begin();
+    fcreate( name );
+    fopen( name );
+    if( fwrite( name, fsb_buf, size ) < 0 ) {
+        ++fsb_errors;
+    } else {
+        for( int i = 0; i < FSB_ITERS; ++i ) {
+            t = fsb_now();
+            fsb_sample( t, fread( name, fsb_buf ) >= (int32_t) size, size );
+        }
+    }
+    fsb_report( "read", size );
+    fclose( name );
+    fdelete( name );
+
+    return( true );
+}
+
+/*
+** Whole-file reads of files chosen at random
+*/
+static void fsb_random( void ) {
+    char name[16];
+    uint64_t t;
+    int i;
+
+    for( i = 0; i < FSB_RAND_FILES; ++i ) {
+        fsb_name( name, 'r', i );
+        fcreate( name );
+        fopen( name );
+        fwrite( name, fsb_buf, FSB_RAND_SIZE );
+    }
+
+    fsb_begin();
+    for( i = 0; i < FSB_RAND_READS; ++i ) {
+        fsb_name( name, 'r', fsb_rand() % FSB_RAND_FILES );
+        t = fsb_now();
+        fsb_sample( t, fread( name, fsb_buf ) >= FSB_RAND_SIZE,
+                    FSB_RAND_SIZE );
+    }
+    fsb_report( "randread", FSB_RAND_SIZE );
+
+    for( i = 0; i < FSB_RAND_FILES; ++i ) {
+        fsb_name( name, 'r', i );
+        fclose( name );
+        fdelete( name );
+    }
+}
+
+/*
+** Metadata operations as the number of files grows to n
+*/
+static void fsb_scale( int n ) {
+    char name[16];
+    uint64_t t;
+    int have = 0;
+    int ok;
+
+    for( int want = n < 16 ? n : 16; want <= n; want *= 2 ) {
+
+        fsb_begin();
+        while( have < want ) {
+            fsb_name( name, 's', have );
+            t = fsb_now();
+            ok = fcreate( name ) >= 0;
+            fsb_sample( t, ok, 0 );
+            if( !ok ) {
+                break;
+            }
+            ++have;
+        }
+        fsb_report( "scale_create", want );
+
+        if( have < want ) {
+            break;
+        }
+
+        fsb_begin();
+        for( int i = 0; i < FSB_LOOKUPS; ++i ) {
+            fsb_name( name, 's', fsb_rand() % have );
+            t = fsb_now();
+            ok = fopen( name ) >= 0;
+            ok = fclose( name ) >= 0 && ok;
+            fsb_sample( t, ok, 0 );
+        }
+        fsb_report( "scale_open", want );
+    }
+
+    while( have > 0 ) {
+        fsb_name( name, 's', --have );
+        fdelete( name );
+    }
+}
+
+int32_t fsbench( uint32_t arg1, uint32_t arg2 ) {
+    int files = FSB_MAX_FILES;
+    char buf[32];
+
+    (void) arg1;
+    if( arg2 > 0 && arg2 < FSB_MAX_FILES ) {
+        files = arg2;
+    }
+
+    cwrites( "fsbench started\n" );
+
+    for( int i = 0; i < FSB_MAX_SIZE; ++i ) {
+        fsb_buf[i] = 'a' + i % 26;
+    }
+
+    fsb_put( "\n@B test,size,ops,errors,usec,ops_per_sec,kb_per_sec,"
+             "p50_ns,p90_ns,p99_ns,max_ns\n" );
+
+    fsb_meta( files );
+    fsb_append();
+    for( uint32_t size = 512; size <= FSB_MAX_SIZE; size *= 2 ) {
+        if( !fsb_rw( size ) ) {
+            break;
+        }
+    }
+    fsb_random();
+    fsb_scale( files );
+
+    sprint( buf, "\n@E %d\n", fsb_total_errors );
+    fsb_put( buf );
+
+    cwrites( "fsbench done\n" );
+
+    exit( fsb_total_errors == 0 ? 0 : 1 );
+
+    return( 42 );  // shut the compiler up!
+}
+
+#endif
@@ -50,6 +50,22 @@ int init( uint32_t arg1, uint32_t arg2 ) {
         cwrites( "init, spawn() of idle failed!!!\n" );
     }
 
+#ifdef PROFILE
+    // next, the process that collects the profiler's samples
+    whom = spawn( profd, PRIO_STD, 'p', 0 );
+    if( whom < 0 ) {
+        cwrites( "init, spawn() of profd failed!!!\n" );
+    }
+#endif
+
+#ifdef IOTRACE
+    // and the one that collects the I/O trace
+    whom = spawn( traced, PRIO_STD, 't', 0 );
+    if( whom < 0 ) {
+        cwrites( "init, spawn() of traced failed!!!\n" );
+    }
+#endif
+
     /*
     ** Start all the other users
     */
@@ -278,6 +294,17 @@ int init( uint32_t arg1, uint32_t arg2 ) {
 
     // Users W through Z are spawned elsewhere
 
+    // The file system benchmark
+
+#ifdef SPAWN_BENCH
+    // "fsbench b 128"
+    whom = spawn( fsbench, PRIO_STD, 'b', 128 );
+    if( whom < 0 ) {
+        cwrites( "init, spawn() of fsbench failed\n" );
+    }
+    swritech( ch );
+#endif
+
     swrites( "!\r\n\n" );
 
     /*
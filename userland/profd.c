@@ -0,0 +1,76 @@
+#ifndef PROFD_H_
+#define PROFD_H_
+
+/**
+** Profile drain process:  profread, write, sleep
+**
+** Empties the kernel profiler's sample buffer every so often and
+** writes each sample to the SIO on a line of its own, as
+**
+**      @P pid eip
+**
+** with both values in hex.  A line "@D n" reports n samples lost
+** because the buffer filled up.  Each line starts with a newline so
+** that characters written by other processes can't run into it;
+** ProfReport picks these lines out of the rest of the SIO output.
+**
+** At 9600 baud the SIO can carry about 50 samples per second, so a
+** profiling kernel should sample no more often than that (for
+** example, PROFILE=20); samples taken faster than they can be sent
+** are dropped and reported as such.
+**
+** Invoked as:  profd  x  n
+**   where x is ignored
+**         n is the time between drains, in ms (defaults to 1000)
+*/
+
+// samples taken per profread() call
+#define PROFD_BATCH 32
+
+int32_t profd( uint32_t arg1, uint32_t arg2 ) {
+    profsample_t samples[PROFD_BATCH];
+    uint32_t period = 1000;   // default drain interval
+    uint32_t dropped;
+    char buf[64];
+
+    (void) arg1;
+    if( arg2 > 0 ) {
+        period = arg2;
+    }
+
+    cwrites( "profd started\n" );
+
+    for(;;) {
+        int32_t n = profread( samples, PROFD_BATCH, &dropped );
+        uint32_t sent = 0;
+
+        if( dropped > 0 ) {
+            sprint( buf, "\n@D %x\n", dropped );
+            sent += swrites( buf );
+        }
+
+        for( int32_t i = 0; i < n; ++i ) {
+            sprint( buf, "\n@P %x %x\n", samples[i].pid, samples[i].eip );
+            sent += swrites( buf );
+        }
+
+        // the SIO runs at 9600 baud, about a character per ms; give
+        // it time to send this batch before the next one, so the
+        // output buffer never overflows
+        if( n == PROFD_BATCH ) {
+            sleep( sent );
+        } else {
+            sleep( period > sent ? period : sent );
+        }
+    }
+
+    // we should never reach this point!
+
+    cwrites( "+++ profd done !?!?!\n" );
+
+    exit( 1 );
+
+    return( 42 );  // shut the compiler up!
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef TRACED_H_
+#define TRACED_H_
+
+/**
+** Trace drain process:  traceread, write, sleep
+**
+** Empties the kernel's I/O trace every so often and writes each
+** record to the SIO on a line of its own, as
+**
+**      @T seq event pid tsc-high tsc-low arg0 arg1
+**
+** with all values in hex.  Each batch is preceded by "@K khz", giving
+** the TSC rate, and by "@L n" if n records were lost since the last
+** batch.  Each line starts with a newline so that characters written
+** by other processes can't run into it; TraceDecode picks these lines
+** out of the rest of the SIO output.
+**
+** At 9600 baud the SIO can carry about 20 records per second, so for
+** anything but a short burst of I/O, choose the IOTRACE classes with
+** care; dispatch events in particular are plentiful.
+**
+** Invoked as:  traced  x  n
+**   where x is ignored
+**         n is the time between drains, in ms (defaults to 1000)
+*/
+
+// records taken per traceread() call
+#define TRACED_BATCH 16
+
+int32_t traced( uint32_t arg1, uint32_t arg2 ) {
+    trace_rec_t recs[TRACED_BATCH];
+    trace_info_t info;
+    uint32_t period = 1000;   // default drain interval
+    char buf[96];
+
+    (void) arg1;
+    if( arg2 > 0 ) {
+        period = arg2;
+    }
+
+    cwrites( "traced started\n" );
+
+    for(;;) {
+        int32_t n = traceread( recs, TRACED_BATCH, &info );
+        uint32_t sent = 0;
+
+        if( n > 0 ) {
+            sprint( buf, "\n@K %x\n", info.tsc_khz );
+            sent += swrites( buf );
+        }
+
+        if( info.lost > 0 ) {
+            sprint( buf, "\n@L %x\n", info.lost );
+            sent += swrites( buf );
+        }
+
+        for( int32_t i = 0; i < n; ++i ) {
+            trace_rec_t *r = &recs[i];
+            sprint( buf, "\n@T %x %x %x %x %x %x %x\n", r->seq, r->event,
+                    r->pid, (uint32_t) (r->tsc >> 32), (uint32_t) r->tsc,
+                    r->arg[0], r->arg[1] );
+            sent += swrites( buf );
+        }
+
+        // the SIO runs at 9600 baud, about a character per ms; give
+        // it time to send this batch before the next one, so the
+        // output buffer never overflows
+        if( n == TRACED_BATCH ) {
+            sleep( sent );
+        } else {
+            sleep( period > sent ? period : sent );
+        }
+    }
+
+    // we should never reach this point!
+
+    cwrites( "+++ traced done !?!?!\n" );
+
+    exit( 1 );
+
+    return( 42 );  // shut the compiler up!
+}
+
+#endif
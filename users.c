@@ -129,6 +129,10 @@ int32_t userY( uint32_t, uint32_t ); int32_t userZ( uint32_t, uint32_t );
 #include "userland/userV.c"
 #endif
 
+#if defined(SPAWN_BENCH)
+#include "userland/fsbench.c"
+#endif
+
 /*
 ** System processes - these should always be included here
 */
@@ -136,3 +140,11 @@ int32_t userY( uint32_t, uint32_t ); int32_t userZ( uint32_t, uint32_t );
 #include "userland/init.c"
 
 #include "userland/idle.c"
+
+#ifdef PROFILE
+#include "userland/profd.c"
+#endif
+
+#ifdef IOTRACE
+#include "userland/traced.c"
+#endif
@@ -91,6 +91,12 @@
 // called exit() but continued to run), it will usually return a status
 // of 42.
 //
+// A system built with BENCH defined (see "make bench") runs only the
+// file system benchmark instead.
+//
+#ifdef BENCH
+#define SPAWN_BENCH
+#else
 #define SPAWN_A
 #define SPAWN_B
 #define SPAWN_C
@@ -113,6 +119,14 @@
 #define SPAWN_T
 #define SPAWN_U
 #define SPAWN_V
+#endif
+
+//
+// The file system benchmark writes its results to the SIO, and is
+// best run with nothing else going on; define SPAWN_BENCH here (or
+// with -DSPAWN_BENCH) to start it alongside the others.
+//
+// #define SPAWN_BENCH
 
 //
 // Users W-Z are spawned from other processes; they
@@ -141,6 +155,33 @@ int32_t init( uint32_t arg1, uint32_t arg2 );
 */
 int32_t idle( uint32_t arg1, uint32_t arg2 );
 
+/**
+** profd - drains the kernel profiler's samples to the SIO
+**
+** Only present when the system is built with PROFILE defined
+**
+** Invoked as:  profd  x  n
+*/
+int32_t profd( uint32_t arg1, uint32_t arg2 );
+
+/**
+** traced - drains the kernel's I/O trace to the SIO
+**
+** Only present when the system is built with IOTRACE defined
+**
+** Invoked as:  traced  x  n
+*/
+int32_t traced( uint32_t arg1, uint32_t arg2 );
+
+/**
+** fsbench - times file system calls and reports the results on the SIO
+**
+** Only present when SPAWN_BENCH is defined
+**
+** Invoked as:  fsbench  x  n
+*/
+int32_t fsbench( uint32_t arg1, uint32_t arg2 );
+
 #endif
 /* SP_ASM_SRC */
 
@@ -45,6 +45,7 @@
 #define	TIMER_0_NDIV		TIMER_MODE_2	/* divide-by-N counter */
 #define	TIMER_0_SQUARE		TIMER_MODE_3	/* square-wave mode */
 #define	TIMER_0_ENDSIGNAL		0x00	/* assert OUT at end of count */
+#define	TIMER_0_LATCH			0x00	/* latch the current count */
 
 /* Timer 1 settings */
 
@@ -57,6 +58,12 @@
 #define	TIMER_2_READ			0x30	/* read/load LSB then MSB */
 #define	TIMER_2_RATE			0x06	/* square-wave, for USART */
 
+/* Timer 2 gate and output, in the system control port */
+#define	TIMER_2_GATE_PORT		0x61	/* system control port B */
+#define	TIMER_2_GATE			0x01	/* enable counting */
+#define	TIMER_2_SPEAKER			0x02	/* connect OUT to the speaker */
+#define	TIMER_2_OUT			0x20	/* current state of OUT */
+
 /* Timer read-back */
 #define	TIMER_READBACK			0xc0	/* perform a read-back */
 #define	TIMER_RB_NOT_COUNT		0x20	/* don't latch the count */